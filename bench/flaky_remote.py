@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+"""
+Benchmark `ldh update` against a flaky remote.
+
+Serves a synthetic repository through `git daemon`, behind a TCP proxy that cuts the first few connections after
+a fixed number of bytes, and reports how long `ldh` took to get a complete checkout and how many connections it
+needed to do so.
+
+Usage:
+    flaky_remote.py [-h] [--ldh BIN] [--commits N] [--blob-size BYTES] [--drop-after BYTES] [--drops N]
+                    [--retries N]
+
+Options:
+  --ldh BIN  Path to the `ldh` binary [default: ./ldh].
+  --commits N  Number of commits in the synthetic repository [default: 200].
+  --blob-size BYTES  Size of the (incompressible) file added by each commit [default: 65536].
+  --drop-after BYTES  Bytes the proxy lets through before cutting a connection [default: 1048576].
+  --drops N  Number of connections to cut before behaving [default: 3].
+  --retries N  Value for `ldh update --fetch-retries` [default: 4].
+  -h, --help  Print this help dialog.
+"""
+import os
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+from docopt import docopt
+
+
+######################################################
+# Stand-in remote
+######################################################
+
+
+def make_repository(base_dir: str, commits: int, blob_size: int) -> str:
+    work_dir = os.path.join(base_dir, 'work')
+    bare_dir = os.path.join(base_dir, 'served', 'repo.git')
+
+    subprocess.run(['git', 'init', '-q', '-b', 'main', work_dir], check=True)
+    for i in range(commits):
+        with open(os.path.join(work_dir, f'blob-{i}'), 'wb') as f:
+            f.write(os.urandom(blob_size))
+        subprocess.run(['git', '-C', work_dir, 'add', '.'], check=True)
+        subprocess.run(
+            ['git', '-C', work_dir, '-c', 'user.name=bench', '-c', 'user.email=bench@localhost',
+             'commit', '-q', '-m', f'commit {i}'],
+            check=True,
+        )
+        if i % 50 == 0:
+            subprocess.run(['git', '-C', work_dir, 'tag', f'v0.{i // 50}.0'], check=True)
+
+    subprocess.run(['git', 'clone', '-q', '--bare', work_dir, bare_dir], check=True)
+    return os.path.dirname(bare_dir)
+
+
+def free_port() -> int:
+    with socket.socket() as s:
+        s.bind(('127.0.0.1', 0))
+        return s.getsockname()[1]
+
+
+class FlakyProxy(threading.Thread):
+    """Forwards connections to `upstream_port`. The first `drops` connections are closed once `drop_after`
+    bytes have been sent back to the client.
+    """
+
+    def __init__(self, port: int, upstream_port: int, drop_after: int, drops: int):
+        super().__init__(daemon=True)
+        self.port = port
+        self.upstream_port = upstream_port
+        self.drop_after = drop_after
+        self.drops_left = drops
+        self.connections = 0
+        self.bytes_sent = 0
+        self.lock = threading.Lock()
+
+    def run(self):
+        server = socket.socket()
+        server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        server.bind(('127.0.0.1', self.port))
+        server.listen()
+
+        while True:
+            client, _ = server.accept()
+            with self.lock:
+                self.connections += 1
+                should_drop = self.drops_left > 0
+                self.drops_left -= 1 if should_drop else 0
+
+            upstream = socket.create_connection(('127.0.0.1', self.upstream_port))
+            threading.Thread(target=self.pipe, args=(client, upstream, None), daemon=True).start()
+            threading.Thread(
+                target=self.pipe, args=(upstream, client, self.drop_after if should_drop else None), daemon=True,
+            ).start()
+
+    def pipe(self, src: socket.socket, dst: socket.socket, limit):
+        sent = 0
+        try:
+            while True:
+                data = src.recv(65536)
+                if not data:
+                    break
+                if limit is not None and sent + len(data) > limit:
+                    break
+                dst.sendall(data)
+                sent += len(data)
+        except OSError:
+            pass
+        finally:
+            with self.lock:
+                self.bytes_sent += sent
+            for s in (src, dst):
+                try:
+                    s.shutdown(socket.SHUT_RDWR)
+                except OSError:
+                    pass
+                s.close()
+
+
+######################################################
+# Main logic
+######################################################
+
+
+CONFIG_TEMPLATE = '''[package]
+name = "flaky-remote-bench"
+version = "0.1.0"
+authors = ["bench"]
+
+[dependencies]
+flaky = {{git = "git://127.0.0.1:{port}/repo.git"}}
+'''
+
+
+def main(arguments):
+    ldh = os.path.abspath(arguments['--ldh'])
+
+    with tempfile.TemporaryDirectory() as base_dir:
+        served_dir = make_repository(base_dir, int(arguments['--commits']), int(arguments['--blob-size']))
+
+        daemon_port = free_port()
+        daemon = subprocess.Popen(
+            ['git', 'daemon', '--reuseaddr', '--export-all', f'--base-path={served_dir}', f'--port={daemon_port}',
+             '--listen=127.0.0.1', served_dir],
+        )
+        time.sleep(0.5)
+
+        proxy = FlakyProxy(free_port(), daemon_port, int(arguments['--drop-after']), int(arguments['--drops']))
+        proxy.start()
+
+        project_dir = os.path.join(base_dir, 'project')
+        os.makedirs(project_dir)
+        with open(os.path.join(project_dir, 'ldh.toml'), 'w') as f:
+            f.write(CONFIG_TEMPLATE.format(port=proxy.port))
+
+        try:
+            start = time.monotonic()
+            result = subprocess.run(
+                [ldh, 'update', 'ldh.toml', '--no-progress', '--fetch-retries', arguments['--retries']],
+                cwd=project_dir,
+            )
+            elapsed = time.monotonic() - start
+        finally:
+            daemon.terminate()
+            daemon.wait()
+
+        checkout = os.path.join(project_dir, 'target', 'dependencies', 'flaky-latest')
+        complete = result.returncode == 0 and os.path.isdir(checkout) and len(os.listdir(checkout)) > 1
+
+        print(f'exit code:   {result.returncode}')
+        print(f'complete:    {complete}')
+        print(f'wall time:   {elapsed:.2f}s')
+        print(f'connections: {proxy.connections}')
+        print(f'bytes sent:  {proxy.bytes_sent}')
+
+        return 0 if complete else 1
+
+
+if __name__ == '__main__':
+    arguments = docopt(__doc__)
+    sys.exit(main(arguments))
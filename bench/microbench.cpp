@@ -0,0 +1,377 @@
+/* Microbenchmarks for the parsing, matching and serialization kernels.
+ *
+ * Everything runs in-process on synthetic inputs (no git, no network), across a range of input sizes, reporting
+ * the time and heap allocations per operation, and how the former scales with the input: a `scaling` of ~1.0
+ * between two sizes means linear growth, ~2.0 quadratic.
+ *
+ * Usage:
+ *     make bench && ./ldh-bench [filter]
+ *
+ * Only benchmarks whose name contains `filter` are run.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <new>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "application_context.hpp"
+#include "configuration_io.cpp"
+#include "dependency_resolver.cpp"
+#include "lock_journal.cpp"
+#include "logger_manager.hpp"
+#include "manifest_cache.cpp"
+#include "progress_reporter.cpp"
+#include "resolution_scheduler.cpp"
+
+
+namespace fs = std::filesystem;
+
+typedef chrono::steady_clock bench_clock;
+
+// each size is measured for at least this long (and at least `MIN_BENCHMARK_ITERATIONS` times)
+const chrono::milliseconds MIN_BENCHMARK_DURATION = chrono::milliseconds(200);
+const size_t MIN_BENCHMARK_ITERATIONS = 3;
+
+
+/***************************************************
+ * Allocation counting
+ ***************************************************/
+
+
+atomic<size_t> allocationCount{0};
+
+
+void* operator new(size_t size) {
+    allocationCount.fetch_add(1, memory_order_relaxed);
+
+    if (void* memory = malloc(size ? size : 1)) {
+        return memory;
+    }
+
+    throw bad_alloc();
+}
+
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+
+void operator delete(void* memory, size_t) noexcept {
+    free(memory);
+}
+
+
+/***************************************************
+ * Harness
+ ***************************************************/
+
+
+// `prepare` runs before every iteration, outside of the measurement, for kernels that consume or modify their
+// input; `run` is the operation being measured.
+struct benchmark_case {
+    function<void()> prepare;
+    function<void()> run;
+};
+
+
+struct benchmark {
+    const char* name;
+    vector<size_t> sizes;
+    function<benchmark_case(size_t)> setup;
+};
+
+
+struct benchmark_result {
+    double nanosecondsPerOperation;
+    double allocationsPerOperation;
+};
+
+
+benchmark_result Measure(benchmark_case& bc) {
+    // warm-up, so that one-off costs (e.g. first-touch of buffers) are not attributed to the kernel
+    if (bc.prepare) {
+        bc.prepare();
+    }
+    bc.run();
+
+    chrono::nanoseconds measuredTime{0};
+    size_t measuredAllocations = 0;
+    size_t iterations = 0;
+
+    while (iterations < MIN_BENCHMARK_ITERATIONS || measuredTime < MIN_BENCHMARK_DURATION) {
+        if (bc.prepare) {
+            bc.prepare();
+        }
+
+        size_t allocationsBefore = allocationCount.load(memory_order_relaxed);
+        bench_clock::time_point startTime = bench_clock::now();
+        bc.run();
+        measuredTime += bench_clock::now() - startTime;
+        measuredAllocations += allocationCount.load(memory_order_relaxed) - allocationsBefore;
+
+        iterations++;
+    }
+
+    return { (double) measuredTime.count() / iterations, (double) measuredAllocations / iterations };
+}
+
+
+void RunBenchmark(benchmark& b) {
+    double previousTime = 0;
+    size_t previousSize = 0;
+
+    for (size_t size : b.sizes) {
+        benchmark_case bc = b.setup(size);
+        benchmark_result result = Measure(bc);
+
+        string scaling = "-";
+        if (previousSize) {
+            double exponent = log(result.nanosecondsPerOperation / previousTime) / log((double) size / previousSize);
+
+            char buffer[16];
+            snprintf(buffer, sizeof(buffer), "%.2f", exponent);
+            scaling = buffer;
+        }
+
+        printf("%-32s %8zu %16.0f %12.1f %8s\n", b.name, size, result.nanosecondsPerOperation,
+               result.allocationsPerOperation, scaling.c_str());
+
+        previousTime = result.nanosecondsPerOperation;
+        previousSize = size;
+    }
+}
+
+
+/***************************************************
+ * Synthetic inputs
+ ***************************************************/
+
+
+// `count` distinct semver tags, none of them above 7.0.0; `lastTag` (if any) is appended after them.
+tag_list MakeTags(size_t count, const string& lastTag = "") {
+    tag_list tags;
+
+    vector<size_t> offsets;
+    offsets.reserve(count + 2);
+    for (size_t i = 0; i < count; i++) {
+        offsets.push_back(tags.arena.size());
+        tags.arena += to_string(i % 7) + "." + to_string((i / 7) % 50) + "." + to_string(i / 350);
+    }
+    if (!lastTag.empty()) {
+        offsets.push_back(tags.arena.size());
+        tags.arena += lastTag;
+    }
+    offsets.push_back(tags.arena.size());
+
+    tags.names.reserve(offsets.size() - 1);
+    for (size_t i = 0; i + 1 < offsets.size(); i++) {
+        tags.names.emplace_back(tags.arena.data() + offsets[i], offsets[i + 1] - offsets[i]);
+    }
+
+    return tags;
+}
+
+
+string DependencyName(size_t index) {
+    return "dependency-" + to_string(index);
+}
+
+
+string MakeManifest(size_t dependencyCount) {
+    ostringstream manifest;
+    manifest << "[package]\nname = \"bench\"\nversion = \"0.1.0\"\nauthors = [\"ldh\"]\n\n[dependencies]\n";
+
+    for (size_t i = 0; i < dependencyCount; i++) {
+        string source = "https://example.com/org/" + DependencyName(i) + ".git";
+        switch (i % 4) {
+            case 0:
+                {
+                    manifest << DependencyName(i) << " = {git = \"" << source << "\"}\n";
+                    break;
+                }
+            case 1:
+                {
+                    manifest << DependencyName(i) << " = {git = \"" << source << "\", branch = \"main\"}\n";
+                    break;
+                }
+            case 2:
+                {
+                    manifest << DependencyName(i) << " = {git = \"" << source << "\", version = \">=1.2.0\"}\n";
+                    break;
+                }
+            default:
+                {
+                    manifest << DependencyName(i) << " = {git = \"" << source << "\", tag = \"v1.0.0\"}\n";
+                    break;
+                }
+        }
+    }
+
+    return manifest.str();
+}
+
+
+configuration MakeConfiguration(size_t dependencyCount) {
+    configuration config;
+    config.packageInformation = { "bench", "0.1.0", { "ldh" } };
+
+    config.dependencies.resize(dependencyCount);
+    for (size_t i = 0; i < dependencyCount; i++) {
+        dependency& dep = config.dependencies[i];
+        dep.name = DependencyName(i);
+
+        dep.inputDependency.sourceType = source_type::SOURCE_TYPE_GIT;
+        dep.inputDependency.source = "https://example.com/org/" + dep.name + ".git";
+        dep.inputDependency.specifiedVersion.type = version_type::VERSION_TYPE_TAG;
+        dep.inputDependency.specifiedVersion.exact = "v1.0.0";
+    }
+
+    return config;
+}
+
+
+// A lock for `MakeConfiguration(dependencyCount)`, plus one stale entry for every ten dependencies.
+string MakeLock(size_t dependencyCount) {
+    ostringstream lock;
+
+    size_t entryCount = dependencyCount + dependencyCount / 10;
+    for (size_t i = 0; i < entryCount; i++) {
+        string name = i < dependencyCount ? DependencyName(i) : "stale-" + to_string(i);
+
+        lock << "[[packages]]\n" <<
+            "name = \"" << name << "\"\n" <<
+            "version = \"0123456789abcdef0123456789abcdef01234567\"\n" <<
+            "source = \"https://example.com/org/" << name << ".git\"\n" <<
+            "path = \"" << application_context::dependencyPathPrefix << name << "-v1.0.0\"\n\n";
+    }
+
+    return lock.str();
+}
+
+
+void FillLockDependencies(configuration& config) {
+    for (dependency& dep : config.dependencies) {
+        dep.lockDependency.localPath = application_context::dependencyPathPrefix + dep.name + "-v1.0.0";
+        dep.lockDependency.resolvedSource = dep.inputDependency.source;
+        dep.lockDependency.resolvedVersion = "0123456789abcdef0123456789abcdef01234567";
+    }
+}
+
+
+/***************************************************
+ * Benchmarks
+ ***************************************************/
+
+
+vector<benchmark> MakeBenchmarks(application_context& ctx, const string& scratchDirectory) {
+    vector<size_t> tagCounts = { 10, 100, 1000, 10000 };
+    vector<size_t> dependencyCounts = { 10, 100, 1000, 5000 };
+
+    return {
+        {"VersionsMatch/exact", tagCounts, [](size_t size) {
+            auto tags = make_shared<tag_list>(MakeTags(size));
+            auto version = make_shared<version_t>();
+            version->type = version_type::VERSION_TYPE_TAG;
+            version->exact = "does-not-exist";
+
+            return benchmark_case{ nullptr, [tags, version] {
+                for (string_view tag : tags->names) {
+                    version->VersionsMatch(tag);
+                }
+            }};
+        }},
+        {"VersionsMatch/range", tagCounts, [](size_t size) {
+            auto tags = make_shared<tag_list>(MakeTags(size));
+            auto version = make_shared<version_t>();
+            version->type = version_type::VERSION_TYPE_SEMVER;
+            version->FromString(">=1.2.0");
+
+            return benchmark_case{ nullptr, [tags, version] {
+                for (string_view tag : tags->names) {
+                    version->VersionsMatch(tag);
+                }
+            }};
+        }},
+        // the tag-matching half of `MatchVersionRange`, with the only match last (its worst case)
+        {"MatchVersionRange", tagCounts, [&ctx](size_t size) {
+            auto tags = make_shared<tag_list>(MakeTags(size - 1, "100.0.0"));
+            auto version = make_shared<version_t>();
+            version->type = version_type::VERSION_TYPE_SEMVER;
+            version->FromString(">=100.0.0");
+
+            return benchmark_case{ nullptr, [&ctx, tags, version] {
+                FindMatchingTag(ctx, *version, *tags);
+            }};
+        }},
+        // reconciliation moves entries out of the lock and appends stale ones to the configuration, so both are
+        // rebuilt before every iteration
+        {"ReconcileConfigurationAndLock", dependencyCounts, [&ctx](size_t size) {
+            auto pristine = make_shared<configuration>(MakeConfiguration(size));
+            auto config = make_shared<configuration>();
+            auto lockDict = make_shared<dict_like_config>(toml::parse(MakeLock(size)));
+            auto lockEntries = make_shared<vector<dependency>>();
+
+            return benchmark_case{
+                [pristine, config, lockDict, lockEntries] {
+                    *config = *pristine;
+                    *lockEntries = ParseLockEntries(*lockDict);
+                },
+                [&ctx, config, lockEntries] {
+                    ReconcileConfigurationAndLock(ctx, *config, *lockEntries);
+                },
+            };
+        }},
+        {"configuration::FromDictLike", dependencyCounts, [](size_t size) {
+            auto manifestDict = make_shared<dict_like_config>(toml::parse(MakeManifest(size)));
+
+            return benchmark_case{ nullptr, [manifestDict] {
+                configuration::FromDictLike(*manifestDict);
+            }};
+        }},
+        {"WriteConfiguration", dependencyCounts, [&ctx, scratchDirectory](size_t size) {
+            auto config = make_shared<configuration>(MakeConfiguration(size));
+            FillLockDependencies(*config);
+            auto lockPath = make_shared<string>(scratchDirectory + "/ldh.lock");
+
+            return benchmark_case{ nullptr, [&ctx, config, lockPath] {
+                WriteConfiguration(ctx, *lockPath, *config);
+            }};
+        }},
+    };
+}
+
+
+int main(int argc, char* argv[]) {
+    application_context ctx = application_context();
+    ctx.binaryName = string(argv[0]);
+    ctx.applicationLogger = logger_manager::GetInstance()->GetLogger(APPLICATION_LOGGER_NAME);
+    ctx.userLogger = logger_manager::GetInstance()->GetLogger(USER_LOGGER_NAME);
+    ctx.args = new execution_arguments();
+
+    string filter = argc > 1 ? string(argv[1]) : "";
+
+    string scratchDirectory = (fs::temp_directory_path() / ("ldh-bench." + to_string(getpid()))).string();
+    fs::create_directories(scratchDirectory);
+
+    printf("%-32s %8s %16s %12s %8s\n", "benchmark", "size", "ns/op", "allocs/op", "scaling");
+    for (benchmark& b : MakeBenchmarks(ctx, scratchDirectory)) {
+        if (string(b.name).find(filter) != string::npos) {
+            RunBenchmark(b);
+        }
+    }
+
+    std::error_code removalError;
+    fs::remove_all(scratchDirectory, removalError);
+
+    return 0;
+}
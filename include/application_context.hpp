@@ -1,6 +1,23 @@
 #if !defined(APPLICATION_CONTEXT_H)
+#include "cancellation_token.hpp"
 #include "command_line.hpp"
 #include "logger_manager.hpp"
+#include "progress_reporter.hpp"
+#include "resolution_scheduler.hpp"
+#include "run_metrics.hpp"
+#include "thread_pool.hpp"
+
+class lock_journal;
+class url_rewriter;
+
+// shared with `libldh`'s callers, which is why they live in the `ldh` namespace
+using ldh::cancellation_token;
+using ldh::job_group;
+using ldh::thread_pool;
+
+
+const std::string LDH_VERSION = "0.1.0";
+
 
 struct application_context {
     std::string binaryName;
@@ -8,13 +25,76 @@ struct application_context {
     logger_ptr applicationLogger;
     logger_ptr userLogger;
 
+    // `nullptr` when progress reporting is disabled
+    progress_reporter* progress;
+
+    // `nullptr` when resolution work is not limited
+    resolution_scheduler* scheduler;
+
+    // `nullptr` unless metrics were requested
+    run_metrics* metrics;
+
+    // `nullptr` unless resolutions are being journaled (see `lock_journal.hpp`)
+    lock_journal* journal;
+
+    // `nullptr` unless mirrors are configured (see `url_rewrite.hpp`)
+    url_rewriter* mirrors;
+
+    // `nullptr` unless the caller brings its own (`libldh`, see `ldh.hpp`), in which case resolution jobs run there
+    thread_pool* pool;
+
+    // `nullptr` unless the run can be cancelled (see `cancellation_token.hpp`)
+    const cancellation_token* cancellation;
+
     execution_arguments* args;
 
+    // Where checkouts go, and what the paths in the lock file are relative to. Empty for the working directory.
+    std::string projectRoot;
+
     static const std::string dependencyPathPrefix;
 
+    bool Cancelled() const {
+        return this->cancellation && this->cancellation->Cancelled();
+    }
+
+    // `path`, as recorded in the lock file, as a path the process can use
+    std::string ProjectPath(const std::string& path) const {
+        if (this->projectRoot.empty() || path.empty() || path[0] == '/') {
+            return path;
+        }
+
+        return this->projectRoot + "/" + path;
+    }
+
+    // the reverse of `ProjectPath`
+    std::string RelativeToProjectRoot(const std::string& path) const {
+        if (this->projectRoot.empty() || path.compare(0, this->projectRoot.size(), this->projectRoot) ||
+            path.size() <= this->projectRoot.size() || path[this->projectRoot.size()] != '/') {
+            return path;
+        }
+
+        return path.substr(this->projectRoot.size() + 1);
+    }
+
+    std::string DependencyPathPrefix() const {
+        return this->ProjectPath(dependencyPathPrefix);
+    }
+
     std::string GetLockFilePath() {
         return this->args->lockFilePath;
     }
+
+    slot_pool* TransferSlots(const std::string& remoteUrl) {
+        return this->scheduler ? this->scheduler->TransferSlots(remoteUrl) : nullptr;
+    }
+
+    slot_pool* DiskSlots() {
+        return this->scheduler ? this->scheduler->DiskSlots() : nullptr;
+    }
+
+    memory_pool* JobMemory() {
+        return this->scheduler ? this->scheduler->JobMemory() : nullptr;
+    }
 };
 
 // C++ is not fun.
@@ -0,0 +1,155 @@
+/* Archive dependencies, i.e. `name = {archive = "<url>", sha256 = "<hex digest>"}`.
+ *
+ * Archives are never held in memory as a whole: each chunk of the download goes through the SHA-256 hasher, into
+ * the download cache, through decompression (gzip or zstd, told apart by their magic bytes, or none for a plain
+ * tar) and into the tar extractor, in that order. The checksum is only known once the last chunk is in, so
+ * extraction happens in a staging directory, which (like the cache entry) is discarded on a mismatch.
+ *
+ * Downloads are cached by checksum under `$LDH_HOME/cache/archives`, so that an archive is only downloaded once per
+ * host, whichever project needs it. Cached archives are verified again whenever they are extracted.
+ */
+
+#if !defined(ARCHIVE_LIB_H)
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <zlib.h>
+#include <zstd.h>
+
+#include "application_context.hpp"
+#include "file_lock.hpp"
+#include "git_lib.hpp"
+#include "sha256.hpp"
+
+using namespace std;
+
+
+const size_t ARCHIVE_IO_BUFFER_SIZE = 1 << 16;
+const size_t TAR_BLOCK_SIZE = 512;
+
+// Upper bound for GNU long names and pax extended headers, which are buffered in memory.
+const size_t TAR_MAX_METADATA_SIZE = 1 << 20;
+
+// Largest zstd window decompressed (128 MiB, zstd's own default limit), which frames compressed with `--long=28` or
+// more exceed. Gzip windows are a fixed 32 KiB.
+const int ARCHIVE_ZSTD_WINDOW_LOG_MAX = 27;
+
+// Working set assumed for admission against the memory budget (see `resolution_scheduler.hpp`) while an archive is
+// extracted: the largest zstd window, plus I/O buffers and tar metadata.
+const size_t ARCHIVE_MEMORY_ESTIMATE = ((size_t) 1 << ARCHIVE_ZSTD_WINDOW_LOG_MAX) + (4 << 20);
+
+const long ARCHIVE_CONNECT_TIMEOUT_SECONDS = 30;
+// Downloads slower than 1 byte/s for this long are aborted (and retried).
+const long ARCHIVE_STALL_TIMEOUT_SECONDS = 60;
+
+
+// Streaming extractor for ustar archives, including GNU long names and pax `path`/`linkpath`/`size` overrides.
+class tar_extractor {
+    public:
+        string error;
+        size_t extractedFiles = 0;
+
+        tar_extractor(string r): root(r) {}
+
+        bool Feed(const char*, size_t);
+        bool Finish();
+
+    private:
+        enum class extractor_state {
+            HEADER,
+            CONTENTS,
+            PADDING,
+            END,
+        };
+
+        enum class entry_kind {
+            FILE,
+            METADATA,
+            SKIPPED,
+        };
+
+        std::filesystem::path root;
+        extractor_state state = extractor_state::HEADER;
+
+        char header[TAR_BLOCK_SIZE];
+        size_t headerLength = 0;
+
+        entry_kind currentKind = entry_kind::SKIPPED;
+        char currentType = '\0';
+        uint64_t contentsRemaining = 0;
+        uint64_t paddingRemaining = 0;
+        ofstream currentFile;
+        std::filesystem::path currentPath;
+        std::filesystem::perms currentPermissions;
+        string metadata;
+
+        // set by GNU long name (`L`/`K`) and pax (`x`) entries, for the entry that follows them only
+        string nextPath;
+        string nextLinkPath;
+        bool hasNextSize = false;
+        uint64_t nextSize = 0;
+
+        // entries below a symlink would be written wherever it points to
+        unordered_set<string> symlinks;
+        vector<pair<std::filesystem::path, std::filesystem::perms>> directoryPermissions;
+
+        bool ProcessHeader();
+        bool BeginEntry(const string&, const string&, uint64_t);
+        bool EndEntry();
+        bool ParsePaxHeader();
+        bool IsBelowSymlink(const std::filesystem::path&);
+        bool Fail(string);
+};
+
+
+enum class archive_compression {
+    ARCHIVE_COMPRESSION_UNKNOWN = 0,
+    ARCHIVE_COMPRESSION_NONE,
+    ARCHIVE_COMPRESSION_GZIP,
+    ARCHIVE_COMPRESSION_ZSTD,
+};
+
+
+// Decompresses whatever it is fed into `extractor`, detecting the compression from the first bytes of the stream.
+class archive_decoder {
+    public:
+        string error;
+
+        archive_decoder(tar_extractor* e): extractor(e), outputBuffer(ARCHIVE_IO_BUFFER_SIZE) {}
+        ~archive_decoder();
+
+        bool Feed(const char*, size_t);
+        bool Finish();
+
+    private:
+        tar_extractor* extractor;
+        archive_compression compression = archive_compression::ARCHIVE_COMPRESSION_UNKNOWN;
+        string pendingInput;
+
+        z_stream inflateStream = {};
+        bool inflateInitialized = false;
+        bool inflateEnded = false;
+
+        ZSTD_DStream* zstdStream = nullptr;
+        size_t zstdLastResult = 0;
+
+        vector<char> outputBuffer;
+
+        bool DetectCompression();
+        bool Decode(const char*, size_t);
+        bool Forward(const char*, size_t);
+};
+
+
+string GetArchiveCacheDirectory();
+string GetArchiveCachePath(const string&);
+bool IsArchiveCached(const string&);
+
+resolution_result FetchArchive(application_context&, const string&, const string&, const string&);
+bool PrefetchArchive(application_context&, const string&, const string&);
+
+#define ARCHIVE_LIB_H
+#endif
@@ -0,0 +1,37 @@
+/* Change stamps for downstream incremental builds.
+ *
+ * After every lock write, each locked dependency gets a stamp file, `target/stamps/<name>.stamp` next to the
+ * lock, holding its resolved version (and the paths and commits of its submodules). Stamps are only rewritten
+ * when that content changes, so their mtime moves exactly when the checkout does. Build rules for anything that
+ * uses a dependency can then depend on its stamp rather than on the (huge, and always touched) checkout:
+ *
+ *     foo.o: foo.cpp target/stamps/fmt.stamp
+ *
+ * `target/dependencies.d` ties the lock to all stamps, in the depfile format understood by both make
+ * (`-include target/dependencies.d`) and ninja (`depfile = target/dependencies.d`), with an empty rule per stamp
+ * so that builds survive a dependency (and its stamp) being removed.
+ */
+
+#if !defined(BUILD_STAMPS_H)
+#include <string>
+#include <vector>
+
+#include "application_context.hpp"
+#include "dependency.hpp"
+
+using namespace std;
+
+
+const string STAMP_DIRECTORY_NAME = "target/stamps";
+const string STAMP_FILE_EXTENSION = ".stamp";
+const string DEPFILE_NAME = "target/dependencies.d";
+
+
+string GetStampDirectory(const string&);
+string GetStampPath(const string&, const string&);
+string GetDepfilePath(const string&);
+
+bool WriteBuildStamps(application_context&, const string&, vector<dependency>&);
+
+#define BUILD_STAMPS_H
+#endif
@@ -0,0 +1,46 @@
+/* Bundles hold the resolved dependencies of a lock file in a single zstd-compressed stream, so that they can be
+ * restored on another machine without talking to any git server.
+ *
+ * After a header (`BUNDLE_MAGIC` and the format version), the stream is a sequence of tagged records: a package
+ * record, carrying the package's lock entry, is followed by the directory, file and symlink records of its
+ * checkout, with paths relative to the checkout's root. An end record closes the stream. Files are written as
+ * their size followed by their contents, so both ends stream them in fixed size chunks.
+ */
+
+#if !defined(BUNDLE_H)
+#include <string>
+
+#include "application_context.hpp"
+
+using namespace std;
+
+
+const uint32_t BUNDLE_FORMAT_VERSION = 2;
+
+// Size of the buffers used for compressed and uncompressed I/O.
+const size_t BUNDLE_IO_BUFFER_SIZE = 256 * 1024;
+
+// zstd's own default: checkouts are mostly git packs, which barely compress any further.
+const int BUNDLE_ZSTD_LEVEL = 3;
+
+// Upper bound for file contents read ahead of the threads writing them out during an import. Files larger than
+// this are written by the reading thread itself.
+const size_t BUNDLE_MAX_BUFFERED_BYTES = 64 * 1024 * 1024;
+
+
+enum class bundle_record: uint8_t {
+    BUNDLE_RECORD_END = 0,
+    BUNDLE_RECORD_PACKAGE,
+    BUNDLE_RECORD_DIRECTORY,
+    BUNDLE_RECORD_FILE,
+    BUNDLE_RECORD_SYMLINK,
+};
+
+
+// `gitOnly` limits the export to each checkout's `.git` directory; the work trees are then checked out again
+// during the import.
+bool ExportBundle(application_context&, string&, string&, bool gitOnly);
+bool ImportBundle(application_context&, string&, string&);
+
+#define BUNDLE_H
+#endif
@@ -0,0 +1,27 @@
+/* Lets whoever started a run (a `libldh` caller, see `ldh.hpp`) ask for it to stop early. Cancellation is
+ * cooperative: transfers and checkouts already under way run to completion, but no new dependency, submodule, or
+ * fetch attempt is started, and nothing is retried. Work that did complete is still recorded in the lock file.
+ */
+
+#if !defined(CANCELLATION_TOKEN_H)
+#include <atomic>
+
+
+namespace ldh {
+    class cancellation_token {
+        public:
+            void Cancel() {
+                this->cancelled.store(true, std::memory_order_relaxed);
+            }
+
+            bool Cancelled() const {
+                return this->cancelled.load(std::memory_order_relaxed);
+            }
+
+        private:
+            std::atomic<bool> cancelled = false;
+    };
+}
+
+#define CANCELLATION_TOKEN_H
+#endif
@@ -2,15 +2,72 @@
 #include "clipp.h"
 
 
+const unsigned int DEFAULT_FETCH_RETRIES = 4;
+const unsigned int DEFAULT_RESOLUTION_JOBS = 8;
+const unsigned int DEFAULT_TRANSFERS_PER_HOST = 4;
+const unsigned int DEFAULT_DISK_JOBS = 2;
+
+
 enum mode {
     MODE_HELP = 0,
     MODE_VALIDATE,
     MODE_UPDATE,
+    MODE_PLAN,
     MODE_INSTALL,
+    MODE_GC,
+    MODE_WORKSPACE,
+    MODE_BUNDLE_EXPORT,
+    MODE_BUNDLE_IMPORT,
+    MODE_FETCH,
 
     MODE_CNT,
 };
 
+constexpr const char* ModeToString(mode m) {
+    switch (m) {
+        case MODE_VALIDATE:
+            {
+                return "validate";
+            }
+        case MODE_UPDATE:
+            {
+                return "update";
+            }
+        case MODE_PLAN:
+            {
+                return "plan";
+            }
+        case MODE_INSTALL:
+            {
+                return "install";
+            }
+        case MODE_GC:
+            {
+                return "gc";
+            }
+        case MODE_WORKSPACE:
+            {
+                return "workspace";
+            }
+        case MODE_BUNDLE_EXPORT:
+            {
+                return "bundle-export";
+            }
+        case MODE_BUNDLE_IMPORT:
+            {
+                return "bundle-import";
+            }
+        case MODE_FETCH:
+            {
+                return "fetch";
+            }
+        default:
+            {
+                return "help";
+            }
+    }
+}
+
 struct execution_arguments {
     clipp::group* cli;
 
@@ -18,6 +75,22 @@ struct execution_arguments {
 
     std::string configurationFilePath;
     std::string lockFilePath;
+    std::string bundleFilePath;
+    std::string metricsFilePath;
+    std::string memoryBudget;
+
+    std::vector<std::string> validationPaths;
+
+    bool dryRun;
+    bool noProgress;
+    bool noManifestCache;
+    bool gitOnly;
+    bool refresh;
+
+    unsigned int fetchRetries;
+    unsigned int jobs;
+    unsigned int transfersPerHost;
+    unsigned int diskJobs;
 };
 
 
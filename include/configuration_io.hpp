@@ -36,26 +36,31 @@ configuration_modes operator &(configuration_modes lhs, configuration_modes rhs)
 
 struct configuration {
     package_information packageInformation;
-    vector<dependency*> dependencies;
+    vector<dependency> dependencies;
 
     void ParsePackageSection(section packageSection);
     void ParseDependenciesSection(section dependenciesSection);
 
-    static configuration* FromDictLike(dict_like_config& dictLike) {
-        configuration* config = new configuration();
-        config->ParsePackageSection(dictLike["package"]);
-        config->ParseDependenciesSection(dictLike["dependencies"]);
+    static configuration FromDictLike(dict_like_config& dictLike) {
+        configuration config;
+        config.ParsePackageSection(dictLike["package"]);
+        config.ParseDependenciesSection(dictLike["dependencies"]);
 
         return config;
     }
 };
 
 
-configuration* ParseConfiguration(application_context&, string&, configuration_modes);
-bool CheckConfiguration(application_context&, configuration*, configuration_modes);
-configuration* ParseAndCheckConfiguration(application_context&, string&, configuration_modes);
+string GenerateLockFilePath(string);
 
-bool WriteConfiguration(application_context&, string&, configuration*);
+vector<dependency> ParseLockEntries(dict_like_config&);
+bool ReadLockFile(application_context&, string&, vector<dependency>&);
+
+bool ParseConfiguration(application_context&, string&, configuration_modes, configuration&);
+bool CheckConfiguration(application_context&, configuration&, configuration_modes);
+bool ParseAndCheckConfiguration(application_context&, string&, configuration_modes, configuration&);
+
+bool WriteConfiguration(application_context&, string&, configuration&);
 
 #define CONFIGURATION_PARSER_H
 #endif
@@ -1,9 +1,16 @@
 #if !defined(DEPENDENCY_H)
 
+#include <string>
+#include <string_view>
+#include <vector>
+
 #include "semver.hpp"
 
+using namespace std;
+
 enum class source_type {
     SOURCE_TYPE_GIT = 0,
+    SOURCE_TYPE_ARCHIVE,
     SOURCE_TYPE_UNKNOWN,
 
     SOURCE_TYPE_COUNT,
@@ -16,6 +23,10 @@ constexpr const char* SourceTypeToString(source_type s) {
             {
                 return "git";
             }
+        case source_type::SOURCE_TYPE_ARCHIVE:
+            {
+                return "archive";
+            }
         default:
             {
                 return "";
@@ -30,6 +41,8 @@ enum class version_type {
     VERSION_TYPE_BRANCH,
     VERSION_TYPE_TAG,
     VERSION_TYPE_COMMIT_HASH,
+    // archives are pinned by the SHA-256 of their (compressed) contents
+    VERSION_TYPE_CHECKSUM,
 
     VERSION_TYPE_COUNT,
 };
@@ -54,7 +67,7 @@ struct version_t {
         this->versionRange = "";
     }
 
-    void FromString(string v) {
+    void FromString(const string& v) {
         if (this->IsExact() || this->IsExactSemVer(v)) {
             this->exact = v;
 
@@ -64,7 +77,7 @@ struct version_t {
         this->versionRange = v;
     }
 
-    bool VersionsMatch(string versionToMatch) {
+    bool VersionsMatch(string_view versionToMatch) {
         if (!this->exact.empty()) {
             return this->exact == versionToMatch;
         }
@@ -86,7 +99,7 @@ struct version_t {
         return this->type != version_type::VERSION_TYPE_SEMVER;
     }
 
-    bool IsExactSemVer(string v) {
+    bool IsExactSemVer(string_view v) {
         return semver::valid(v);
     }
 
@@ -102,6 +115,9 @@ struct input_dependency {
 
     version_t specifiedVersion;
 
+    // `submodules = true`: also check out (recursively) the submodules of git dependencies
+    bool submodules = false;
+
     bool HasValue() {
         return !(this->source.empty() && this->specifiedVersion.Empty());
     }
@@ -112,11 +128,21 @@ struct input_dependency {
 };
 
 
+// A submodule checked out inside a dependency, `path` being relative to the dependency's own checkout.
+struct locked_submodule {
+    string path;
+    string resolvedSource;
+    string resolvedVersion;
+};
+
+
 struct lock_dependency {
     string localPath;
     string resolvedSource;
     string resolvedVersion;
 
+    vector<locked_submodule> submodules;
+
     bool HasValue() {
         return !(this->localPath.empty() && this->resolvedSource.empty() && this->resolvedVersion.empty());
     }
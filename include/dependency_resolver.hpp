@@ -7,10 +7,14 @@
 #if !defined(DEPENDENCY_RESOLVER_H)
 #include "application_context.hpp"
 #include "configuration_io.hpp"
+#include "git_lib.hpp"
 #include "utils.hpp"
 
-void ResolveDependencies(application_context&, vector<dependency*>);
-vector<dependency*>* FilterUnmodified(application_context&, vector<dependency*>&);
+string FindMatchingTag(application_context&, version_t&, tag_list&);
+string GetLockedSemVerTag(dependency&);
+bool DeleteDependency(application_context&, dependency&);
+void ResolveDependencies(application_context&, vector<dependency>&);
+bool PrefetchDependencies(application_context&, vector<dependency>&);
 
 #define DEPENDENCY_RESOLVER_H
 #endif
@@ -0,0 +1,91 @@
+/* Advisory file locks (`flock`), so that concurrent `ldh` processes on one host can share dependency directories
+ * and caches.
+ *
+ * Every dependency checkout (`target/dependencies/foo-1.0`, and any checkout below one, e.g. submodules) and every
+ * archive cache entry has a lock file of its own, in a `.locks` directory next to it. Lock files are never removed,
+ * as removing one would let two processes lock different files for the same entry. Processes that only look at an
+ * existing entry hold its lock shared; creating, updating, moving or deleting an entry takes it exclusively.
+ * Checkouts below another one are only locked while holding the enclosing checkout's lock (shared), never the other
+ * way around.
+ *
+ * Checkouts are only recorded in a lock file once every one of them is resolved, so each project's dependency
+ * directory has a lock of its own as well: whatever creates checkouts in it holds that one shared until the lock files
+ * referring to them are registered (see `lock_registry.hpp`), and `ldh gc` holds it exclusively while collecting the
+ * directory.
+ *
+ * Locks are per open file, not per process: threads of the same process locking the same entry exclude each other
+ * as well.
+ */
+
+#if !defined(FILE_LOCK_H)
+#include <string>
+
+#include "application_context.hpp"
+
+using namespace std;
+
+
+const string FILE_LOCK_DIRECTORY_NAME = ".locks";
+const string FILE_LOCK_EXTENSION = ".lock";
+// not a valid checkout name, checkouts being named `<name>-<version>`
+const string PROJECT_LOCK_ENTRY = ".project";
+
+
+enum class file_lock_mode {
+    FILE_LOCK_SHARED = 0,
+    FILE_LOCK_EXCLUSIVE,
+};
+
+
+// Holds an advisory lock on a lock file until released or destroyed.
+class file_lock {
+    public:
+        file_lock() {}
+        file_lock(file_lock&& other): descriptor(other.descriptor), path(move(other.path)) {
+            other.descriptor = -1;
+        }
+        file_lock(const file_lock&) = delete;
+
+        ~file_lock() {
+            this->Release();
+        }
+
+        file_lock& operator=(file_lock&& other) {
+            if (this != &other) {
+                this->Release();
+                this->descriptor = other.descriptor;
+                this->path = move(other.path);
+                other.descriptor = -1;
+            }
+
+            return *this;
+        }
+        file_lock& operator=(const file_lock&) = delete;
+
+        // Waits for the lock. A lock that is already held is converted to `mode`; conversions are not atomic, so
+        // whatever the lock protects has to be looked at again after one.
+        bool Acquire(application_context&, const string&, file_lock_mode);
+        // Like `Acquire`, but gives up (returning false) instead of waiting for another holder.
+        bool TryAcquire(application_context&, const string&, file_lock_mode);
+        void Release();
+
+        bool Held() {
+            return this->descriptor >= 0;
+        }
+
+    private:
+        int descriptor = -1;
+        string path;
+
+        bool Open(application_context&, const string&);
+};
+
+
+string GetFileLockPath(const string&, const string&);
+string GetDependencyLockPath(application_context&, const string&);
+bool LockDependencyPath(application_context&, file_lock&, const string&, file_lock_mode);
+string GetProjectLockPath(const string&);
+bool LockProject(application_context&, file_lock&, file_lock_mode);
+
+#define FILE_LOCK_H
+#endif
@@ -0,0 +1,42 @@
+/* Things this entity is responsible for:
+ *  - figuring out which dependency checkouts on this host are still referenced by a registered lock file
+ *  - reclaiming the space taken up by everything else
+ */
+
+#if !defined(GARBAGE_COLLECTOR_H)
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "application_context.hpp"
+
+using namespace std;
+
+
+struct gc_entry {
+    string path;
+    uintmax_t sizeInBytes;
+    bool deleted;
+};
+
+
+struct gc_report {
+    vector<gc_entry> unreachableEntries;
+    size_t scannedEntries;
+    size_t failedDeletions;
+
+    uintmax_t ReclaimableBytes() {
+        uintmax_t total = 0;
+        for (gc_entry& entry : this->unreachableEntries) {
+            total += entry.sizeInBytes;
+        }
+
+        return total;
+    }
+};
+
+
+bool CollectGarbage(application_context&, bool);
+
+#define GARBAGE_COLLECTOR_H
+#endif
@@ -1,28 +1,176 @@
 #if !defined(GIT_LIB_H)
+#include <memory>
+#include <string_view>
+#include <unordered_map>
 
 #include "git2.h"
 
 #include "dependency.hpp"
+#include "progress_reporter.hpp"
 
 // NOTE `EMPTY()` macro used for cases where we want to return from a `void` method.
 #define EMPTY()
 #define GIT_LIB_ERROR_CHECK(lgr, op, rc, rv) \
     if ((rc)) { \
         (lgr)->error("libgit operation {} failed", op); \
-        (lgr)->error("Reason: {}", git_error_last()->message); \
+        (lgr)->error("Reason: {}", GetGitErrorMessage()); \
         return rv; \
     }
 
-#define GIT_LIB_SHUTDOWN_AND_RETURN(ctx, val) \
-    ShutdownLibrary((ctx)); \
-    return (val);
+
+// `git_error_last()` is `NULL` when nothing set an error, e.g. (before libgit2 1.8) a callback that failed.
+const char* GetGitErrorMessage() {
+    const git_error* error = git_error_last();
+    return error && error->message ? error->message : "unknown error";
+}
+
+
+// Owning wrapper around a libgit2 object, released through the matching `git_*_free` function. `Out()` is meant
+// to be passed wherever libgit2 expects a `T**` output parameter.
+template <typename T, void (*Free)(T*)>
+struct git_handle {
+    T* ptr;
+
+    git_handle(T* p = nullptr): ptr(p) {}
+    git_handle(git_handle&& other): ptr(other.ptr) {
+        other.ptr = nullptr;
+    }
+    git_handle(const git_handle&) = delete;
+
+    ~git_handle() {
+        this->Reset();
+    }
+
+    git_handle& operator=(git_handle&& other) {
+        if (this != &other) {
+            this->Reset(other.ptr);
+            other.ptr = nullptr;
+        }
+
+        return *this;
+    }
+    git_handle& operator=(const git_handle&) = delete;
+
+    T* Get() const {
+        return this->ptr;
+    }
+
+    T** Out() {
+        this->Reset();
+        return &this->ptr;
+    }
+
+    void Reset(T* p = nullptr) {
+        if (this->ptr) {
+            Free(this->ptr);
+        }
+
+        this->ptr = p;
+    }
+
+    explicit operator bool() const {
+        return this->ptr != nullptr;
+    }
+};
+
+typedef git_handle<git_repository, git_repository_free> git_repository_handle;
+typedef git_handle<git_reference, git_reference_free> git_reference_handle;
+typedef git_handle<git_annotated_commit, git_annotated_commit_free> git_annotated_commit_handle;
+typedef git_handle<git_object, git_object_free> git_object_handle;
+typedef git_handle<git_commit, git_commit_free> git_commit_handle;
+typedef git_handle<git_remote, git_remote_free> git_remote_handle;
+typedef git_handle<git_odb, git_odb_free> git_odb_handle;
+typedef git_handle<git_revwalk, git_revwalk_free> git_revwalk_handle;
+typedef git_handle<git_packbuilder, git_packbuilder_free> git_packbuilder_handle;
+
+
+// Clones happen in `<target>` + this suffix, and are only renamed to their final name once complete.
+const string STAGING_DIRECTORY_SUFFIX = ".partial";
+// Dependencies on a version range are checked out in `<name>` + this suffix, and only moved to their version's
+// directory once it is known.
+const string RANGE_CHECKOUT_SUFFIX = "-temp";
+const char* const STAGING_REMOTE_NAME = "origin";
+
+// Left by `ldh fetch` in the git directory of the staging repositories it fills, holding the remote's default
+// branch: `CloneRepo` then takes the staging repository as complete, and does not go back to the remote.
+const string PREFETCH_MARKER_FILE_NAME = "ldh-prefetched";
+
+// History depth requested when fetching a pinned commit. Shallow fetches need libgit2 >= 1.7; older versions fetch
+// the commit's full history (but still nothing else).
+const int COMMIT_FETCH_DEPTH = 1;
+
+// Working sets assumed for admission against the memory budget (see `resolution_scheduler.hpp`): fetches are
+// dominated by pack indexing (object entries, delta bases), checkouts by the index and blobs being written out.
+const size_t FETCH_MEMORY_ESTIMATE = 64 << 20;
+const size_t CHECKOUT_MEMORY_ESTIMATE = 32 << 20;
+
+const chrono::milliseconds FETCH_RETRY_INITIAL_DELAY = chrono::milliseconds(1000);
+const chrono::milliseconds FETCH_RETRY_MAX_DELAY = chrono::milliseconds(30000);
+
+// Mirrors are not retried: moving on to the next source is cheaper than waiting for a flaky mirror to recover.
+const unsigned int MIRROR_FETCH_ATTEMPTS = 1;
+
+
+// Where a fetch goes to: the canonical remote, or one of its mirrors (see `url_rewrite.hpp`).
+struct fetch_source {
+    string url;
+    unsigned int attempts;
+};
+
+
+enum class reference_kind {
+    REFERENCE_KIND_LOCAL_BRANCH = 0,
+    REFERENCE_KIND_REMOTE_BRANCH,
+    REFERENCE_KIND_TAG,
+    REFERENCE_KIND_OTHER,
+};
+
+
+// A reference, peeled to the commit it (ultimately) points to.
+struct reference_entry {
+    string name;
+    reference_kind kind;
+    git_oid commitId;
+
+    // remote branches only: the branch's name on its remote, e.g. `feature/x` for `refs/remotes/origin/feature/x`
+    string branchName;
+};
+
+
+/* Every reference of a repository, gathered with a single pass over them when first needed. Names resolve with
+ * the precedence of `git_reference_dwim` (`<name>`, `refs/<name>`, `refs/tags/<name>`, `refs/heads/<name>`, ...),
+ * then to the branch of that name on any remote, each step being a hash lookup.
+ */
+class reference_map {
+    public:
+        bool Build(application_context&, git_repository*);
+        const reference_entry* Find(const string&) const;
+        void Add(reference_entry);
+
+    private:
+        unordered_map<string, reference_entry> referencesByName;
+        // `feature/x` -> `refs/remotes/origin/feature/x`, branches of `STAGING_REMOTE_NAME` winning over others
+        unordered_map<string, string> remoteBranchesByBranchName;
+        // longest first, as remote names may themselves contain slashes
+        vector<string> remoteNames;
+
+        static int AddReference(git_reference*, void*);
+};
 
 
 struct repository {
-    git_repository* libRepository;
+    git_repository_handle libRepository;
     string path;
 
-    repository(git_repository* r, string p): libRepository(r), path(p) {}
+    // built on first use, and dropped whenever references are changed behind its back (e.g. by a fetch)
+    unique_ptr<reference_map> references;
+
+    repository() {}
+    repository(git_repository_handle&& r, string p): libRepository(move(r)), path(p) {}
+
+    git_repository* Get() {
+        return this->libRepository.Get();
+    }
 };
 
 
@@ -31,7 +179,7 @@ struct resolution_result {
     // resolvers, this will move to a shared file.
     bool resolutionSuccessful;
 
-    repository* repo;
+    repository repo;
 
     string localPath;
     string remote;
@@ -39,16 +187,54 @@ struct resolution_result {
     string version;
     string tag;
 
-    resolution_result(bool rs): resolutionSuccessful(rs) { }
+    resolution_result(bool rs = false): resolutionSuccessful(rs) { }
+};
+
+
+// All tag names of a repository. Names are stored back to back in a single buffer, so that repositories with
+// tens of thousands of tags cost two allocations instead of one per tag.
+struct tag_list {
+    string arena;
+    vector<string_view> names;
+
+    bool empty() {
+        return this->names.empty();
+    }
 };
 
 
-resolution_result* CloneRepo(application_context&, string, string);
-resolution_result* CloneAndCheckout(application_context&, string, string, string);
+// A submodule as recorded in a repository's HEAD tree, its URL resolved against the repository's remote.
+struct submodule_entry {
+    string path;
+    string url;
+    string commit;
+};
+
+
+bool InitializeLibrary(application_context&);
+bool ShutdownLibrary(application_context&);
+
+resolution_result CloneRepo(application_context&, const string&, const string&, const string& = "");
+resolution_result CloneAndCheckout(application_context&, const string&, const string&, const string&, bool = false);
+resolution_result FetchCommit(application_context&, const string&, const string&, const string&,
+                              const vector<string>& = {});
+bool HasCommitLocally(application_context&, const string&, const string&, const string&);
+resolution_result PrefetchRepo(application_context&, const string&, const string&, const string& = "");
+bool PrefetchCommit(application_context&, const string&, const string&, const string&);
+void Checkout(application_context&, resolution_result&, const string&);
+bool CheckoutHead(application_context&, const string&);
+
+resolution_result CreateResolutionResultFromLocalGitRepo(application_context&, const string&, const string&,
+                                                         version_t&);
+bool RefreshRepository(application_context&, resolution_result&);
 
-resolution_result* CreateResolutionResultFromLocalGitRepo(application_context&, string, string, version_t&);
+tag_list GetTagsForRepository(application_context&, repository&);
+string ResolveToCommitId(application_context&, repository&, const string&);
+bool ListSubmodules(application_context&, const string&, vector<submodule_entry>&);
+string GetHeadIdAtPath(const string&);
 
-vector<string*>* GetTagsForRepository(application_context&, repository*);
+int TransferProgressCallback(const git_indexer_progress*, void*);
+void CheckoutProgressCallback(const char*, size_t, size_t, void*);
 
 #define GIT_LIB_H
 #endif
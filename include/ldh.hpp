@@ -0,0 +1,124 @@
+/* `libldh`: parsing, planning, resolving and verifying projects in-process, for build systems that would otherwise
+ * spawn `ldh` once per package and scrape its output. `make lib` builds it into `libldh.a`, from the same sources
+ * as the `ldh` binary; it needs the same libraries linked in.
+ *
+ * This header (and the two it pulls in from `include/`, which only declare `ldh::` types) is all that callers should
+ * include: the rest of `include/` defines globals, and is only meant for the single translation unit `ldh` and
+ * `libldh` are each built from. In `libldh`, all of that lives in `ldh::detail`, out of the way of callers' names.
+ *
+ * A `session` keeps libgit2 (and its caches) initialized, and the transfer, disk and memory limits and the mirror
+ * configuration loaded, for as long as it lives, so that every call made through it shares them. Calls may be made
+ * concurrently. Dependencies are checked out under `target/dependencies/` in the manifest's directory (the project
+ * root), whatever the process' working directory; paths in the lock file are relative to it.
+ */
+
+#if !defined(LDH_H)
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "spdlog/logger.h"
+
+#include "cancellation_token.hpp"
+#include "thread_pool.hpp"
+
+
+// Bumped whenever what this header declares changes in an incompatible way.
+#define LDH_API_VERSION 1
+
+
+namespace ldh {
+    struct session_options {
+        // `nullptr` for `ldh`'s own console loggers
+        std::shared_ptr<spdlog::logger> applicationLogger;
+        std::shared_ptr<spdlog::logger> userLogger;
+
+        // `nullptr` for a pool of `jobs` threads per call. Calls only wait for their own jobs, and may be made from
+        // the pool's own workers (which then run queued jobs while they wait).
+        thread_pool* pool;
+
+        // same meaning, and defaults, as the `ldh update` options of the same name
+        unsigned int jobs;
+        unsigned int fetchRetries;
+        unsigned int transfersPerHost;
+        unsigned int diskJobs;
+        // The part of the budget capping libgit2's caches applies to the whole process (libgit2 has no other kind
+        // of limit), so the session opened last sets it for every session.
+        std::string memoryBudget;
+        bool noManifestCache;
+        bool refresh;
+
+        session_options();
+    };
+
+
+    struct dependency_info {
+        std::string name;
+
+        // as recorded in the lock file, empty until the dependency has been resolved
+        std::string source;
+        std::string version;
+        // of the checkout, starting with the project root
+        std::string path;
+    };
+
+
+    struct project {
+        std::string name;
+        std::string manifestPath;
+        std::string lockFilePath;
+
+        std::vector<dependency_info> dependencies;
+    };
+
+
+    struct planned_dependency {
+        std::string name;
+        // as printed by `ldh plan`: `none`, `clone`, `fetch`, `checkout`, ...
+        std::string action;
+        std::string path;
+        std::string reason;
+    };
+
+
+    struct verification {
+        // whether the manifest parses and passes its checks, and if not, why
+        bool valid;
+        std::string diagnostics;
+
+        // whether `Resolve` would have nothing to do, and if not, what it would do
+        bool upToDate;
+        std::vector<planned_dependency> pending;
+    };
+
+
+    class session {
+        public:
+            session();
+            ~session();
+
+            session(const session&) = delete;
+            session& operator=(const session&) = delete;
+
+            // Must succeed before any other call is made, and may only be called once.
+            bool Open(const session_options& options);
+
+            // `lockFilePath` defaults to the lock file `ldh` would use for `manifestPath`.
+            bool Parse(const std::string& manifestPath, project& result, const std::string& lockFilePath = "");
+            bool Plan(const std::string& manifestPath, std::vector<planned_dependency>& result,
+                      const std::string& lockFilePath = "");
+            bool Verify(const std::string& manifestPath, verification& result, const std::string& lockFilePath = "");
+
+            // What `ldh update` does. `result` describes the lock file as written, even when some (or, after
+            // cancellation, not all) dependencies could not be resolved and `false` is returned.
+            bool Resolve(const std::string& manifestPath, project& result,
+                         const cancellation_token* cancellation = nullptr, const std::string& lockFilePath = "");
+
+        private:
+            struct state;
+            std::unique_ptr<state> impl;
+    };
+}
+
+#define LDH_H
+#endif
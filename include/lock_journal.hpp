@@ -0,0 +1,56 @@
+/* Journal of lock updates.
+ *
+ * The lock file is only rewritten once every dependency has been resolved. So that an interrupted `ldh update`
+ * does not lose track of the work it already did, each resolution (or deletion) is also appended to
+ * `<lock file>.journal` as soon as it completes. The next run replays the journal on top of the lock before
+ * reconciling it with the configuration, and a successful lock write removes it.
+ *
+ * The journal is a text file: a header line, then one record per line, with tab-separated (and escaped) fields:
+ *     +\t<name>\t<resolved version>\t<resolved source>\t<local path>[\t<submodule path>\t<version>\t<source>]...
+ *     -\t<name>\t<local path>
+ * A record only counts once its newline has been written; a trailing partial line is a torn write and ignored.
+ * Deletions name the path they deleted, as the lock entry a version bump leaves behind for deletion has the same name
+ * as the new one, and may well be deleted after the new one was resolved.
+ */
+
+#if !defined(LOCK_JOURNAL_H)
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "application_context.hpp"
+#include "dependency.hpp"
+
+using namespace std;
+
+
+const string LOCK_JOURNAL_HEADER = "ldh-lock-journal 2";
+
+
+class lock_journal {
+    public:
+        lock_journal(int d, string p): descriptor(d), path(p), appendFailed(false) {}
+        ~lock_journal();
+
+        bool RecordResolved(application_context&, dependency&);
+        bool RecordDeleted(application_context&, dependency&, const string&);
+
+        bool Append(application_context&, const string&);
+
+    private:
+        int descriptor;
+        string path;
+
+        mutex appendMutex;
+        bool appendFailed;
+};
+
+
+string GetLockJournalPath(const string&);
+
+lock_journal* OpenLockJournal(application_context&, const string&);
+bool ReplayLockJournal(application_context&, const string&, vector<dependency>&);
+bool FinishLockJournal(application_context&, const string&);
+
+#define LOCK_JOURNAL_H
+#endif
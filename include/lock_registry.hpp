@@ -0,0 +1,33 @@
+/* The lock registry is a per-user list of every lock file `ldh update` has written on this host, alongside the
+ * project root its dependency paths are relative to. It is what `ldh gc` uses to figure out which dependency
+ * checkouts are still referenced by someone.
+ *
+ * The registry is only ever replaced as a whole (written under a temporary name, then renamed), and changes to it
+ * hold an exclusive `file_lock` (see `file_lock.hpp`) from reading it to writing it back.
+ */
+
+#if !defined(LOCK_REGISTRY_H)
+#include <string>
+#include <vector>
+
+#include "application_context.hpp"
+
+using namespace std;
+
+
+struct registered_lock {
+    string lockFilePath;
+    string projectRoot;
+};
+
+
+string GetLockRegistryPath();
+
+vector<registered_lock> ReadLockRegistry(application_context&);
+// Only to be called with the registry locked, by `RegisterLockFile` or `UnregisterLockFiles`.
+bool WriteLockRegistry(application_context&, vector<registered_lock>&);
+bool RegisterLockFile(application_context&, string&);
+bool UnregisterLockFiles(application_context&, vector<registered_lock>&);
+
+#define LOCK_REGISTRY_H
+#endif
@@ -1,8 +1,25 @@
 #if !defined(LOGGER_H)
+#include <cstdlib>
 #include <map>
 #include <vector>
 
+// Compile-time minimum level for the `SPDLOG_LOGGER_*` macros; calls below it are compiled out entirely.
+#if !defined(SPDLOG_ACTIVE_LEVEL)
+#if defined(DEBUG)
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#else
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_INFO
+#endif
+#endif
+
+// Set to 0 to log synchronously from the calling thread (useful when debugging crashes, as nothing is left
+// sitting in the queue).
+#if !defined(LDH_ASYNC_LOGGING)
+#define LDH_ASYNC_LOGGING 1
+#endif
+
 #include "spdlog/spdlog.h"
+#include "spdlog/async.h"
 #include "spdlog/sinks/stdout_color_sinks.h"
 
 using namespace std;
@@ -10,6 +27,8 @@ using namespace std;
 const string APPLICATION_LOGGER_NAME = "APP";
 const string USER_LOGGER_NAME = "USR";
 
+const size_t ASYNC_LOGGER_QUEUE_SIZE = 8192;
+
 typedef spdlog::logger logger_type;
 typedef shared_ptr<logger_type> logger_ptr;
 
@@ -21,16 +40,37 @@ class logger_manager{
         map<string, logger_ptr> componentLoggers;
         vector<spdlog::sink_ptr> sinks;
 
-        logger_manager() {
-            this->sinks.push_back(make_shared<spdlog::sinks::stdout_color_sink_mt>()); // stdout sink
+        // Only set in async mode. A single background thread drains the queue and is the only one that ever
+        // touches the sinks, so producers never wait on console I/O.
+        shared_ptr<spdlog::details::thread_pool> asyncThreadPool;
+
+        logger_manager(bool async) {
+            if (async) {
+                this->asyncThreadPool = make_shared<spdlog::details::thread_pool>(ASYNC_LOGGER_QUEUE_SIZE, 1);
+                this->sinks.push_back(make_shared<spdlog::sinks::stdout_color_sink_st>()); // stdout sink
+            } else {
+                this->sinks.push_back(make_shared<spdlog::sinks::stdout_color_sink_mt>()); // stdout sink
+            }
         }
 
         logger_ptr CreateComponentLogger(const string& componentName) {
-            logger_ptr componentLogger = make_shared<logger_type>(componentName, begin(this->sinks), end(this->sinks));
+            logger_ptr componentLogger;
+            if (this->asyncThreadPool) {
+                componentLogger = make_shared<spdlog::async_logger>(componentName, begin(this->sinks),
+                                                                    end(this->sinks), this->asyncThreadPool,
+                                                                    spdlog::async_overflow_policy::block);
+            } else {
+                componentLogger = make_shared<logger_type>(componentName, begin(this->sinks), end(this->sinks));
+            }
+
             if (componentName == USER_LOGGER_NAME) {
                 componentLogger->set_pattern("[%^%l%$]: %v");
             } else {
+#if defined(DEBUG)
                 componentLogger->set_pattern("[%^%l%$ - %H:%M:%S%z] %@ (tid %t): %v");
+#else
+                componentLogger->set_pattern("[%^%l%$ - %H:%M:%S%z] %v");
+#endif
             }
 
             return componentLogger;
@@ -47,6 +87,20 @@ class logger_manager{
             return componentLogger;
         }
 
+        // Drains any queued messages; called at exit. Loggers handed out earlier stay valid, but in async mode,
+        // messages logged through them after this point never reach the sinks: spdlog hands each one to its error
+        // handler instead, which prints a (rate-limited) complaint to stderr. Nothing calls this on abnormal
+        // termination (`abort`, fatal signals), where whatever is still queued is lost; build with
+        // `LDH_ASYNC_LOGGING=0` when the last messages before a crash matter.
+        void Shutdown() {
+            for (auto&& [componentName, componentLogger] : this->componentLoggers) {
+                componentLogger->flush();
+            }
+
+            // the pool's destructor processes everything still in the queue before joining its thread
+            this->asyncThreadPool.reset();
+        }
+
         static logger_manager* GetInstance();
 };
 
@@ -56,7 +110,9 @@ logger_manager* logger_manager::instance = nullptr;
 
 logger_manager* logger_manager::GetInstance() {
     if (instance == nullptr) {
-        instance = new logger_manager();
+        instance = new logger_manager(LDH_ASYNC_LOGGING);
+
+        std::atexit([] { logger_manager::instance->Shutdown(); });
     }
 
     return instance;
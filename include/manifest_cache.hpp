@@ -0,0 +1,27 @@
+/* Cache of parsed and checked manifests.
+ *
+ * Entries are keyed by the SHA-256 of the manifest's contents, salted with the `ldh` version and the cache format
+ * version, so an unchanged manifest can skip TOML parsing and `CheckConfiguration` entirely. Entries live under
+ * `$LDH_HOME/cache/manifests`, in a compact binary form (see `SerializeConfiguration`).
+ */
+
+#if !defined(MANIFEST_CACHE_H)
+#include <string>
+
+#include "application_context.hpp"
+#include "configuration_io.hpp"
+
+using namespace std;
+
+
+// Bump whenever the serialized layout of `configuration` (or the enums it stores) changes.
+const uint32_t MANIFEST_CACHE_FORMAT_VERSION = 3;
+
+
+string ManifestCacheKey(const string&);
+
+bool LoadCachedConfiguration(application_context&, const string&, configuration&);
+bool StoreCachedConfiguration(application_context&, const string&, configuration&);
+
+#define MANIFEST_CACHE_H
+#endif
@@ -0,0 +1,90 @@
+/* `ldh plan` works out what `ldh update` would do, using nothing but the manifest, the lock file and what is on
+ * disk. It never talks to a remote: dependencies whose outcome can only be known by asking one (semver ranges
+ * without a usable lock entry, refreshed branches) are reported as the network action `update` would take.
+ */
+
+#if !defined(PLAN_H)
+#include <string>
+#include <vector>
+
+#include "application_context.hpp"
+#include "dependency.hpp"
+
+using namespace std;
+
+
+// `plan` exits with 0 when `update` has something to do, and with this when it does not.
+const int PLAN_EXIT_NOTHING_TO_DO = 2;
+
+
+enum class plan_action {
+    PLAN_ACTION_NONE = 0,
+    PLAN_ACTION_CLONE,
+    PLAN_ACTION_RESUME,
+    PLAN_ACTION_FETCH,
+    PLAN_ACTION_CHECKOUT,
+    PLAN_ACTION_LOCK,
+    PLAN_ACTION_DELETE,
+    PLAN_ACTION_PRUNE,
+    PLAN_ACTION_FAIL,
+
+    PLAN_ACTION_COUNT,
+};
+
+
+constexpr const char* PlanActionToString(plan_action a) {
+    switch (a) {
+        case plan_action::PLAN_ACTION_CLONE:
+            {
+                return "clone";
+            }
+        case plan_action::PLAN_ACTION_RESUME:
+            {
+                return "resume";
+            }
+        case plan_action::PLAN_ACTION_FETCH:
+            {
+                return "fetch";
+            }
+        case plan_action::PLAN_ACTION_CHECKOUT:
+            {
+                return "checkout";
+            }
+        case plan_action::PLAN_ACTION_LOCK:
+            {
+                return "lock";
+            }
+        case plan_action::PLAN_ACTION_DELETE:
+            {
+                return "delete";
+            }
+        case plan_action::PLAN_ACTION_PRUNE:
+            {
+                return "prune";
+            }
+        case plan_action::PLAN_ACTION_FAIL:
+            {
+                return "fail";
+            }
+        default:
+            {
+                return "none";
+            }
+    }
+}
+
+
+struct planned_action {
+    plan_action action;
+
+    string name;
+    string path;
+    string reason;
+};
+
+
+vector<planned_action> PlanDependencies(application_context&, vector<dependency>&);
+int PrintPlan(application_context&, vector<planned_action>&);
+
+#define PLAN_H
+#endif
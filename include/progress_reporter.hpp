@@ -0,0 +1,86 @@
+/* Progress reporting for long running transfers (clones, checkouts).
+ *
+ * libgit2 calls our progress callbacks for every chunk it receives, potentially from several resolutions at
+ * once, so the callbacks themselves only store counters. Rendering is rate limited: whichever callback first
+ * notices that the render interval has elapsed renders every active transfer, everyone else returns right away.
+ */
+
+#if !defined(PROGRESS_REPORTER_H)
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "logger_manager.hpp"
+
+using namespace std;
+
+typedef chrono::steady_clock progress_clock;
+
+class progress_reporter;
+
+
+struct transfer_progress {
+    progress_reporter* reporter;
+
+    string name;
+    progress_clock::time_point startTime;
+
+    atomic<size_t> receivedBytes{0};
+    atomic<unsigned int> receivedObjects{0};
+    atomic<unsigned int> indexedObjects{0};
+    atomic<unsigned int> totalObjects{0};
+
+    atomic<size_t> checkedOutFiles{0};
+    atomic<size_t> totalFiles{0};
+
+    // only touched while rendering, under the reporter's render lock
+    size_t lastRenderedBytes = 0;
+    progress_clock::time_point lastRenderTime;
+
+    transfer_progress(progress_reporter* r, string n): reporter(r), name(n) {
+        this->startTime = progress_clock::now();
+        this->lastRenderTime = this->startTime;
+    }
+};
+
+
+class progress_reporter {
+    public:
+        progress_reporter(logger_ptr l, chrono::milliseconds interval): logger(l), renderInterval(interval) {}
+
+        transfer_progress* Begin(string name);
+        void End(transfer_progress*, bool);
+
+        // Cheap enough to call on every progress update; renders at most once per `renderInterval`.
+        void MaybeRender() {
+            int64_t now = progress_clock::now().time_since_epoch().count();
+            int64_t due = this->nextRenderTick.load(memory_order_relaxed);
+            if (now < due) {
+                return;
+            }
+
+            int64_t next = now + chrono::duration_cast<progress_clock::duration>(this->renderInterval).count();
+            if (!this->nextRenderTick.compare_exchange_strong(due, next, memory_order_relaxed)) {
+                return;
+            }
+
+            this->Render();
+        }
+
+    private:
+        logger_ptr logger;
+        chrono::milliseconds renderInterval;
+        atomic<int64_t> nextRenderTick{0};
+
+        mutex entriesMutex;
+        vector<transfer_progress*> activeEntries;
+
+        size_t completedBytes = 0;
+
+        void Render();
+};
+
+#define PROGRESS_REPORTER_H
+#endif
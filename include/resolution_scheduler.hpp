@@ -0,0 +1,176 @@
+/* Limits on how much of the concurrent resolution work runs at the same time.
+ *
+ * Network transfers are limited per remote host, so that resolving many dependencies from the same server does
+ * not trip its rate limiting. Disk heavy work (checkouts, deletions) shares a single, separate limit, so that
+ * hosts with slow disks are not thrashed by many checkouts at once while transfers to other hosts keep going.
+ *
+ * With a memory budget (`--memory-budget` or `LDH_MEMORY_BUDGET`), part of it caps libgit2's process-wide caches,
+ * and the rest is shared by fetches, checkouts and archive extractions: each of them is only let in once its
+ * estimated working set fits in what is left, so peak memory does not grow with the number of dependencies (or
+ * `--jobs`).
+ */
+
+#if !defined(RESOLUTION_SCHEDULER_H)
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+
+// Shares of the memory budget given to libgit2's pack window mappings and object cache, respectively.
+const size_t MEMORY_BUDGET_MWINDOW_DIVISOR = 4;
+const size_t MEMORY_BUDGET_OBJECT_CACHE_DIVISOR = 8;
+
+
+// Counting semaphore.
+class slot_pool {
+    public:
+        slot_pool(size_t slotCount): available(slotCount ? slotCount : 1) {}
+
+        void Acquire() {
+            unique_lock<mutex> lock(this->slotsMutex);
+            this->slotsCondition.wait(lock, [this] { return this->available > 0; });
+            this->available--;
+        }
+
+        void Release() {
+            {
+                unique_lock<mutex> lock(this->slotsMutex);
+                this->available++;
+            }
+            this->slotsCondition.notify_one();
+        }
+
+    private:
+        mutex slotsMutex;
+        condition_variable slotsCondition;
+        size_t available;
+};
+
+
+// Holds a slot of `pool` for as long as it is in scope. A `nullptr` pool means there is no limit to respect.
+class scheduled_slot {
+    public:
+        scheduled_slot(slot_pool* p): pool(p) {
+            if (this->pool) {
+                this->pool->Acquire();
+            }
+        }
+
+        ~scheduled_slot() {
+            if (this->pool) {
+                this->pool->Release();
+            }
+        }
+
+        scheduled_slot(const scheduled_slot&) = delete;
+        scheduled_slot& operator=(const scheduled_slot&) = delete;
+
+    private:
+        slot_pool* pool;
+};
+
+
+// Counting semaphore over bytes. Requests larger than the whole pool are clamped to it, so that they still run,
+// on their own.
+class memory_pool {
+    public:
+        memory_pool(size_t byteCount): size(byteCount), available(byteCount) {}
+
+        size_t Acquire(size_t byteCount) {
+            byteCount = min(byteCount, this->size);
+
+            unique_lock<mutex> lock(this->memoryMutex);
+            this->memoryCondition.wait(lock, [this, byteCount] { return this->available >= byteCount; });
+            this->available -= byteCount;
+
+            return byteCount;
+        }
+
+        void Release(size_t byteCount) {
+            {
+                unique_lock<mutex> lock(this->memoryMutex);
+                this->available += byteCount;
+            }
+            this->memoryCondition.notify_all();
+        }
+
+    private:
+        mutex memoryMutex;
+        condition_variable memoryCondition;
+        size_t size;
+        size_t available;
+};
+
+
+// Holds `byteCount` bytes of `pool` for as long as it is in scope. A `nullptr` pool means there is no budget.
+class scheduled_memory {
+    public:
+        scheduled_memory(memory_pool* p, size_t byteCount): pool(p), acquired(0) {
+            if (this->pool) {
+                this->acquired = this->pool->Acquire(byteCount);
+            }
+        }
+
+        ~scheduled_memory() {
+            if (this->pool) {
+                this->pool->Release(this->acquired);
+            }
+        }
+
+        scheduled_memory(const scheduled_memory&) = delete;
+        scheduled_memory& operator=(const scheduled_memory&) = delete;
+
+    private:
+        memory_pool* pool;
+        size_t acquired;
+};
+
+
+class resolution_scheduler {
+    public:
+        // a `memoryBudget` of 0 means no budget
+        resolution_scheduler(size_t transfersPerHost, size_t diskJobs, size_t memoryBudget = 0):
+            transfersPerHost(transfersPerHost), diskSlots(diskJobs), memoryBudget(memoryBudget) {
+            if (memoryBudget) {
+                this->jobMemory = make_unique<memory_pool>(memoryBudget - memoryBudget / MEMORY_BUDGET_MWINDOW_DIVISOR -
+                                                           memoryBudget / MEMORY_BUDGET_OBJECT_CACHE_DIVISOR);
+            }
+        }
+
+        slot_pool* TransferSlots(const string& remoteUrl);
+
+        slot_pool* DiskSlots() {
+            return &this->diskSlots;
+        }
+
+        memory_pool* JobMemory() {
+            return this->jobMemory.get();
+        }
+
+        size_t MemoryBudget() {
+            return this->memoryBudget;
+        }
+
+    private:
+        size_t transfersPerHost;
+
+        mutex hostsMutex;
+        unordered_map<string, unique_ptr<slot_pool>> hostSlots;
+
+        slot_pool diskSlots;
+
+        size_t memoryBudget;
+        unique_ptr<memory_pool> jobMemory;
+};
+
+
+string GetRemoteHost(const string&);
+string GetMemoryBudgetSetting(const string&);
+
+#define RESOLUTION_SCHEDULER_H
+#endif
@@ -0,0 +1,72 @@
+/* Per-run metrics, for monitoring `ldh` across many machines.
+ *
+ * Counters are relaxed atomics bumped once per dependency, fetch or checkout (never per object or per file), so
+ * collecting them costs next to nothing. At the end of the run they are written to the file given through
+ * `--metrics` or `LDH_METRICS_FILE`: in the Prometheus text format (for node_exporter's textfile collector) if its
+ * name ends in `.prom`, as a single JSON object otherwise.
+ */
+
+#if !defined(RUN_METRICS_H)
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+typedef chrono::steady_clock metrics_clock;
+
+struct application_context;
+
+
+struct run_metrics {
+    string outputPath;
+    metrics_clock::time_point startTime;
+
+    // filled in by the main thread only
+    vector<pair<string, double>> phaseDurations;
+
+    atomic<size_t> dependenciesResolved{0};
+    atomic<size_t> dependenciesAlreadyPresent{0};
+    atomic<size_t> dependenciesFailed{0};
+    atomic<size_t> dependenciesDeleted{0};
+
+    atomic<size_t> fetches{0};
+    atomic<size_t> fetchedBytes{0};
+    atomic<size_t> fetchedObjects{0};
+    atomic<size_t> checkedOutFiles{0};
+
+    atomic<size_t> tagScans{0};
+    atomic<size_t> tagsScanned{0};
+
+    run_metrics(string p): outputPath(p), startTime(metrics_clock::now()) {}
+};
+
+
+// Records the time between its construction and destruction as a phase of the run. A `nullptr` metrics
+// object turns it into a no-op.
+class phase_timer {
+    public:
+        phase_timer(run_metrics* m, const char* n): metrics(m), name(n), startTime(metrics_clock::now()) {}
+
+        ~phase_timer() {
+            if (this->metrics) {
+                double elapsed = chrono::duration<double>(metrics_clock::now() - this->startTime).count();
+                this->metrics->phaseDurations.emplace_back(this->name, elapsed);
+            }
+        }
+
+    private:
+        run_metrics* metrics;
+        const char* name;
+        metrics_clock::time_point startTime;
+};
+
+
+size_t GetPeakResidentSetSize();
+string GetMetricsOutputPath(const string&);
+bool WriteRunMetrics(application_context&, int);
+
+#define RUN_METRICS_H
+#endif
@@ -0,0 +1,179 @@
+/* Streaming SHA-256 (FIPS 180-4). Data can be fed in arbitrarily sized pieces through `Update`, so that large
+ * inputs never have to be held in memory at once.
+ */
+
+#if !defined(SHA256_H)
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+typedef array<uint8_t, 32> sha256_digest;
+
+
+class sha256 {
+    public:
+        sha256() {
+            this->Reset();
+        }
+
+        void Reset() {
+            static const uint32_t initialState[8] = {
+                0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+            };
+
+            memcpy(this->state, initialState, sizeof(this->state));
+            this->bufferLength = 0;
+            this->totalLength = 0;
+        }
+
+        void Update(const void* data, size_t length) {
+            const uint8_t* bytes = (const uint8_t*) data;
+            this->totalLength += length;
+
+            if (this->bufferLength) {
+                size_t toCopy = min(length, sizeof(this->buffer) - this->bufferLength);
+                memcpy(this->buffer + this->bufferLength, bytes, toCopy);
+                this->bufferLength += toCopy;
+                bytes += toCopy;
+                length -= toCopy;
+
+                if (this->bufferLength < sizeof(this->buffer)) {
+                    return;
+                }
+
+                this->ProcessBlock(this->buffer);
+                this->bufferLength = 0;
+            }
+
+            for (; length >= sizeof(this->buffer); bytes += sizeof(this->buffer), length -= sizeof(this->buffer)) {
+                this->ProcessBlock(bytes);
+            }
+
+            memcpy(this->buffer, bytes, length);
+            this->bufferLength = length;
+        }
+
+        void Update(string_view data) {
+            this->Update(data.data(), data.size());
+        }
+
+        sha256_digest Finalize() {
+            uint64_t totalBits = this->totalLength * 8;
+
+            uint8_t padding[72] = { 0x80 };
+            size_t paddingLength = (this->bufferLength < 56 ? 56 : 120) - this->bufferLength;
+            for (int i = 0; i < 8; i++) {
+                padding[paddingLength + i] = (uint8_t) (totalBits >> (56 - 8 * i));
+            }
+            this->Update(padding, paddingLength + 8);
+
+            sha256_digest digest;
+            for (int i = 0; i < 8; i++) {
+                digest[4 * i] = (uint8_t) (this->state[i] >> 24);
+                digest[4 * i + 1] = (uint8_t) (this->state[i] >> 16);
+                digest[4 * i + 2] = (uint8_t) (this->state[i] >> 8);
+                digest[4 * i + 3] = (uint8_t) this->state[i];
+            }
+
+            return digest;
+        }
+
+        static string ToHex(const sha256_digest& digest) {
+            static const char hexDigits[] = "0123456789abcdef";
+
+            string result(digest.size() * 2, '0');
+            for (size_t i = 0; i < digest.size(); i++) {
+                result[2 * i] = hexDigits[digest[i] >> 4];
+                result[2 * i + 1] = hexDigits[digest[i] & 0xf];
+            }
+
+            return result;
+        }
+
+        static bool IsHexDigest(string_view value) {
+            return value.size() == 64 && all_of(value.begin(), value.end(), [](char c) {
+                return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+            });
+        }
+
+        static string HexDigest(string_view data) {
+            sha256 hasher;
+            hasher.Update(data);
+
+            return ToHex(hasher.Finalize());
+        }
+
+    private:
+        uint32_t state[8];
+        uint8_t buffer[64];
+        size_t bufferLength;
+        uint64_t totalLength;
+
+        static uint32_t RotateRight(uint32_t value, int count) {
+            return (value >> count) | (value << (32 - count));
+        }
+
+        void ProcessBlock(const uint8_t* block) {
+            static const uint32_t roundConstants[64] = {
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+            };
+
+            uint32_t schedule[64];
+            for (int i = 0; i < 16; i++) {
+                schedule[i] = ((uint32_t) block[4 * i] << 24) | ((uint32_t) block[4 * i + 1] << 16) |
+                    ((uint32_t) block[4 * i + 2] << 8) | (uint32_t) block[4 * i + 3];
+            }
+            for (int i = 16; i < 64; i++) {
+                uint32_t s0 = RotateRight(schedule[i - 15], 7) ^ RotateRight(schedule[i - 15], 18) ^
+                    (schedule[i - 15] >> 3);
+                uint32_t s1 = RotateRight(schedule[i - 2], 17) ^ RotateRight(schedule[i - 2], 19) ^
+                    (schedule[i - 2] >> 10);
+                schedule[i] = schedule[i - 16] + s0 + schedule[i - 7] + s1;
+            }
+
+            uint32_t a = this->state[0], b = this->state[1], c = this->state[2], d = this->state[3];
+            uint32_t e = this->state[4], f = this->state[5], g = this->state[6], h = this->state[7];
+
+            for (int i = 0; i < 64; i++) {
+                uint32_t s1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+                uint32_t choice = (e & f) ^ (~e & g);
+                uint32_t temp1 = h + s1 + choice + roundConstants[i] + schedule[i];
+                uint32_t s0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+                uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+                uint32_t temp2 = s0 + majority;
+
+                h = g;
+                g = f;
+                f = e;
+                e = d + temp1;
+                d = c;
+                c = b;
+                b = a;
+                a = temp1 + temp2;
+            }
+
+            this->state[0] += a;
+            this->state[1] += b;
+            this->state[2] += c;
+            this->state[3] += d;
+            this->state[4] += e;
+            this->state[5] += f;
+            this->state[6] += g;
+            this->state[7] += h;
+        }
+};
+
+#define SHA256_H
+#endif
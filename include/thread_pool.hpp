@@ -0,0 +1,181 @@
+#if !defined(THREAD_POOL_H)
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Part of `libldh`'s public interface (see `ldh.hpp`), hence self-contained and in the `ldh` namespace.
+namespace ldh {
+    typedef std::function<void()> job_type;
+
+
+    class thread_pool {
+        public:
+            thread_pool(size_t workerCount = DefaultWorkerCount()) {
+                if (workerCount == 0) {
+                    workerCount = 1;
+                }
+
+                for (size_t i = 0; i < workerCount; i++) {
+                    this->workers.emplace_back([this] { this->WorkerLoop(); });
+                }
+            }
+
+            ~thread_pool() {
+                {
+                    std::unique_lock<std::mutex> lock(this->queueMutex);
+                    this->stopping = true;
+                }
+                this->queueCondition.notify_all();
+
+                for (std::thread& worker : this->workers) {
+                    worker.join();
+                }
+            }
+
+            void Submit(job_type job) {
+                {
+                    std::unique_lock<std::mutex> lock(this->queueMutex);
+                    this->pendingJobs++;
+                    this->jobs.push_back(std::move(job));
+                }
+                this->queueCondition.notify_one();
+            }
+
+            // Blocks until every job submitted so far has finished running.
+            void Wait() {
+                std::unique_lock<std::mutex> lock(this->queueMutex);
+                this->idleCondition.wait(lock, [this] { return this->pendingJobs == 0; });
+            }
+
+            // Runs the oldest queued job on the calling thread, if there is one.
+            bool RunPendingJob() {
+                job_type job;
+                {
+                    std::unique_lock<std::mutex> lock(this->queueMutex);
+                    if (this->jobs.empty()) {
+                        return false;
+                    }
+
+                    job = std::move(this->jobs.front());
+                    this->jobs.pop_front();
+                }
+
+                this->RunJob(job);
+                return true;
+            }
+
+            size_t WorkerCount() {
+                return this->workers.size();
+            }
+
+            static size_t DefaultWorkerCount() {
+                size_t hardwareThreads = std::thread::hardware_concurrency();
+                return hardwareThreads ? hardwareThreads : 4;
+            }
+
+        private:
+            std::vector<std::thread> workers;
+            std::deque<job_type> jobs;
+
+            std::mutex queueMutex;
+            std::condition_variable queueCondition;
+            std::condition_variable idleCondition;
+
+            size_t pendingJobs = 0;
+            bool stopping = false;
+
+            void RunJob(job_type& job) {
+                job();
+
+                std::unique_lock<std::mutex> lock(this->queueMutex);
+                if (--this->pendingJobs == 0) {
+                    this->idleCondition.notify_all();
+                }
+            }
+
+            void WorkerLoop() {
+                while (true) {
+                    job_type job;
+                    {
+                        std::unique_lock<std::mutex> lock(this->queueMutex);
+                        this->queueCondition.wait(lock, [this] { return this->stopping || !this->jobs.empty(); });
+
+                        if (this->jobs.empty()) {
+                            return;
+                        }
+
+                        job = std::move(this->jobs.front());
+                        this->jobs.pop_front();
+                    }
+
+                    this->RunJob(job);
+                }
+            }
+    };
+
+
+    /* A batch of jobs on a (possibly shared) pool that can be waited for on its own, unlike `thread_pool::Wait`,
+     * which waits for everything on the pool. A thread waiting for its group runs queued jobs in the meantime, so
+     * that waiting from one of the pool's own workers does not take a worker away from the jobs being waited for.
+     */
+    class job_group {
+        public:
+            job_group(thread_pool& pool): pool(pool) {}
+
+            ~job_group() {
+                this->Wait();
+            }
+
+            job_group(const job_group&) = delete;
+            job_group& operator=(const job_group&) = delete;
+
+            void Submit(job_type job) {
+                {
+                    std::unique_lock<std::mutex> lock(this->groupMutex);
+                    this->pendingJobs++;
+                }
+
+                this->pool.Submit([this, job = std::move(job)] {
+                    job();
+
+                    // notified with the lock held, so that the group outlives this job's last use of it
+                    std::unique_lock<std::mutex> lock(this->groupMutex);
+                    if (--this->pendingJobs == 0) {
+                        this->doneCondition.notify_all();
+                    }
+                });
+            }
+
+            // Blocks until every job submitted through this group has finished running.
+            void Wait() {
+                while (true) {
+                    {
+                        std::unique_lock<std::mutex> lock(this->groupMutex);
+                        if (this->pendingJobs == 0) {
+                            return;
+                        }
+                    }
+
+                    // nothing left to help with: whatever is left of the group is already running
+                    if (!this->pool.RunPendingJob()) {
+                        std::unique_lock<std::mutex> lock(this->groupMutex);
+                        this->doneCondition.wait(lock, [this] { return this->pendingJobs == 0; });
+                        return;
+                    }
+                }
+            }
+
+        private:
+            thread_pool& pool;
+
+            std::mutex groupMutex;
+            std::condition_variable doneCondition;
+            size_t pendingJobs = 0;
+    };
+}
+
+#define THREAD_POOL_H
+#endif
@@ -0,0 +1,13 @@
+/* What `ldh update` does once the manifest has been parsed (and reconciled with the lock file): resolve every
+ * dependency, record the outcome in the lock file, and leave the traces `ldh gc` and build systems rely on (lock
+ * registry, stamps). Shared by the `ldh` binary and `libldh`.
+ */
+
+#if !defined(UPDATE_H)
+#include "application_context.hpp"
+#include "configuration_io.hpp"
+
+bool UpdateProject(application_context&, configuration&);
+
+#define UPDATE_H
+#endif
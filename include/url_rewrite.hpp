@@ -0,0 +1,54 @@
+/* URL rewriting lets a host fetch dependencies from nearby mirrors while manifests (and locks) keep naming the
+ * canonical remotes. Rules live in a per-user file, `$LDH_HOME/mirrors.toml`, and work like git's `insteadOf`:
+ *
+ *     [[mirror]]
+ *     url = "file:///srv/mirrors/github/"
+ *     instead_of = "https://github.com/"
+ *
+ * A remote URL starting with `instead_of` is fetched from `url` plus the rest of the remote URL instead. When
+ * several prefixes match, the longest one wins; all rules with that prefix are tried in the order they appear in
+ * the file, and the canonical URL is always tried last. Rewriting only ever affects where objects are fetched
+ * from: checkouts are still set up (and locked) against the canonical URL.
+ */
+
+#if !defined(URL_REWRITE_H)
+#include <string>
+#include <vector>
+
+#include "application_context.hpp"
+
+using namespace std;
+
+
+const string MIRROR_CONFIGURATION_FILE_NAME = "mirrors.toml";
+
+
+struct url_rewrite_rule {
+    string prefix;
+    string replacement;
+};
+
+
+class url_rewriter {
+    public:
+        void AddRule(url_rewrite_rule rule);
+
+        // Mirror URLs to try for `remoteUrl`, in order. Does not include `remoteUrl` itself.
+        vector<string> MirrorsOf(const string& remoteUrl) const;
+
+        bool Empty() const {
+            return this->rules.empty();
+        }
+
+    private:
+        vector<url_rewrite_rule> rules;
+};
+
+
+string GetMirrorConfigurationPath();
+
+bool LoadUrlRewriter(application_context&);
+vector<string> GetMirrorUrls(application_context&, const string&);
+
+#define URL_REWRITE_H
+#endif
@@ -1,6 +1,14 @@
 #if !defined(UTILS_H)
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 namespace utils {
     enum directory_creation_mode {
         ERROR_IF_EXISTS = 0,
@@ -17,6 +25,108 @@ namespace utils {
         return std::string(fileName);
     }
 
+    // Per-user directory for state shared between `ldh` runs (lock registry, caches). Can be overridden through
+    // the `LDH_HOME` environment variable.
+    std::string GetLdhHomeDirectory() {
+        const char* ldhHome = std::getenv("LDH_HOME");
+        if (ldhHome && *ldhHome) {
+            return std::string(ldhHome);
+        }
+
+        const char* home = std::getenv("HOME");
+        return std::string(home ? home : ".") + "/.ldh";
+    }
+
+    std::string FormatByteCount(uintmax_t byteCount) {
+        const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+
+        double value = (double) byteCount;
+        size_t unitIndex = 0;
+        while (value >= 1024.0 && unitIndex < 4) {
+            value /= 1024.0;
+            unitIndex++;
+        }
+
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), unitIndex ? "%.1f %s" : "%.0f %s", value, units[unitIndex]);
+
+        return std::string(buffer);
+    }
+
+    // Parses sizes like `512M`, `2GiB` or `1048576` (units are binary, a trailing `B` or `iB` optional).
+    bool ParseByteCount(const std::string& text, uintmax_t& byteCount) {
+        size_t digitsEnd = 0;
+        while (digitsEnd < text.size() && isdigit((unsigned char) text[digitsEnd])) {
+            digitsEnd++;
+        }
+
+        if (!digitsEnd || digitsEnd > 15) {
+            return false;
+        }
+
+        std::string unit = text.substr(digitsEnd);
+        for (char& c : unit) {
+            c = toupper((unsigned char) c);
+        }
+        if (unit.size() > 1 && (unit.compare(1, std::string::npos, "B") == 0 ||
+                                unit.compare(1, std::string::npos, "IB") == 0)) {
+            unit.resize(1);
+        }
+
+        const char* units[] = {"", "K", "M", "G", "T"};
+        for (size_t unitIndex = 0; unitIndex < 5; unitIndex++) {
+            if (unit == units[unitIndex] || (!unitIndex && unit == "B")) {
+                uintmax_t value = std::stoull(text.substr(0, digitsEnd));
+                if (value > (UINTMAX_MAX >> (10 * unitIndex))) {
+                    return false;
+                }
+
+                byteCount = value << (10 * unitIndex);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Total size of the regular files under `pathStr` (or of `pathStr` itself, if it is a file). Symlinks are not
+    // followed.
+    uintmax_t DirectorySize(std::string pathStr) {
+        uintmax_t total = 0;
+
+        std::error_code iterationError;
+        if (std::filesystem::is_regular_file(std::filesystem::symlink_status(pathStr, iterationError))) {
+            uintmax_t fileSize = std::filesystem::file_size(pathStr, iterationError);
+            return iterationError ? 0 : fileSize;
+        }
+
+        std::filesystem::recursive_directory_iterator it(pathStr, iterationError);
+        for (; !iterationError && it != std::filesystem::recursive_directory_iterator(); it.increment(iterationError)) {
+            std::error_code sizeError;
+            if (it->is_regular_file(sizeError) && !it->is_symlink(sizeError)) {
+                uintmax_t fileSize = it->file_size(sizeError);
+                total += sizeError ? 0 : fileSize;
+            }
+        }
+
+        return total;
+    }
+
+    // Entries extracted from bundles or archives may only point below the directory they are extracted into.
+    bool IsSafeRelativePath(const std::filesystem::path& path) {
+        if (path.empty() || path.is_absolute()) {
+            return false;
+        }
+
+        for (const std::filesystem::path& component : path) {
+            if (component == "..") {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
     bool FileExists(std::string pathStr) {
         std::filesystem::path path = std::filesystem::path(pathStr);
 
@@ -36,13 +146,32 @@ namespace utils {
         return true;
     }
 
+    // Flushes a file (or, for a directory, its entries, e.g. one just renamed into it) to disk.
+    bool SyncPath(std::string pathStr) {
+        int descriptor = open(pathStr.c_str(), O_RDONLY | O_CLOEXEC);
+        if (descriptor < 0) {
+            return false;
+        }
+
+        bool synced = fsync(descriptor) == 0;
+        close(descriptor);
+
+        return synced;
+    }
+
+    bool SyncParentDirectory(std::string pathStr) {
+        std::filesystem::path parentPath = std::filesystem::path(pathStr).parent_path();
+
+        return SyncPath(parentPath.empty() ? "." : parentPath.string());
+    }
+
 
     bool RenameNode(application_context& ctx, std::string oldPathToNode, std::string newPathToNode) {
         std::filesystem::path oldPath = std::filesystem::path(oldPathToNode);
         std::filesystem::path newPath = std::filesystem::path(newPathToNode);
 
         std::error_code nodeRenamingError;
-        std::filesystem::rename(oldPath, newPath);
+        std::filesystem::rename(oldPath, newPath, nodeRenamingError);
 
         if (nodeRenamingError) {
             ctx.userLogger->error("Failed while trying to rename node \"{}\" to \"{}\"", oldPathToNode,
@@ -0,0 +1,34 @@
+/* Bulk validation of manifests, i.e. `ldh validate <path>...`.
+ *
+ * Paths are either manifests or directories, the latter being searched recursively for `ldh.toml` files (hidden
+ * directories, and the `target/` directory next to each manifest, with its dependency checkouts, are skipped). All
+ * manifests are parsed and checked in parallel, in a single process. Each one's log output is collected separately
+ * and reported together with its status once all are done, so that the diagnostics of different manifests are
+ * never interleaved.
+ */
+
+#if !defined(VALIDATION_H)
+#include <string>
+#include <vector>
+
+#include "application_context.hpp"
+
+using namespace std;
+
+
+const string MANIFEST_FILE_NAME = "ldh.toml";
+
+
+struct manifest_validation {
+    string configurationFilePath;
+
+    bool valid;
+    string diagnostics;
+};
+
+
+bool DiscoverManifests(application_context&, const vector<string>&, vector<string>&);
+bool ValidateManifests(application_context&, const vector<string>&);
+
+#define VALIDATION_H
+#endif
@@ -0,0 +1,37 @@
+/* Workspaces resolve the manifests of several packages in a single run.
+ *
+ * A workspace manifest lists its member packages:
+ *
+ *     [workspace]
+ *     members = ["core", "passes/lgraph", "inou/yosys/ldh.toml"]
+ *
+ * Members are paths relative to the workspace manifest; a directory stands for the `ldh.toml` inside it. All
+ * members are parsed in parallel, their dependencies are merged so that every unique (source, version) pair is
+ * fetched exactly once, and each member then gets its own lock file next to its manifest. As checkouts are named
+ * after dependencies, members may only share a dependency name if they also share its source.
+ */
+
+#if !defined(WORKSPACE_H)
+#include <string>
+#include <vector>
+
+#include "application_context.hpp"
+#include "configuration_io.hpp"
+
+using namespace std;
+
+
+struct workspace_member {
+    string configurationFilePath;
+    string lockFilePath;
+
+    configuration config;
+    bool parsed;
+};
+
+
+bool ParseWorkspace(application_context&, string&, vector<workspace_member>&);
+bool UpdateWorkspace(application_context&, string&);
+
+#define WORKSPACE_H
+#endif
@@ -0,0 +1,985 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "archive_lib.hpp"
+#include "utils.hpp"
+
+
+namespace fs = std::filesystem;
+
+
+/***************************************************
+ * Tar extraction
+ ***************************************************/
+
+
+// Numeric header fields are octal, terminated by a NUL or a space, unless the high bit of their first byte is set,
+// in which case (a GNU extension, for values that do not fit) they are big-endian binary.
+bool ParseTarNumber(const char* field, size_t length, uint64_t& value) {
+    value = 0;
+
+    if ((uint8_t) field[0] & 0x80) {
+        for (size_t i = 0; i < length; i++) {
+            if (value >> 56) {
+                return false;
+            }
+
+            value = (value << 8) | (uint8_t) (i ? field[i] : field[i] & 0x7f);
+        }
+
+        return true;
+    }
+
+    size_t i = 0;
+    while (i < length && field[i] == ' ') {
+        i++;
+    }
+
+    for (; i < length && field[i] >= '0' && field[i] <= '7'; i++) {
+        value = (value << 3) | (uint64_t) (field[i] - '0');
+    }
+
+    return i == length || field[i] == '\0' || field[i] == ' ';
+}
+
+
+string TarField(const char* field, size_t length) {
+    return string(field, strnlen(field, length));
+}
+
+
+bool tar_extractor::Fail(string message) {
+    if (this->error.empty()) {
+        this->error = move(message);
+    }
+
+    return false;
+}
+
+
+bool tar_extractor::IsBelowSymlink(const fs::path& relativePath) {
+    fs::path prefix;
+    for (const fs::path& component : relativePath) {
+        prefix /= component;
+        if (this->symlinks.count(prefix.string())) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+bool tar_extractor::Feed(const char* data, size_t length) {
+    while (length) {
+        size_t chunkLength = 0;
+
+        switch (this->state) {
+            case extractor_state::HEADER:
+                {
+                    chunkLength = min(length, TAR_BLOCK_SIZE - this->headerLength);
+                    memcpy(this->header + this->headerLength, data, chunkLength);
+                    this->headerLength += chunkLength;
+
+                    if (this->headerLength == TAR_BLOCK_SIZE) {
+                        this->headerLength = 0;
+                        if (!this->ProcessHeader()) {
+                            return false;
+                        }
+                    }
+                    break;
+                }
+            case extractor_state::CONTENTS:
+                {
+                    chunkLength = (size_t) min<uint64_t>(length, this->contentsRemaining);
+                    if (this->currentKind == entry_kind::FILE && !this->currentFile.write(data, chunkLength)) {
+                        return this->Fail("failed while writing \"" + this->currentPath.string() + "\"");
+                    } else if (this->currentKind == entry_kind::METADATA) {
+                        this->metadata.append(data, chunkLength);
+                    }
+
+                    this->contentsRemaining -= chunkLength;
+                    if (!this->contentsRemaining && !this->EndEntry()) {
+                        return false;
+                    }
+                    break;
+                }
+            case extractor_state::PADDING:
+                {
+                    chunkLength = (size_t) min<uint64_t>(length, this->paddingRemaining);
+
+                    this->paddingRemaining -= chunkLength;
+                    if (!this->paddingRemaining) {
+                        this->state = extractor_state::HEADER;
+                    }
+                    break;
+                }
+            case extractor_state::END:
+                {
+                    // whatever follows the end-of-archive marker (usually more zero blocks) is ignored
+                    return true;
+                }
+        }
+
+        data += chunkLength;
+        length -= chunkLength;
+    }
+
+    return true;
+}
+
+
+bool tar_extractor::ProcessHeader() {
+    if (all_of(this->header, this->header + TAR_BLOCK_SIZE, [](char c) { return c == '\0'; })) {
+        this->state = extractor_state::END;
+        return true;
+    }
+
+    // the checksum is computed with its own field taken as spaces
+    uint64_t storedChecksum;
+    uint64_t checksum = 0;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; i++) {
+        checksum += (i >= 148 && i < 156) ? ' ' : (uint8_t) this->header[i];
+    }
+
+    if (!ParseTarNumber(this->header + 148, 8, storedChecksum) || checksum != storedChecksum) {
+        return this->Fail("bad tar header checksum, the archive is corrupt (or not a tar archive)");
+    }
+
+    uint64_t mode;
+    uint64_t size;
+    if (!ParseTarNumber(this->header + 100, 8, mode) || !ParseTarNumber(this->header + 124, 12, size)) {
+        return this->Fail("malformed tar header");
+    }
+
+    this->currentType = this->header[156];
+    this->currentPermissions = (fs::perms) (mode & 0777);
+
+    string path = TarField(this->header, 100);
+    string linkPath = TarField(this->header + 157, 100);
+
+    // POSIX ustar splits long paths between `name` and `prefix` (old GNU archives use the latter for other things)
+    if (!memcmp(this->header + 257, "ustar\0", 6)) {
+        string prefix = TarField(this->header + 345, 155);
+        if (!prefix.empty()) {
+            path = prefix + "/" + path;
+        }
+    }
+
+    bool isMetadata = this->currentType == 'L' || this->currentType == 'K' || this->currentType == 'x' ||
+        this->currentType == 'g';
+    if (!isMetadata) {
+        if (!this->nextPath.empty()) {
+            path = move(this->nextPath);
+            this->nextPath.clear();
+        }
+
+        if (!this->nextLinkPath.empty()) {
+            linkPath = move(this->nextLinkPath);
+            this->nextLinkPath.clear();
+        }
+
+        if (this->hasNextSize) {
+            size = this->nextSize;
+            this->hasNextSize = false;
+        }
+    }
+
+    return this->BeginEntry(path, linkPath, size);
+}
+
+
+bool tar_extractor::BeginEntry(const string& path, const string& linkPath, uint64_t size) {
+    this->contentsRemaining = size;
+    this->paddingRemaining = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+    this->currentKind = entry_kind::SKIPPED;
+    this->state = extractor_state::CONTENTS;
+
+    switch (this->currentType) {
+        case 'L':
+        case 'K':
+        case 'x':
+            {
+                if (size > TAR_MAX_METADATA_SIZE) {
+                    return this->Fail("oversized tar metadata entry");
+                }
+
+                this->currentKind = entry_kind::METADATA;
+                this->metadata.clear();
+
+                return size ? true : this->EndEntry();
+            }
+        case 'g':
+            {
+                // global pax headers only carry metadata we do not restore (times, owners)
+                return size ? true : this->EndEntry();
+            }
+        default:
+            {
+                break;
+            }
+    }
+
+    string trimmedPath = path;
+    while (!trimmedPath.empty() && trimmedPath.back() == '/') {
+        trimmedPath.pop_back();
+    }
+
+    fs::path relativePath = fs::path(trimmedPath).lexically_normal();
+    if (relativePath.empty() || relativePath == ".") {
+        // the archive's root itself
+        return size ? true : this->EndEntry();
+    }
+
+    if (!utils::IsSafeRelativePath(relativePath) || this->IsBelowSymlink(relativePath)) {
+        return this->Fail("archive entry \"" + path + "\" points outside of its extraction directory");
+    }
+
+    fs::path targetPath = this->root / relativePath;
+    std::error_code entryError;
+
+    if (this->currentType != '5') {
+        fs::create_directories(targetPath.parent_path(), entryError);
+
+        // a symlink left here by an earlier entry would otherwise be written through
+        if (!entryError && fs::is_symlink(fs::symlink_status(targetPath, entryError))) {
+            fs::remove(targetPath, entryError);
+            this->symlinks.erase(relativePath.string());
+        }
+        entryError.clear();
+    }
+
+    switch (this->currentType) {
+        case '0':
+        case '7':
+        case '\0':
+            {
+                this->currentFile.open(targetPath, ios::binary | ios::trunc);
+                if (!this->currentFile) {
+                    return this->Fail("could not create \"" + targetPath.string() + "\"");
+                }
+
+                this->currentKind = entry_kind::FILE;
+                this->currentPath = targetPath;
+                break;
+            }
+        case '5':
+            {
+                fs::create_directories(targetPath, entryError);
+                this->directoryPermissions.emplace_back(targetPath, this->currentPermissions);
+                break;
+            }
+        case '2':
+            {
+                fs::create_symlink(linkPath, targetPath, entryError);
+                this->symlinks.insert(relativePath.string());
+                break;
+            }
+        case '1':
+            {
+                fs::path linkTarget = fs::path(linkPath).lexically_normal();
+                if (!utils::IsSafeRelativePath(linkTarget) || this->IsBelowSymlink(linkTarget)) {
+                    return this->Fail("archive hard link \"" + path + "\" points outside of its extraction directory");
+                }
+
+                fs::create_hard_link(this->root / linkTarget, targetPath, entryError);
+                break;
+            }
+        default:
+            {
+                // devices, fifos and the like have no business in a dependency
+                break;
+            }
+    }
+
+    if (entryError) {
+        return this->Fail("could not create \"" + targetPath.string() + "\": " + entryError.message());
+    }
+
+    return size ? true : this->EndEntry();
+}
+
+
+bool tar_extractor::EndEntry() {
+    if (this->currentKind == entry_kind::FILE) {
+        this->currentFile.close();
+        if (!this->currentFile) {
+            return this->Fail("failed while writing \"" + this->currentPath.string() + "\"");
+        }
+
+        std::error_code permissionsError;
+        fs::permissions(this->currentPath, this->currentPermissions | fs::perms::owner_read, permissionsError);
+
+        this->extractedFiles++;
+    } else if (this->currentKind == entry_kind::METADATA) {
+        if (this->currentType == 'L') {
+            this->nextPath = TarField(this->metadata.data(), this->metadata.size());
+        } else if (this->currentType == 'K') {
+            this->nextLinkPath = TarField(this->metadata.data(), this->metadata.size());
+        } else if (!this->ParsePaxHeader()) {
+            return false;
+        }
+    }
+
+    this->currentKind = entry_kind::SKIPPED;
+    this->state = this->paddingRemaining ? extractor_state::PADDING : extractor_state::HEADER;
+
+    return true;
+}
+
+
+// pax records look like `<record length> <key>=<value>\n`, the length covering the whole record.
+bool tar_extractor::ParsePaxHeader() {
+    string_view remaining(this->metadata);
+
+    while (!remaining.empty()) {
+        size_t separatorIndex = remaining.find(' ');
+        uint64_t recordLength = 0;
+        if (separatorIndex == string_view::npos ||
+                from_chars(remaining.data(), remaining.data() + separatorIndex, recordLength).ec != errc() ||
+                recordLength <= separatorIndex + 1 || recordLength > remaining.size() ||
+                remaining[recordLength - 1] != '\n') {
+            return this->Fail("malformed pax header");
+        }
+
+        string_view record = remaining.substr(separatorIndex + 1, recordLength - separatorIndex - 2);
+        remaining.remove_prefix(recordLength);
+
+        size_t equalsIndex = record.find('=');
+        if (equalsIndex == string_view::npos) {
+            return this->Fail("malformed pax header");
+        }
+
+        string_view key = record.substr(0, equalsIndex);
+        string_view value = record.substr(equalsIndex + 1);
+        if (key == "path") {
+            this->nextPath = string(value);
+        } else if (key == "linkpath") {
+            this->nextLinkPath = string(value);
+        } else if (key == "size") {
+            if (from_chars(value.data(), value.data() + value.size(), this->nextSize).ec != errc()) {
+                return this->Fail("malformed pax header");
+            }
+
+            this->hasNextSize = true;
+        }
+    }
+
+    return true;
+}
+
+
+bool tar_extractor::Finish() {
+    // archives without an end-of-archive marker are fine, as long as they do not stop in the middle of an entry
+    bool complete = this->state == extractor_state::END ||
+        (this->state == extractor_state::HEADER && !this->headerLength);
+    if (!complete) {
+        return this->Fail("archive is truncated");
+    }
+
+    // applied last, so that read-only directories could still be written into while extracting
+    for (auto& [path, permissions] : this->directoryPermissions) {
+        std::error_code permissionsError;
+        fs::permissions(path, permissions | fs::perms::owner_all, permissionsError);
+    }
+
+    return true;
+}
+
+
+/***************************************************
+ * Decompression
+ ***************************************************/
+
+
+archive_decoder::~archive_decoder() {
+    if (this->inflateInitialized) {
+        inflateEnd(&this->inflateStream);
+    }
+
+    if (this->zstdStream) {
+        ZSTD_freeDStream(this->zstdStream);
+    }
+}
+
+
+bool archive_decoder::DetectCompression() {
+    const uint8_t* magic = (const uint8_t*) this->pendingInput.data();
+    size_t magicLength = this->pendingInput.size();
+
+    if (magicLength >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        this->compression = archive_compression::ARCHIVE_COMPRESSION_GZIP;
+
+        // gzip wrapper only
+        if (inflateInit2(&this->inflateStream, 16 + MAX_WBITS) != Z_OK) {
+            this->error = "could not initialize gzip decompression";
+            return false;
+        }
+        this->inflateInitialized = true;
+    } else if (magicLength >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+        this->compression = archive_compression::ARCHIVE_COMPRESSION_ZSTD;
+
+        // frames needing a larger window fail to decode, instead of growing past `ARCHIVE_MEMORY_ESTIMATE`
+        this->zstdStream = ZSTD_createDStream();
+        if (!this->zstdStream || ZSTD_isError(ZSTD_initDStream(this->zstdStream)) ||
+                ZSTD_isError(ZSTD_DCtx_setParameter(this->zstdStream, ZSTD_d_windowLogMax,
+                                                    ARCHIVE_ZSTD_WINDOW_LOG_MAX))) {
+            this->error = "could not initialize zstd decompression";
+            return false;
+        }
+    } else {
+        this->compression = archive_compression::ARCHIVE_COMPRESSION_NONE;
+    }
+
+    return true;
+}
+
+
+bool archive_decoder::Feed(const char* data, size_t length) {
+    if (this->compression != archive_compression::ARCHIVE_COMPRESSION_UNKNOWN) {
+        return this->Decode(data, length);
+    }
+
+    // held back until there are enough bytes to tell compression formats apart
+    this->pendingInput.append(data, length);
+    if (this->pendingInput.size() < 4) {
+        return true;
+    }
+
+    if (!this->DetectCompression()) {
+        return false;
+    }
+
+    string pendingInput = move(this->pendingInput);
+    return this->Decode(pendingInput.data(), pendingInput.size());
+}
+
+
+bool archive_decoder::Forward(const char* data, size_t length) {
+    if (!this->extractor->Feed(data, length)) {
+        this->error = this->extractor->error;
+        return false;
+    }
+
+    return true;
+}
+
+
+bool archive_decoder::Decode(const char* data, size_t length) {
+    switch (this->compression) {
+        case archive_compression::ARCHIVE_COMPRESSION_GZIP:
+            {
+                this->inflateStream.next_in = (Bytef*) data;
+                this->inflateStream.avail_in = (uInt) length;
+
+                // output left inside zlib after filling the buffer is drained even without new input
+                bool outputFull = false;
+                while (this->inflateStream.avail_in || outputFull) {
+                    if (this->inflateEnded) {
+                        if (!this->inflateStream.avail_in) {
+                            break;
+                        }
+
+                        // concatenated gzip members decompress to the concatenation of their contents
+                        inflateReset(&this->inflateStream);
+                        this->inflateEnded = false;
+                    }
+
+                    this->inflateStream.next_out = (Bytef*) this->outputBuffer.data();
+                    this->inflateStream.avail_out = (uInt) this->outputBuffer.size();
+
+                    int rc = inflate(&this->inflateStream, Z_NO_FLUSH);
+                    if (rc == Z_BUF_ERROR) {
+                        break;
+                    }
+
+                    if (rc != Z_OK && rc != Z_STREAM_END) {
+                        this->error = string("gzip decompression failed: ") +
+                            (this->inflateStream.msg ? this->inflateStream.msg : zError(rc));
+                        return false;
+                    }
+
+                    size_t outputLength = this->outputBuffer.size() - this->inflateStream.avail_out;
+                    if (!this->Forward(this->outputBuffer.data(), outputLength)) {
+                        return false;
+                    }
+
+                    outputFull = this->inflateStream.avail_out == 0;
+                    this->inflateEnded = rc == Z_STREAM_END;
+                }
+
+                return true;
+            }
+        case archive_compression::ARCHIVE_COMPRESSION_ZSTD:
+            {
+                ZSTD_inBuffer input = { data, length, 0 };
+
+                bool outputFull = false;
+                while (input.pos < input.size || outputFull) {
+                    ZSTD_outBuffer output = { this->outputBuffer.data(), this->outputBuffer.size(), 0 };
+
+                    size_t rc = ZSTD_decompressStream(this->zstdStream, &output, &input);
+                    if (ZSTD_isError(rc)) {
+                        this->error = string("zstd decompression failed: ") + ZSTD_getErrorName(rc);
+                        return false;
+                    }
+                    this->zstdLastResult = rc;
+
+                    if (!this->Forward(this->outputBuffer.data(), output.pos)) {
+                        return false;
+                    }
+
+                    outputFull = output.pos == output.size;
+                }
+
+                return true;
+            }
+        default:
+            {
+                return this->Forward(data, length);
+            }
+    }
+}
+
+
+bool archive_decoder::Finish() {
+    if (this->compression == archive_compression::ARCHIVE_COMPRESSION_UNKNOWN) {
+        // fewer bytes than any magic number, so certainly not compressed
+        this->compression = archive_compression::ARCHIVE_COMPRESSION_NONE;
+        if (!this->Decode(this->pendingInput.data(), this->pendingInput.size())) {
+            return false;
+        }
+    }
+
+    if (this->compression == archive_compression::ARCHIVE_COMPRESSION_GZIP && !this->inflateEnded) {
+        this->error = "gzip stream is truncated";
+        return false;
+    }
+
+    // zero once a frame has been fully decoded and flushed
+    if (this->compression == archive_compression::ARCHIVE_COMPRESSION_ZSTD && this->zstdLastResult) {
+        this->error = "zstd stream is truncated";
+        return false;
+    }
+
+    return true;
+}
+
+
+/***************************************************
+ * Download and cache
+ ***************************************************/
+
+
+string GetArchiveCacheDirectory() {
+    return utils::GetLdhHomeDirectory() + "/cache/archives";
+}
+
+
+string GetArchiveCachePath(const string& checksum) {
+    return GetArchiveCacheDirectory() + "/" + checksum;
+}
+
+
+bool IsArchiveCached(const string& checksum) {
+    return utils::FileExists(GetArchiveCachePath(checksum));
+}
+
+
+// Every byte of an archive goes through here, in order: hashing, the cache (when downloading), decompression and
+// extraction. Without a staging path, archives are only hashed and cached (see `PrefetchArchive`).
+struct archive_pipeline {
+    sha256 hasher;
+    ofstream* cacheStream;
+    bool extracting;
+    tar_extractor extractor;
+    archive_decoder decoder;
+
+    transfer_progress* progress;
+    size_t receivedBytes = 0;
+
+    string error;
+
+    archive_pipeline(const string& stagingPath, ofstream* c, transfer_progress* p):
+        cacheStream(c), extracting(!stagingPath.empty()), extractor(stagingPath), decoder(&this->extractor),
+        progress(p) {}
+
+    bool Feed(const char* data, size_t length) {
+        this->hasher.Update(data, length);
+
+        this->receivedBytes += length;
+        if (this->progress) {
+            this->progress->receivedBytes.store(this->receivedBytes, memory_order_relaxed);
+            if (this->progress->reporter) {
+                this->progress->reporter->MaybeRender();
+            }
+        }
+
+        if (this->cacheStream && !this->cacheStream->write(data, length)) {
+            this->error = "failed while writing to the archive cache";
+            return false;
+        }
+
+        if (this->extracting && !this->decoder.Feed(data, length)) {
+            this->error = this->decoder.error;
+            return false;
+        }
+
+        return true;
+    }
+
+    // Checks that the archive was complete, and returns the checksum of everything fed through `checksum`.
+    bool Finish(string& checksum) {
+        if (this->extracting && !this->decoder.Finish()) {
+            this->error = this->decoder.error;
+            return false;
+        }
+
+        if (this->extracting && !this->extractor.Finish()) {
+            this->error = this->extractor.error;
+            return false;
+        }
+
+        if (this->extracting && this->progress) {
+            this->progress->receivedObjects.store(this->extractor.extractedFiles, memory_order_relaxed);
+            this->progress->checkedOutFiles.store(this->extractor.extractedFiles, memory_order_relaxed);
+        }
+
+        checksum = sha256::ToHex(this->hasher.Finalize());
+        return true;
+    }
+};
+
+
+size_t ArchiveWriteCallback(char* data, size_t size, size_t count, void* payload) {
+    archive_pipeline* pipeline = (archive_pipeline*) payload;
+
+    // anything other than the full length makes libcurl abort the transfer
+    return pipeline->Feed(data, size * count) ? size * count : 0;
+}
+
+
+bool IsRetryableDownloadError(CURLcode rc, long responseCode) {
+    switch (rc) {
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_GOT_NOTHING:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+            {
+                return true;
+            }
+        case CURLE_HTTP_RETURNED_ERROR:
+            {
+                return responseCode >= 500 || responseCode == 408 || responseCode == 429;
+            }
+        default:
+            {
+                return false;
+            }
+    }
+}
+
+
+bool ResetStagingDirectory(application_context& ctx, const string& stagingPath) {
+    if (utils::DirectoryExists(stagingPath) && !utils::DeleteDirAndContents(ctx, stagingPath)) {
+        return false;
+    }
+
+    return utils::MakeDirs(ctx, stagingPath, utils::directory_creation_mode::IGNORE_IF_EXISTS);
+}
+
+
+struct download_outcome {
+    bool successful;
+    bool retryable;
+    string error;
+};
+
+
+download_outcome DownloadArchiveOnce(application_context& ctx, const string& url, const string& checksum,
+                                     const string& stagingPath, const string& temporaryCachePath,
+                                     transfer_progress* progress) {
+    if (!stagingPath.empty() && !ResetStagingDirectory(ctx, stagingPath)) {
+        return { false, false, "could not create \"" + stagingPath + "\"" };
+    }
+
+    ofstream cacheStream(temporaryCachePath, ios::binary | ios::trunc);
+    if (!cacheStream) {
+        return { false, false, "could not create \"" + temporaryCachePath + "\"" };
+    }
+
+    archive_pipeline pipeline(stagingPath, &cacheStream, progress);
+
+    unique_ptr<CURL, void (*)(CURL*)> curl(curl_easy_init(), curl_easy_cleanup);
+    if (!curl) {
+        return { false, false, "could not initialize libcurl" };
+    }
+
+    char errorBuffer[CURL_ERROR_SIZE] = "";
+    string userAgent = "ldh/" + LDH_VERSION;
+
+    curl_easy_setopt(curl.get(), CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl.get(), CURLOPT_USERAGENT, userAgent.c_str());
+    curl_easy_setopt(curl.get(), CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl.get(), CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl.get(), CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl.get(), CURLOPT_CONNECTTIMEOUT, ARCHIVE_CONNECT_TIMEOUT_SECONDS);
+    curl_easy_setopt(curl.get(), CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(curl.get(), CURLOPT_LOW_SPEED_TIME, ARCHIVE_STALL_TIMEOUT_SECONDS);
+    curl_easy_setopt(curl.get(), CURLOPT_ERRORBUFFER, errorBuffer);
+    curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, ArchiveWriteCallback);
+    curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &pipeline);
+
+    CURLcode rc;
+    string actualChecksum;
+    bool pipelineFinished = false;
+    {
+        scheduled_slot transferSlot(ctx.TransferSlots(url));
+        // only archives being extracted are decompressed
+        scheduled_memory archiveMemory(ctx.JobMemory(), pipeline.extracting ? ARCHIVE_MEMORY_ESTIMATE : 0);
+        rc = curl_easy_perform(curl.get());
+        pipelineFinished = rc == CURLE_OK && pipeline.Finish(actualChecksum);
+    }
+
+    if (rc != CURLE_OK) {
+        if (rc == CURLE_WRITE_ERROR && !pipeline.error.empty()) {
+            return { false, false, pipeline.error };
+        }
+
+        long responseCode = 0;
+        curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &responseCode);
+
+        return { false, IsRetryableDownloadError(rc, responseCode), *errorBuffer ? errorBuffer : curl_easy_strerror(rc) };
+    }
+
+    if (ctx.metrics) {
+        ctx.metrics->fetches.fetch_add(1, memory_order_relaxed);
+        ctx.metrics->fetchedBytes.fetch_add(pipeline.receivedBytes, memory_order_relaxed);
+    }
+
+    if (!pipelineFinished) {
+        return { false, false, pipeline.error };
+    }
+
+    cacheStream.close();
+    if (!cacheStream) {
+        return { false, false, "failed while writing to the archive cache" };
+    }
+
+    if (actualChecksum != checksum) {
+        return { false, false, "checksum mismatch, expected " + checksum + " but got " + actualChecksum };
+    }
+
+    return { true, false, "" };
+}
+
+
+// Downloads (and extracts, unless `stagingPath` is empty) an archive into `stagingPath`, retrying like git fetches
+// do. The download is stored in the cache once its checksum has been verified.
+bool DownloadArchive(application_context& ctx, const string& url, const string& checksum,
+                     const string& stagingPath, transfer_progress* progress) {
+    static once_flag curlInitialized;
+    call_once(curlInitialized, [] {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+    });
+
+    if (!utils::MakeDirs(ctx, GetArchiveCacheDirectory(), utils::directory_creation_mode::IGNORE_IF_EXISTS)) {
+        return false;
+    }
+
+    string cachePath = GetArchiveCachePath(checksum);
+    ostringstream temporaryCachePathStream;
+    temporaryCachePathStream << cachePath << ".tmp." << getpid() << "." << this_thread::get_id();
+    string temporaryCachePath = temporaryCachePathStream.str();
+
+    unsigned int maxAttempts = ctx.args->fetchRetries + 1;
+    chrono::milliseconds delay = FETCH_RETRY_INITIAL_DELAY;
+
+    thread_local mt19937 jitterGenerator(random_device{}());
+
+    download_outcome outcome;
+    for (unsigned int attempt = 1; attempt <= maxAttempts; attempt++) {
+        outcome = DownloadArchiveOnce(ctx, url, checksum, stagingPath, temporaryCachePath, progress);
+        if (outcome.successful || !outcome.retryable || attempt == maxAttempts) {
+            break;
+        }
+
+        uniform_int_distribution<long> jitter(0, delay.count() / 4);
+        chrono::milliseconds wait = delay + chrono::milliseconds(jitter(jitterGenerator));
+
+        ctx.userLogger->warn("Downloading from \"{}\" failed (attempt {}/{}): {}; retrying in {}ms", url, attempt,
+                             maxAttempts, outcome.error, wait.count());
+        this_thread::sleep_for(wait);
+
+        delay = min(delay * 2, FETCH_RETRY_MAX_DELAY);
+    }
+
+    std::error_code cacheError;
+    if (!outcome.successful) {
+        ctx.userLogger->error("Failed while downloading \"{}\"", url);
+        ctx.userLogger->error("Reason: {}", outcome.error);
+        fs::remove(temporaryCachePath, cacheError);
+
+        return false;
+    }
+
+    fs::rename(temporaryCachePath, cachePath, cacheError);
+    if (cacheError) {
+        // the extracted archive is fine, it just will not be reused
+        ctx.applicationLogger->warn("Failed while caching \"{}\": {}", url, cacheError.message());
+        fs::remove(temporaryCachePath, cacheError);
+    }
+
+    return true;
+}
+
+
+bool ExtractCachedArchive(application_context& ctx, const string& cachePath, const string& checksum,
+                          const string& stagingPath, transfer_progress* progress) {
+    scheduled_slot diskSlot(ctx.DiskSlots());
+    scheduled_memory archiveMemory(ctx.JobMemory(), ARCHIVE_MEMORY_ESTIMATE);
+
+    if (!ResetStagingDirectory(ctx, stagingPath)) {
+        return false;
+    }
+
+    // bytes read from the cache are not reported as received
+    archive_pipeline pipeline(stagingPath, nullptr, nullptr);
+
+    ifstream cacheStream(cachePath, ios::binary);
+    vector<char> buffer(ARCHIVE_IO_BUFFER_SIZE);
+    while (cacheStream.read(buffer.data(), buffer.size()) || cacheStream.gcount()) {
+        if (!pipeline.Feed(buffer.data(), cacheStream.gcount())) {
+            break;
+        }
+    }
+
+    string actualChecksum;
+    if (!pipeline.error.empty() || cacheStream.bad() || !pipeline.Finish(actualChecksum) ||
+            actualChecksum != checksum) {
+        ctx.userLogger->warn("Discarding corrupt cached archive \"{}\"{}", cachePath,
+                             pipeline.error.empty() ? "" : ": " + pipeline.error);
+        return false;
+    }
+
+    if (progress) {
+        progress->checkedOutFiles.store(pipeline.extractor.extractedFiles, memory_order_relaxed);
+    }
+
+    return true;
+}
+
+
+// Release archives usually wrap everything in a single top-level directory (`name-1.2.3/`), which is dropped.
+bool PromoteExtractedArchive(application_context& ctx, const string& stagingPath, const string& path) {
+    vector<fs::path> entries;
+
+    std::error_code iterationError;
+    for (const fs::directory_entry& entry : fs::directory_iterator(stagingPath, iterationError)) {
+        entries.push_back(entry.path());
+        if (entries.size() > 1) {
+            break;
+        }
+    }
+
+    if (entries.size() == 1 && fs::is_directory(fs::symlink_status(entries[0], iterationError))) {
+        if (!utils::RenameNode(ctx, entries[0].string(), path)) {
+            return false;
+        }
+
+        fs::remove(stagingPath, iterationError);
+        return true;
+    }
+
+    return utils::RenameNode(ctx, stagingPath, path);
+}
+
+
+resolution_result FetchArchive(application_context& ctx, const string& url, const string& checksum,
+                               const string& path) {
+    resolution_result resolutionResult;
+    string stagingPath = path + STAGING_DIRECTORY_SUFFIX;
+
+    // shared while extracting a cached archive, exclusive while downloading one; another process may have
+    // downloaded it while the lock was converted
+    file_lock cacheLock;
+    string cacheLockPath = GetFileLockPath(GetArchiveCacheDirectory(), checksum);
+    bool cacheLocked = cacheLock.Acquire(ctx, cacheLockPath, file_lock_mode::FILE_LOCK_SHARED) &&
+        (IsArchiveCached(checksum) || cacheLock.Acquire(ctx, cacheLockPath, file_lock_mode::FILE_LOCK_EXCLUSIVE));
+    if (!cacheLocked) {
+        return resolutionResult;
+    }
+
+    transfer_progress* progress = BeginProgress(ctx, path);
+
+    bool extracted = false;
+    string cachePath = GetArchiveCachePath(checksum);
+    if (utils::FileExists(cachePath)) {
+        SPDLOG_LOGGER_INFO(ctx.applicationLogger, "Extracting cached archive \"{}\"", cachePath);
+
+        extracted = ExtractCachedArchive(ctx, cachePath, checksum, stagingPath, progress);
+        if (!extracted) {
+            std::error_code removalError;
+            fs::remove(cachePath, removalError);
+        }
+    }
+
+    if (!extracted) {
+        extracted = cacheLock.Acquire(ctx, cacheLockPath, file_lock_mode::FILE_LOCK_EXCLUSIVE) &&
+            DownloadArchive(ctx, url, checksum, stagingPath, progress);
+    }
+
+    extracted = extracted && PromoteExtractedArchive(ctx, stagingPath, path);
+    EndProgress(ctx, progress, extracted);
+
+    if (!extracted) {
+        if (utils::DirectoryExists(stagingPath)) {
+            utils::DeleteDirAndContents(ctx, stagingPath);
+        }
+
+        return resolutionResult;
+    }
+
+    resolutionResult.resolutionSuccessful = true;
+    resolutionResult.localPath = path;
+    resolutionResult.remote = url;
+    resolutionResult.version = checksum;
+
+    return resolutionResult;
+}
+
+
+// Only downloads an archive into the cache, for `ldh fetch`: a later `FetchArchive` then just extracts it.
+bool PrefetchArchive(application_context& ctx, const string& url, const string& checksum) {
+    file_lock cacheLock;
+    if (!cacheLock.Acquire(ctx, GetFileLockPath(GetArchiveCacheDirectory(), checksum),
+                           file_lock_mode::FILE_LOCK_EXCLUSIVE)) {
+        return false;
+    }
+
+    if (IsArchiveCached(checksum)) {
+        SPDLOG_LOGGER_INFO(ctx.applicationLogger, "Archive \"{}\" is already cached", url);
+        return true;
+    }
+
+    string cachePath = GetArchiveCachePath(checksum);
+    transfer_progress* progress = BeginProgress(ctx, cachePath);
+    bool downloaded = DownloadArchive(ctx, url, checksum, "", progress);
+    EndProgress(ctx, progress, downloaded);
+
+    return downloaded;
+}
@@ -0,0 +1,188 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <unordered_set>
+
+#include "build_stamps.hpp"
+#include "utils.hpp"
+
+
+namespace fs = std::filesystem;
+
+
+// Stamps live next to the lock they were derived from, so that workspace members do not share them.
+string GetStampDirectory(const string& lockFilePath) {
+    return (fs::path(lockFilePath).parent_path() / STAMP_DIRECTORY_NAME).string();
+}
+
+
+string GetStampPath(const string& lockFilePath, const string& dependencyName) {
+    string fileName = dependencyName;
+    for (char& c : fileName) {
+        if (!isalnum((unsigned char) c) && c != '-' && c != '_' && c != '.') {
+            c = '_';
+        }
+    }
+
+    return (fs::path(GetStampDirectory(lockFilePath)) / (fileName + STAMP_FILE_EXTENSION)).string();
+}
+
+
+string GetDepfilePath(const string& lockFilePath) {
+    return (fs::path(lockFilePath).parent_path() / DEPFILE_NAME).string();
+}
+
+
+// Only what ends up in the checkout: the same commit (or archive) fetched from elsewhere, e.g. after a remote moved,
+// leaves the stamp alone.
+string StampContents(dependency& dep) {
+    lock_dependency& lockDependency = dep.lockDependency;
+
+    string contents = lockDependency.resolvedVersion + "\n";
+    for (locked_submodule& submodule : lockDependency.submodules) {
+        contents += submodule.path + " " + submodule.resolvedVersion + "\n";
+    }
+
+    return contents;
+}
+
+
+// make and ninja agree on backslash-escaping spaces and `#`, and on doubling `$`.
+string EscapeDepfilePath(const string& path) {
+    string escaped;
+    escaped.reserve(path.size());
+
+    for (char c : path) {
+        if (c == ' ' || c == '#' || c == '\\') {
+            escaped.push_back('\\');
+        } else if (c == '$') {
+            escaped.push_back('$');
+        }
+
+        escaped.push_back(c);
+    }
+
+    return escaped;
+}
+
+
+// Leaves `path` (and its mtime) alone when it already holds `contents`.
+bool WriteFileIfChanged(application_context& ctx, const string& path, const string& contents, bool& changed) {
+    changed = false;
+    if (utils::FileExists(path)) {
+        ifstream currentStream(path, ios::binary);
+        ostringstream currentBuffer;
+        currentBuffer << currentStream.rdbuf();
+
+        if (currentBuffer.str() == contents) {
+            return true;
+        }
+    }
+
+    string temporaryPath = path + ".tmp." + to_string(getpid());
+    {
+        ofstream outputStream(temporaryPath, ios::binary | ios::trunc);
+        outputStream << contents;
+        outputStream.close();
+
+        if (!outputStream) {
+            ctx.applicationLogger->error("Failed while writing \"{}\"", temporaryPath);
+
+            std::error_code removalError;
+            fs::remove(temporaryPath, removalError);
+
+            return false;
+        }
+    }
+
+    std::error_code renameError;
+    fs::rename(temporaryPath, path, renameError);
+    if (renameError) {
+        ctx.applicationLogger->error("Failed while replacing \"{}\": {}", path, renameError.message());
+        fs::remove(temporaryPath, renameError);
+
+        return false;
+    }
+
+    changed = true;
+    return true;
+}
+
+
+// Stamps of dependencies that are no longer locked are removed; the depfile no longer mentions them either.
+void RemoveStaleStamps([[maybe_unused]] application_context& ctx, const string& stampDirectory,
+                       unordered_set<string>& stampPaths) {
+    std::error_code iterationError;
+    for (fs::directory_iterator it(stampDirectory, iterationError), end; !iterationError && it != end;
+            it.increment(iterationError)) {
+        string stampPath = it->path().string();
+        if (it->path().extension() != STAMP_FILE_EXTENSION || stampPaths.count(stampPath)) {
+            continue;
+        }
+
+        SPDLOG_LOGGER_DEBUG(ctx.applicationLogger, "Removing stale stamp \"{}\"", stampPath);
+
+        std::error_code removalError;
+        fs::remove(stampPath, removalError);
+    }
+}
+
+
+bool WriteBuildStamps(application_context& ctx, const string& lockFilePath, vector<dependency>& dependencies) {
+    string stampDirectory = GetStampDirectory(lockFilePath);
+    if (!utils::MakeDirs(ctx, stampDirectory, utils::directory_creation_mode::IGNORE_IF_EXISTS)) {
+        return false;
+    }
+
+    bool allWritten = true;
+    size_t changedStamps = 0;
+    vector<string> orderedStampPaths;
+    unordered_set<string> stampPaths;
+
+    for (dependency& dep : dependencies) {
+        if (!dep.inputDependency.HasValue() || !dep.lockDependency.HasValue()) {
+            continue;
+        }
+
+        string stampPath = GetStampPath(lockFilePath, dep.name);
+        if (!stampPaths.insert(stampPath).second) {
+            ctx.userLogger->warn("Dependency \"{}\" shares its stamp \"{}\" with another dependency", dep.name,
+                                 stampPath);
+            continue;
+        }
+        orderedStampPaths.push_back(stampPath);
+
+        bool changed;
+        if (!WriteFileIfChanged(ctx, stampPath, StampContents(dep), changed)) {
+            allWritten = false;
+            continue;
+        }
+
+        if (changed) {
+            SPDLOG_LOGGER_DEBUG(ctx.applicationLogger, "\"{}\" changed, touched \"{}\"", dep.name, stampPath);
+            changedStamps++;
+        }
+    }
+
+    RemoveStaleStamps(ctx, stampDirectory, stampPaths);
+
+    string depfile = EscapeDepfilePath(lockFilePath) + ":";
+    for (string& stampPath : orderedStampPaths) {
+        depfile += " " + EscapeDepfilePath(stampPath);
+    }
+    depfile += "\n";
+    for (string& stampPath : orderedStampPaths) {
+        depfile += EscapeDepfilePath(stampPath) + ":\n";
+    }
+
+    bool changed;
+    string depfilePath = GetDepfilePath(lockFilePath);
+    if (!WriteFileIfChanged(ctx, depfilePath, depfile, changed)) {
+        allWritten = false;
+    }
+
+    SPDLOG_LOGGER_INFO(ctx.applicationLogger, "{} of {} dependency stamps changed", changedStamps,
+                       orderedStampPaths.size());
+    return allWritten;
+}
@@ -0,0 +1,746 @@
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <zstd.h>
+
+#include "bundle.hpp"
+#include "configuration_io.hpp"
+#include "file_lock.hpp"
+#include "git_lib.hpp"
+#include "lock_registry.hpp"
+#include "thread_pool.hpp"
+#include "utils.hpp"
+
+
+namespace fs = std::filesystem;
+
+
+const char BUNDLE_MAGIC[4] = {'L', 'D', 'H', 'B'};
+
+// Paths and symlink targets longer than this can only come from a corrupt bundle.
+const uint32_t BUNDLE_MAX_STRING_LENGTH = 64 * 1024;
+
+
+/***************************************************
+ * Stream encoding
+ ***************************************************/
+
+
+// Compresses everything written through it into a single zstd frame, ended by `Finish`.
+struct bundle_writer {
+    FILE* file;
+    ZSTD_CStream* zstdStream;
+    vector<char> outputBuffer;
+
+    bundle_writer(FILE* file):
+        file(file), zstdStream(ZSTD_createCStream()), outputBuffer(BUNDLE_IO_BUFFER_SIZE) {}
+
+    ~bundle_writer() {
+        ZSTD_freeCStream(this->zstdStream);
+    }
+
+    bool Initialize() {
+        return this->zstdStream && !ZSTD_isError(ZSTD_initCStream(this->zstdStream, BUNDLE_ZSTD_LEVEL));
+    }
+
+    // Feeds `input` to the encoder and writes out whatever it produces. With `ZSTD_e_end`, this goes on until the
+    // frame is complete.
+    bool Compress(ZSTD_inBuffer& input, ZSTD_EndDirective directive) {
+        size_t remaining;
+        do {
+            ZSTD_outBuffer output = { this->outputBuffer.data(), this->outputBuffer.size(), 0 };
+            remaining = ZSTD_compressStream2(this->zstdStream, &output, &input, directive);
+            if (ZSTD_isError(remaining) || fwrite(output.dst, 1, output.pos, this->file) != output.pos) {
+                return false;
+            }
+        } while (directive == ZSTD_e_end ? remaining != 0 : input.pos < input.size);
+
+        return true;
+    }
+
+    bool Write(const void* data, size_t length) {
+        ZSTD_inBuffer input = { data, length, 0 };
+        return this->Compress(input, ZSTD_e_continue);
+    }
+
+    bool Finish() {
+        ZSTD_inBuffer input = { nullptr, 0, 0 };
+        return this->Compress(input, ZSTD_e_end);
+    }
+
+    bool WriteU8(uint8_t value) {
+        return this->Write(&value, 1);
+    }
+
+    bool WriteU32(uint32_t value) {
+        uint8_t bytes[4];
+        for (int i = 0; i < 4; i++) {
+            bytes[i] = (uint8_t) (value >> (8 * i));
+        }
+
+        return this->Write(bytes, sizeof(bytes));
+    }
+
+    bool WriteU64(uint64_t value) {
+        uint8_t bytes[8];
+        for (int i = 0; i < 8; i++) {
+            bytes[i] = (uint8_t) (value >> (8 * i));
+        }
+
+        return this->Write(bytes, sizeof(bytes));
+    }
+
+    bool WriteString(const string& value) {
+        return this->WriteU32((uint32_t) value.size()) && this->Write(value.data(), value.size());
+    }
+
+    bool WriteRecord(bundle_record record) {
+        return this->WriteU8((uint8_t) record);
+    }
+};
+
+
+struct bundle_reader {
+    FILE* file;
+    ZSTD_DStream* zstdStream;
+    vector<char> inputBuffer;
+    ZSTD_inBuffer input;
+    string scratch;
+
+    bundle_reader(FILE* file):
+        file(file), zstdStream(ZSTD_createDStream()), inputBuffer(BUNDLE_IO_BUFFER_SIZE), input({ nullptr, 0, 0 }) {}
+
+    ~bundle_reader() {
+        ZSTD_freeDStream(this->zstdStream);
+    }
+
+    bool Initialize() {
+        return this->zstdStream && !ZSTD_isError(ZSTD_initDStream(this->zstdStream));
+    }
+
+    bool Read(void* data, size_t length) {
+        ZSTD_outBuffer output = { data, length, 0 };
+        while (output.pos < output.size) {
+            // the decoder flushes all it can on each call, so output left to fill means it needs more input
+            if (this->input.pos == this->input.size) {
+                size_t readLength = fread(this->inputBuffer.data(), 1, this->inputBuffer.size(), this->file);
+                if (!readLength) {
+                    return false;
+                }
+
+                this->input = { this->inputBuffer.data(), readLength, 0 };
+            }
+
+            if (ZSTD_isError(ZSTD_decompressStream(this->zstdStream, &output, &this->input))) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool Skip(uint64_t length) {
+        this->scratch.resize(BUNDLE_IO_BUFFER_SIZE);
+
+        while (length) {
+            size_t chunkLength = (size_t) min<uint64_t>(length, this->scratch.size());
+            if (!this->Read(this->scratch.data(), chunkLength)) {
+                return false;
+            }
+
+            length -= chunkLength;
+        }
+
+        return true;
+    }
+
+    bool ReadU8(uint8_t& value) {
+        return this->Read(&value, 1);
+    }
+
+    bool ReadU32(uint32_t& value) {
+        uint8_t bytes[4];
+        if (!this->Read(bytes, sizeof(bytes))) {
+            return false;
+        }
+
+        value = 0;
+        for (int i = 0; i < 4; i++) {
+            value |= (uint32_t) bytes[i] << (8 * i);
+        }
+
+        return true;
+    }
+
+    bool ReadU64(uint64_t& value) {
+        uint8_t bytes[8];
+        if (!this->Read(bytes, sizeof(bytes))) {
+            return false;
+        }
+
+        value = 0;
+        for (int i = 0; i < 8; i++) {
+            value |= (uint64_t) bytes[i] << (8 * i);
+        }
+
+        return true;
+    }
+
+    bool ReadString(string& value) {
+        uint32_t length;
+        if (!this->ReadU32(length) || length > BUNDLE_MAX_STRING_LENGTH) {
+            return false;
+        }
+
+        value.resize(length);
+        return this->Read(value.data(), length);
+    }
+};
+
+
+/***************************************************
+ * Export
+ ***************************************************/
+
+
+bool ExportFile(bundle_writer& writer, const fs::path& path, uint64_t fileSize, string& buffer) {
+    ifstream fileStream(path, ios::binary);
+
+    for (uint64_t remaining = fileSize; remaining; ) {
+        size_t chunkLength = (size_t) min<uint64_t>(remaining, buffer.size());
+        if (!fileStream.read(buffer.data(), chunkLength) || !writer.Write(buffer.data(), chunkLength)) {
+            return false;
+        }
+
+        remaining -= chunkLength;
+    }
+
+    return true;
+}
+
+
+bool ExportCheckout(application_context& ctx, bundle_writer& writer, const string& checkoutPath, bool gitOnly) {
+    string buffer(BUNDLE_IO_BUFFER_SIZE, '\0');
+
+    std::error_code iterationError;
+    fs::recursive_directory_iterator it(checkoutPath, iterationError);
+    for (; !iterationError && it != fs::recursive_directory_iterator(); it.increment(iterationError)) {
+        fs::path relativePath = it->path().lexically_relative(checkoutPath);
+        fs::file_status status = it->symlink_status();
+
+        if (gitOnly && *relativePath.begin() != ".git") {
+            if (fs::is_directory(status)) {
+                it.disable_recursion_pending();
+            }
+
+            continue;
+        }
+
+        uint32_t mode = (uint32_t) (status.permissions() & fs::perms::mask);
+
+        bool entryWritten;
+        if (fs::is_symlink(status)) {
+            entryWritten = writer.WriteRecord(bundle_record::BUNDLE_RECORD_SYMLINK) &&
+                writer.WriteString(relativePath.string()) &&
+                writer.WriteString(fs::read_symlink(it->path()).string());
+        } else if (fs::is_directory(status)) {
+            entryWritten = writer.WriteRecord(bundle_record::BUNDLE_RECORD_DIRECTORY) &&
+                writer.WriteString(relativePath.string()) && writer.WriteU32(mode);
+        } else if (fs::is_regular_file(status)) {
+            uint64_t fileSize = it->file_size();
+            entryWritten = writer.WriteRecord(bundle_record::BUNDLE_RECORD_FILE) &&
+                writer.WriteString(relativePath.string()) && writer.WriteU32(mode) && writer.WriteU64(fileSize) &&
+                ExportFile(writer, it->path(), fileSize, buffer);
+        } else {
+            SPDLOG_LOGGER_DEBUG(ctx.applicationLogger, "Skipping special file \"{}\"", it->path().string());
+            continue;
+        }
+
+        if (!entryWritten) {
+            ctx.userLogger->error("Failed while exporting \"{}\"", it->path().string());
+            return false;
+        }
+    }
+
+    if (iterationError) {
+        ctx.userLogger->error("Failed while exporting \"{}\"", checkoutPath);
+        ctx.userLogger->error("Reason: {}", iterationError.message());
+        return false;
+    }
+
+    return true;
+}
+
+
+bool ExportBundle(application_context& ctx, string& bundleFilePath, string& lockFilePath, bool gitOnly) {
+    vector<dependency> lockEntries;
+    if (!ReadLockFile(ctx, lockFilePath, lockEntries)) {
+        return false;
+    }
+
+    FILE* bundleFile = fopen(bundleFilePath.c_str(), "wb");
+    if (!bundleFile) {
+        ctx.userLogger->error("Could not open \"{}\" for writing", bundleFilePath);
+        return false;
+    }
+
+    bundle_writer writer(bundleFile);
+    bool exportSuccessful = writer.Initialize() && writer.Write(BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) &&
+        writer.WriteU32(BUNDLE_FORMAT_VERSION);
+
+    for (dependency& dep : lockEntries) {
+        lock_dependency& lockDependency = dep.lockDependency;
+        if (!exportSuccessful) {
+            break;
+        }
+
+        file_lock directoryLock;
+        if (!LockDependencyPath(ctx, directoryLock, lockDependency.localPath, file_lock_mode::FILE_LOCK_SHARED)) {
+            exportSuccessful = false;
+            break;
+        }
+
+        if (!utils::DirectoryExists(lockDependency.localPath)) {
+            ctx.userLogger->error("Dependency \"{}\" is locked but missing from \"{}\", run `update` first",
+                                  dep.name, lockDependency.localPath);
+            exportSuccessful = false;
+            break;
+        }
+
+        // archives have no repository to rebuild a work tree from, and the work trees of submodules are not rebuilt
+        // on import, so both are always exported in full
+        bool packageGitOnly = gitOnly && utils::DirectoryExists(lockDependency.localPath + "/.git") &&
+            lockDependency.submodules.empty();
+
+        SPDLOG_LOGGER_INFO(ctx.applicationLogger, "Exporting \"{}\" from \"{}\"", dep.name, lockDependency.localPath);
+        exportSuccessful = writer.WriteRecord(bundle_record::BUNDLE_RECORD_PACKAGE) &&
+            writer.WriteString(dep.name) &&
+            writer.WriteString(lockDependency.resolvedVersion) &&
+            writer.WriteString(lockDependency.resolvedSource) &&
+            writer.WriteString(ctx.RelativeToProjectRoot(lockDependency.localPath)) &&
+            writer.WriteU8(packageGitOnly ? 0 : 1) &&
+            ExportCheckout(ctx, writer, lockDependency.localPath, packageGitOnly);
+    }
+
+    exportSuccessful = exportSuccessful && writer.WriteRecord(bundle_record::BUNDLE_RECORD_END) && writer.Finish();
+    if (fclose(bundleFile)) {
+        exportSuccessful = false;
+    }
+
+    if (!exportSuccessful) {
+        ctx.userLogger->error("Failed while exporting bundle \"{}\"", bundleFilePath);
+
+        std::error_code removalError;
+        fs::remove(bundleFilePath, removalError);
+        return false;
+    }
+
+    ctx.userLogger->info("Exported {} dependencies into \"{}\" ({})", lockEntries.size(), bundleFilePath,
+                         utils::FormatByteCount(fs::file_size(bundleFilePath)));
+    return true;
+}
+
+
+/***************************************************
+ * Import
+ ***************************************************/
+
+
+struct imported_package {
+    dependency entry;
+    string stagingPath;
+    file_lock directoryLock;
+
+    bool hasWorkTree;
+    bool skipped;
+
+    // entries below a symlink would be written wherever it points to
+    unordered_set<string> symlinks;
+
+    bool IsBelowSymlink(const fs::path& relativePath) {
+        fs::path prefix;
+        for (const fs::path& component : relativePath) {
+            prefix /= component;
+            if (this->symlinks.count(prefix.string())) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
+
+
+bool WriteImportedFile(const fs::path& path, fs::perms permissions, const char* contents, size_t length) {
+    {
+        ofstream fileStream(path, ios::binary | ios::trunc);
+        if (!fileStream.write(contents, length)) {
+            return false;
+        }
+    }
+
+    std::error_code permissionsError;
+    fs::permissions(path, permissions, permissionsError);
+
+    return !permissionsError;
+}
+
+
+// Writes file contents read from the bundle on the thread pool. Contents waiting to be written are bounded by
+// `BUNDLE_MAX_BUFFERED_BYTES`, so the reading thread blocks in `Reserve` when the writers fall behind.
+class import_writer {
+    public:
+        import_writer(application_context& c): ctx(c) {}
+
+        void Reserve(size_t length) {
+            unique_lock<mutex> lock(this->budgetMutex);
+            this->budgetCondition.wait(lock, [this, length] {
+                return this->bufferedBytes + length <= BUNDLE_MAX_BUFFERED_BYTES;
+            });
+
+            this->bufferedBytes += length;
+        }
+
+        void Release(size_t length) {
+            {
+                unique_lock<mutex> lock(this->budgetMutex);
+                this->bufferedBytes -= length;
+            }
+
+            this->budgetCondition.notify_one();
+        }
+
+        // `contents` must have been `Reserve`d.
+        void Submit(fs::path path, fs::perms permissions, shared_ptr<string> contents) {
+            this->pool.Submit([this, path, permissions, contents] {
+                if (!WriteImportedFile(path, permissions, contents->data(), contents->size())) {
+                    this->ctx.userLogger->error("Failed while writing \"{}\"", path.string());
+                    this->failed.store(true);
+                }
+
+                this->Release(contents->size());
+            });
+        }
+
+        void Wait() {
+            this->pool.Wait();
+        }
+
+        bool Failed() {
+            return this->failed.load();
+        }
+
+    private:
+        application_context& ctx;
+        thread_pool pool;
+
+        mutex budgetMutex;
+        condition_variable budgetCondition;
+        size_t bufferedBytes = 0;
+
+        atomic<bool> failed = false;
+};
+
+
+bool ReadPackageRecord(application_context& ctx, bundle_reader& reader, vector<imported_package>& packages) {
+    imported_package& package = packages.emplace_back();
+    lock_dependency& lockDependency = package.entry.lockDependency;
+
+    uint8_t hasWorkTree;
+    bool recordRead = reader.ReadString(package.entry.name) &&
+        reader.ReadString(lockDependency.resolvedVersion) &&
+        reader.ReadString(lockDependency.resolvedSource) &&
+        reader.ReadString(lockDependency.localPath) &&
+        reader.ReadU8(hasWorkTree);
+
+    if (!recordRead || !utils::IsSafeRelativePath(lockDependency.localPath)) {
+        return false;
+    }
+    lockDependency.localPath = ctx.ProjectPath(lockDependency.localPath);
+
+    package.hasWorkTree = hasWorkTree != 0;
+    package.skipped = false;
+    for (size_t i = 0; i + 1 < packages.size() && !package.skipped; i++) {
+        package.skipped = packages[i].entry.lockDependency.localPath == lockDependency.localPath;
+    }
+
+    // held until the package has been moved into place, so that no other process creates it meanwhile
+    if (!package.skipped) {
+        if (!LockDependencyPath(ctx, package.directoryLock, lockDependency.localPath,
+                                file_lock_mode::FILE_LOCK_EXCLUSIVE)) {
+            return false;
+        }
+
+        package.skipped = utils::DirectoryExists(lockDependency.localPath);
+    }
+
+    if (package.skipped) {
+        ctx.userLogger->info("\"{}\" is already present, skipping", lockDependency.localPath);
+        return true;
+    }
+
+    // leftovers of an interrupted import or clone are replaced
+    package.stagingPath = lockDependency.localPath + STAGING_DIRECTORY_SUFFIX;
+    std::error_code removalError;
+    fs::remove_all(package.stagingPath, removalError);
+
+    return utils::MakeDirs(ctx, package.stagingPath, utils::directory_creation_mode::IGNORE_IF_EXISTS);
+}
+
+
+bool ReadFileRecord(application_context& ctx, bundle_reader& reader, import_writer& writer,
+                    imported_package& package, const fs::path& targetPath) {
+    uint32_t mode;
+    uint64_t fileSize;
+    if (!reader.ReadU32(mode) || !reader.ReadU64(fileSize)) {
+        return false;
+    }
+
+    if (package.skipped) {
+        return reader.Skip(fileSize);
+    }
+
+    fs::perms permissions = (fs::perms) mode & fs::perms::mask;
+
+    if (fileSize <= BUNDLE_MAX_BUFFERED_BYTES) {
+        writer.Reserve(fileSize);
+
+        shared_ptr<string> contents = make_shared<string>(fileSize, '\0');
+        if (!reader.Read(contents->data(), fileSize)) {
+            writer.Release(fileSize);
+            return false;
+        }
+
+        writer.Submit(targetPath, permissions, contents);
+        return true;
+    }
+
+    // too large to hand over, stream it straight to disk instead
+    reader.scratch.resize(BUNDLE_IO_BUFFER_SIZE);
+    {
+        ofstream fileStream(targetPath, ios::binary | ios::trunc);
+        for (uint64_t remaining = fileSize; remaining; ) {
+            size_t chunkLength = (size_t) min<uint64_t>(remaining, reader.scratch.size());
+            if (!reader.Read(reader.scratch.data(), chunkLength) ||
+                    !fileStream.write(reader.scratch.data(), chunkLength)) {
+                ctx.userLogger->error("Failed while writing \"{}\"", targetPath.string());
+                return false;
+            }
+
+            remaining -= chunkLength;
+        }
+    }
+
+    std::error_code permissionsError;
+    fs::permissions(targetPath, permissions, permissionsError);
+
+    return !permissionsError;
+}
+
+
+bool ReadBundleRecords(application_context& ctx, bundle_reader& reader, import_writer& writer,
+                       vector<imported_package>& packages,
+                       vector<pair<fs::path, fs::perms>>& directoryPermissions) {
+    char magic[sizeof(BUNDLE_MAGIC)];
+    uint32_t formatVersion;
+    if (!reader.Read(magic, sizeof(magic)) || memcmp(magic, BUNDLE_MAGIC, sizeof(magic)) ||
+            !reader.ReadU32(formatVersion) || formatVersion != BUNDLE_FORMAT_VERSION) {
+        ctx.userLogger->error("Not a bundle, or written by an incompatible version of ldh");
+        return false;
+    }
+
+    while (!writer.Failed()) {
+        uint8_t record;
+        if (!reader.ReadU8(record)) {
+            return false;
+        }
+
+        if ((bundle_record) record == bundle_record::BUNDLE_RECORD_END) {
+            return true;
+        }
+
+        if ((bundle_record) record == bundle_record::BUNDLE_RECORD_PACKAGE) {
+            if (!ReadPackageRecord(ctx, reader, packages)) {
+                return false;
+            }
+
+            continue;
+        }
+
+        string relativePath;
+        if (packages.empty() || !reader.ReadString(relativePath) || !utils::IsSafeRelativePath(relativePath)) {
+            return false;
+        }
+
+        imported_package& package = packages.back();
+        if (!package.skipped && package.IsBelowSymlink(relativePath)) {
+            ctx.userLogger->error("Bundle entry \"{}\" is below a symlink", relativePath);
+            return false;
+        }
+
+        fs::path targetPath = fs::path(package.stagingPath) / relativePath;
+        std::error_code entryError;
+
+        switch ((bundle_record) record) {
+            case bundle_record::BUNDLE_RECORD_DIRECTORY:
+                {
+                    uint32_t mode;
+                    if (!reader.ReadU32(mode)) {
+                        return false;
+                    }
+
+                    if (!package.skipped) {
+                        fs::create_directories(targetPath, entryError);
+                        directoryPermissions.emplace_back(targetPath, (fs::perms) mode & fs::perms::mask);
+                    }
+                    break;
+                }
+            case bundle_record::BUNDLE_RECORD_FILE:
+                {
+                    if (!ReadFileRecord(ctx, reader, writer, package, targetPath)) {
+                        return false;
+                    }
+                    break;
+                }
+            case bundle_record::BUNDLE_RECORD_SYMLINK:
+                {
+                    string symlinkTarget;
+                    if (!reader.ReadString(symlinkTarget)) {
+                        return false;
+                    }
+
+                    if (!package.skipped) {
+                        fs::create_symlink(symlinkTarget, targetPath, entryError);
+                        package.symlinks.insert(fs::path(relativePath).string());
+                    }
+                    break;
+                }
+            default:
+                {
+                    return false;
+                }
+        }
+
+        if (entryError) {
+            ctx.userLogger->error("Failed while creating \"{}\"", targetPath.string());
+            ctx.userLogger->error("Reason: {}", entryError.message());
+            return false;
+        }
+    }
+
+    return false;
+}
+
+
+bool CheckoutImportedWorkTrees(application_context& ctx, vector<imported_package>& packages) {
+    bool checkoutNeeded = any_of(packages.begin(), packages.end(), [](imported_package& package) {
+        return !package.skipped && !package.hasWorkTree;
+    });
+
+    if (!checkoutNeeded) {
+        return true;
+    }
+
+    if (!InitializeLibrary(ctx)) {
+        return false;
+    }
+
+    atomic<bool> checkoutsSuccessful = true;
+    {
+        thread_pool pool;
+        for (imported_package& package : packages) {
+            if (package.skipped || package.hasWorkTree) {
+                continue;
+            }
+
+            pool.Submit([&ctx, &package, &checkoutsSuccessful] {
+                if (!CheckoutHead(ctx, package.stagingPath)) {
+                    ctx.userLogger->error("Failed while checking out \"{}\"", package.entry.name);
+                    checkoutsSuccessful.store(false);
+                }
+            });
+        }
+        pool.Wait();
+    }
+
+    ShutdownLibrary(ctx);
+    return checkoutsSuccessful.load();
+}
+
+
+bool ImportBundle(application_context& ctx, string& bundleFilePath, string& lockFilePath) {
+    FILE* bundleFile = fopen(bundleFilePath.c_str(), "rb");
+    if (!bundleFile) {
+        ctx.userLogger->error("Could not open \"{}\" for reading", bundleFilePath);
+        return false;
+    }
+
+    // keeps `ldh gc` away from imported checkouts until the lock file referring to them is registered
+    file_lock projectLock;
+    if (!LockProject(ctx, projectLock, file_lock_mode::FILE_LOCK_SHARED)) {
+        fclose(bundleFile);
+        return false;
+    }
+
+    bundle_reader reader(bundleFile);
+    vector<imported_package> packages;
+    vector<pair<fs::path, fs::perms>> directoryPermissions;
+
+    bool importSuccessful;
+    {
+        import_writer writer(ctx);
+        importSuccessful = reader.Initialize() &&
+            ReadBundleRecords(ctx, reader, writer, packages, directoryPermissions);
+
+        writer.Wait();
+        importSuccessful = importSuccessful && !writer.Failed();
+    }
+    fclose(bundleFile);
+
+    // applied last, so that read-only directories do not get in the way of their own contents
+    for (auto& [directoryPath, permissions] : directoryPermissions) {
+        std::error_code permissionsError;
+        fs::permissions(directoryPath, permissions, permissionsError);
+    }
+
+    importSuccessful = importSuccessful && CheckoutImportedWorkTrees(ctx, packages);
+
+    for (imported_package& package : packages) {
+        if (package.skipped) {
+            continue;
+        }
+
+        if (!importSuccessful) {
+            utils::DeleteDirAndContents(ctx, package.stagingPath);
+            continue;
+        }
+
+        importSuccessful = utils::RenameNode(ctx, package.stagingPath, package.entry.lockDependency.localPath);
+    }
+
+    if (!importSuccessful) {
+        ctx.userLogger->error("Failed while importing bundle \"{}\"", bundleFilePath);
+        return false;
+    }
+
+    configuration config;
+    for (imported_package& package : packages) {
+        config.dependencies.push_back(move(package.entry));
+    }
+
+    if (!WriteConfiguration(ctx, lockFilePath, config)) {
+        ctx.applicationLogger->error("Failed while writing lock file to \"{}\"", lockFilePath);
+        return false;
+    }
+
+    RegisterLockFile(ctx, lockFilePath);
+
+    ctx.userLogger->info("Imported {} dependencies from \"{}\"", config.dependencies.size(), bundleFilePath);
+    return true;
+}
@@ -17,6 +17,10 @@ std::string ManPage(execution_arguments* args, const char* binaryName) {
 bool ParseExecutionArguments(execution_arguments* args, int argc, char* argv[]) {
     // default to `help`
     args->currentMode = mode::MODE_HELP;
+    args->fetchRetries = DEFAULT_FETCH_RETRIES;
+    args->jobs = DEFAULT_RESOLUTION_JOBS;
+    args->transfersPerHost = DEFAULT_TRANSFERS_PER_HOST;
+    args->diskJobs = DEFAULT_DISK_JOBS;
 
     clipp::parameter helpMode = clipp::command("help").set(args->currentMode, mode::MODE_HELP);
     clipp::parameter configurationFilePath = clipp::value("fname",
@@ -26,16 +30,66 @@ bool ParseExecutionArguments(execution_arguments* args, int argc, char* argv[])
     clipp::group lockFilePath = (
             clipp::option("-o") & clipp::value("ofname", args->lockFilePath) );
 
+    clipp::group metricsFilePath = (
+            clipp::option("--metrics") & clipp::value("metricsfname", args->metricsFilePath) );
+
+    clipp::parameter noManifestCache = clipp::option("--no-manifest-cache").set(args->noManifestCache);
+
+    // any number of manifests, and directories to search for them
+    clipp::parameter validationPaths = clipp::values("path", args->validationPaths).if_missing([]{
+                                           std::cout << "A configuration file or directory is required\n";
+                                       } );
+
     clipp::group validateMode = (
             clipp::command("validate").set(args->currentMode, mode::MODE_VALIDATE),
-            configurationFilePath );
+            validationPaths, noManifestCache, metricsFilePath );
+
+    clipp::group resolutionOptions = (
+            clipp::option("--refresh").set(args->refresh),
+            clipp::option("--no-progress").set(args->noProgress),
+            clipp::option("--fetch-retries") & clipp::integer("count", args->fetchRetries),
+            clipp::option("-j", "--jobs") & clipp::integer("jobs", args->jobs),
+            clipp::option("--host-transfers") & clipp::integer("count", args->transfersPerHost),
+            clipp::option("--disk-jobs") & clipp::integer("count", args->diskJobs),
+            clipp::option("--memory-budget") & clipp::value("size", args->memoryBudget) );
 
     clipp::group updateMode = (
             clipp::command("update").set(args->currentMode, mode::MODE_UPDATE),
-            configurationFilePath, lockFilePath );
+            configurationFilePath, lockFilePath, noManifestCache, resolutionOptions, metricsFilePath );
+
+    // downloads what `update` would, without checking anything out
+    clipp::group fetchMode = (
+            clipp::command("fetch").set(args->currentMode, mode::MODE_FETCH),
+            configurationFilePath, lockFilePath, noManifestCache, resolutionOptions, metricsFilePath );
+
+    clipp::group planMode = (
+            clipp::command("plan").set(args->currentMode, mode::MODE_PLAN),
+            configurationFilePath, lockFilePath, noManifestCache,
+            clipp::option("--refresh").set(args->refresh), metricsFilePath );
+
+    // `fname` is the workspace manifest here
+    clipp::group workspaceMode = (
+            clipp::command("workspace").set(args->currentMode, mode::MODE_WORKSPACE),
+            configurationFilePath, noManifestCache, resolutionOptions, metricsFilePath );
+
+    clipp::parameter bundleFilePath = clipp::value("bundle", args->bundleFilePath);
+    clipp::group bundleLockFilePath = (
+            clipp::option("-l", "--lock") & clipp::value("lockfname", args->lockFilePath) );
+
+    clipp::group bundleMode = (
+            clipp::command("bundle"),
+            (clipp::command("export").set(args->currentMode, mode::MODE_BUNDLE_EXPORT),
+                bundleFilePath, bundleLockFilePath, clipp::option("--git-only").set(args->gitOnly),
+                metricsFilePath) |
+            (clipp::command("import").set(args->currentMode, mode::MODE_BUNDLE_IMPORT),
+                bundleFilePath, bundleLockFilePath, metricsFilePath) );
+
+    clipp::group gcMode = (
+            clipp::command("gc").set(args->currentMode, mode::MODE_GC),
+            clipp::option("-n", "--dry-run").set(args->dryRun), metricsFilePath );
 
     args->cli = new clipp::group();
-    *args->cli = validateMode | updateMode | helpMode;
+    *args->cli = validateMode | updateMode | fetchMode | planMode | workspaceMode | bundleMode | gcMode | helpMode;
 
     return clipp::parse(argc, argv, *args->cli) ? true : false;
 }
@@ -1,8 +1,19 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <unordered_map>
 
 #include "utils.hpp"
 #include "configuration_io.hpp"
+#include "lock_journal.hpp"
 #include "logger_manager.hpp"
+#include "manifest_cache.hpp"
+#include "sha256.hpp"
 
 
 namespace fs = std::filesystem;
@@ -26,13 +37,28 @@ void configuration::ParsePackageSection(section packageSection) {
 
 
 void configuration::ParseDependenciesSection(section dependenciesSection) {
-    for (auto&& [dependencyName, dependencyProperties] : *dependenciesSection.as_table()) {
-        dependency* entry = new dependency();
+    toml::table* dependenciesTable = dependenciesSection.as_table();
+    this->dependencies.reserve(this->dependencies.size() + dependenciesTable->size());
 
-        entry->name = dependencyName;
+    for (auto&& [dependencyName, dependencyProperties] : *dependenciesTable) {
+        dependency& entry = this->dependencies.emplace_back();
+
+        entry.name = dependencyName;
         dependencyProperties.visit([&entry](auto& node) noexcept {
                 auto nodeTable = node.as_table();
-                input_dependency* dependency = &entry->inputDependency;
+                input_dependency* dependency = &entry.inputDependency;
+
+                if (nodeTable->contains("archive")) {
+                    dependency->sourceType = source_type::SOURCE_TYPE_ARCHIVE;
+                    dependency->source = (*nodeTable)["archive"].value_or("");
+
+                    string checksum = (*nodeTable)["sha256"].value_or("");
+                    transform(checksum.begin(), checksum.end(), checksum.begin(), ::tolower);
+
+                    dependency->specifiedVersion.type = version_type::VERSION_TYPE_CHECKSUM;
+                    dependency->specifiedVersion.FromString(checksum);
+                    return;
+                }
 
                 if (!nodeTable->contains("git")) {
                     dependency->sourceType = source_type::SOURCE_TYPE_UNKNOWN;
@@ -41,10 +67,11 @@ void configuration::ParseDependenciesSection(section dependenciesSection) {
 
                 dependency->sourceType = source_type::SOURCE_TYPE_GIT;
                 dependency->source = (*nodeTable)["git"].value_or("");
+                dependency->submodules = (*nodeTable)["submodules"].value_or(false);
 
                 version_t* dependencyVersion = &dependency->specifiedVersion;
 
-                string versionKey;
+                const char* versionKey = nullptr;
                 if (nodeTable->contains("branch")) {
                     dependencyVersion->type = version_type::VERSION_TYPE_BRANCH;
                     versionKey = "branch";
@@ -61,78 +88,188 @@ void configuration::ParseDependenciesSection(section dependenciesSection) {
                     dependencyVersion->type = version_type::VERSION_TYPE_DEFAULT;
                 }
 
-                dependencyVersion->FromString(versionKey.empty() ? "latest" : (*nodeTable)[versionKey].value_or(""));
+                dependencyVersion->FromString(versionKey ? (*nodeTable)[versionKey].value_or("") : "latest");
         });
-
-        this->dependencies.push_back(entry);
     }
 }
 
 
-void ReconcileConfigurationAndLock(application_context& ctx, configuration* configuration, dict_like_config lockFileDict) {
-    for (auto&& entry: *(lockFileDict["packages"]).as_array()) {
-        lock_dependency lockDependency;
+// Lock entries only carry a name and a lock dependency, their input dependency is left empty.
+vector<dependency> ParseLockEntries(dict_like_config& lockFileDict) {
+    vector<dependency> lockEntries;
+
+    toml::array* packages = lockFileDict["packages"].as_array();
+    if (!packages) {
+        return lockEntries;
+    }
+
+    lockEntries.reserve(packages->size());
+    for (auto&& entry : *packages) {
+        dependency& lockEntry = lockEntries.emplace_back();
+        lock_dependency& lockDependency = lockEntry.lockDependency;
 
         auto tbl = entry.as_table();
         lockDependency.localPath = (*tbl)["path"].value_or("");
         lockDependency.resolvedSource = (*tbl)["source"].value_or("");
         lockDependency.resolvedVersion = (*tbl)["version"].value_or("");
 
-        string lockDependencyName = (*tbl)["name"].value_or("");
+        if (toml::array* submodules = (*tbl)["submodules"].as_array()) {
+            lockDependency.submodules.reserve(submodules->size());
+            for (auto&& submodule : *submodules) {
+                auto submoduleTable = submodule.as_table();
+                if (!submoduleTable) {
+                    continue;
+                }
+
+                lockDependency.submodules.push_back({
+                    (*submoduleTable)["path"].value_or(""),
+                    (*submoduleTable)["source"].value_or(""),
+                    (*submoduleTable)["version"].value_or(""),
+                });
+            }
+        }
+
+        lockEntry.name = (*tbl)["name"].value_or("");
+    }
+
+    return lockEntries;
+}
+
+
+bool ReadLockFile(application_context& ctx, string& lockFilePath, vector<dependency>& lockEntries) {
+    if (!utils::FileExists(lockFilePath)) {
+        ctx.userLogger->error("Lock file not found: \"{}\"", lockFilePath);
+        return false;
+    }
+
+    dict_like_config lockFileDict = toml::parse_file(lockFilePath);
+    lockEntries = ParseLockEntries(lockFileDict);
+
+    return true;
+}
+
+
+void ReconcileConfigurationAndLock([[maybe_unused]] application_context& ctx, configuration& configuration,
+                                   vector<dependency>& lockEntries) {
+    // dependency names are keys in the configuration's table, so they're guaranteed to be unique.
+    // N.b. entries are pointers into `configuration.dependencies`, which must not grow until we're done with them.
+    unordered_map<string_view, dependency*> dependenciesByName;
+    dependenciesByName.reserve(configuration.dependencies.size());
+    for (dependency& dep : configuration.dependencies) {
+        dependenciesByName[dep.name] = &dep;
+    }
+
+    vector<dependency> dependenciesToBeDeleted;
+
+    for (dependency& lockEntry : lockEntries) {
+        lock_dependency& lockDependency = lockEntry.lockDependency;
+
+        auto match = dependenciesByName.find(lockEntry.name);
+        if (match != dependenciesByName.end()) {
+            dependency* dep = match->second;
 
-        bool matched = false;
-        for (dependency* dep: configuration->dependencies) {
             string fullDependencyName = dep->name + "-" + dep->inputDependency.specifiedVersion.exact;
-            if (dep->name != lockDependencyName || lockDependency.localPath.find(fullDependencyName) == string::npos) {
+            if (lockDependency.localPath.find(fullDependencyName) != string::npos) {
+                dep->lockDependency = move(lockDependency);
                 continue;
             }
-
-            dep->lockDependency = lockDependency;
-            matched = true;
         }
 
-        if (matched) {
-            continue;
-        }
+        SPDLOG_LOGGER_DEBUG(ctx.applicationLogger, "Will delete {} (present in lock, not in config)",
+                            lockEntry.name);
+
+        dependenciesToBeDeleted.push_back(move(lockEntry));
+    }
+
+    for (dependency& dep : dependenciesToBeDeleted) {
+        configuration.dependencies.push_back(move(dep));
+    }
+}
 
-        dependency* dependencyToBeDeleted = new dependency();
-        dependencyToBeDeleted->lockDependency = lockDependency;
 
-        ctx.applicationLogger->debug("Will delete {} (present in lock, not in config)", lockDependencyName);
+string GenerateLockFilePath(string configurationFilePath) {
+    size_t lastSeparatorIndex = configurationFilePath.rfind('/');  // NOTE this is platform dependent.
+    if (lastSeparatorIndex == string::npos) {
+        return "ldh.lock";
     }
+
+    return configurationFilePath.substr(0, lastSeparatorIndex) + "/ldh.lock";
 }
 
 
-configuration* ParseConfiguration(application_context& ctx, string& configurationFilePath, configuration_modes mode) {
+bool ReadManifest(application_context& ctx, string& configurationFilePath, string& manifestContents) {
     if (!fs::exists(configurationFilePath)) {
         ctx.applicationLogger->error("File not found: \"{}\"", configurationFilePath);
-        return nullptr;
+        return false;
     }
 
+    ifstream manifestStream(configurationFilePath, ios::binary);
+    ostringstream manifestBuffer;
+    manifestBuffer << manifestStream.rdbuf();
+    manifestContents = manifestBuffer.str();
+
+    return true;
+}
+
+
+void ParseManifest(string& configurationFilePath, string& manifestContents, configuration& parsedConfiguration) {
     // TODO wrap in internal lib
-    dict_like_config configurationDict = toml::parse_file(configurationFilePath);
-    configuration* parsedConfiguration = configuration::FromDictLike(configurationDict);
+    dict_like_config configurationDict = toml::parse(manifestContents, configurationFilePath);
+    parsedConfiguration = configuration::FromDictLike(configurationDict);
+}
+
 
+void ReconcileWithLockFile(application_context& ctx, configuration& parsedConfiguration, configuration_modes mode) {
     if ((mode & configuration_modes::CONFIGURATION_MODE_OUTPUT) != configuration_modes::CONFIGURATION_MODE_NONE) {
         string lockFilePath = ctx.GetLockFilePath();
+
+        vector<dependency> lockEntries;
         if (utils::FileExists(lockFilePath)) {
-            dict_like_config lockFileDict = toml::parse_file(ctx.GetLockFilePath());
-            ReconcileConfigurationAndLock(ctx, parsedConfiguration, lockFileDict);
+            dict_like_config lockFileDict = toml::parse_file(lockFilePath);
+            lockEntries = ParseLockEntries(lockFileDict);
+        }
+
+        // whatever an interrupted run got done since the lock was last written
+        ReplayLockJournal(ctx, lockFilePath, lockEntries);
+
+        for (dependency& lockEntry : lockEntries) {
+            lockEntry.lockDependency.localPath = ctx.ProjectPath(lockEntry.lockDependency.localPath);
         }
+
+        ReconcileConfigurationAndLock(ctx, parsedConfiguration, lockEntries);
+    }
+}
+
+
+bool ParseConfiguration(application_context& ctx, string& configurationFilePath, configuration_modes mode,
+                        configuration& parsedConfiguration) {
+    string manifestContents;
+    if (!ReadManifest(ctx, configurationFilePath, manifestContents)) {
+        return false;
     }
 
-    return parsedConfiguration;
+    ParseManifest(configurationFilePath, manifestContents, parsedConfiguration);
+    ReconcileWithLockFile(ctx, parsedConfiguration, mode);
+
+    return true;
 }
 
 
-bool CheckConfiguration(application_context& ctx, configuration* config, configuration_modes mode) {
+bool CheckConfiguration(application_context& ctx, configuration& config, [[maybe_unused]] configuration_modes mode) {
     // TODO:
     //  - rules to check.
 
-    for (dependency* dep : config->dependencies) {
-        if (dep->inputDependency.sourceType == source_type::SOURCE_TYPE_UNKNOWN) {
+    for (dependency& dep : config.dependencies) {
+        if (dep.inputDependency.sourceType == source_type::SOURCE_TYPE_UNKNOWN) {
             // TODO do not use the default file ctx.applicationLogger for this.
-            ctx.userLogger->error("Unknown dependency type for dependency \"{}\"", dep->name);
+            ctx.userLogger->error("Unknown dependency type for dependency \"{}\"", dep.name);
+            return false;
+        }
+
+        // archives are only ever trusted by their checksum, so there is no such thing as an unpinned one
+        bool isArchive = dep.inputDependency.sourceType == source_type::SOURCE_TYPE_ARCHIVE;
+        if (isArchive && !sha256::IsHexDigest(dep.inputDependency.specifiedVersion.exact)) {
+            ctx.userLogger->error("Archive dependency \"{}\" needs a `sha256` (64 hexadecimal digits)", dep.name);
             return false;
         }
 
@@ -143,21 +280,36 @@ bool CheckConfiguration(application_context& ctx, configuration* config, configu
 }
 
 
-configuration* ParseAndCheckConfiguration(application_context& ctx, string& configurationFilePath, configuration_modes mode) {
-    configuration* config = ParseConfiguration(ctx, configurationFilePath, mode);
-
-    if (!config) {
+bool ParseAndCheckConfiguration(application_context& ctx, string& configurationFilePath, configuration_modes mode,
+                                configuration& config) {
+    string manifestContents;
+    if (!ReadManifest(ctx, configurationFilePath, manifestContents)) {
         ctx.applicationLogger->error("Could not parse config from input \"{}\"", configurationFilePath);
-        return nullptr;
+        return false;
     }
 
-    if (!CheckConfiguration(ctx, config, mode)) {
-        ctx.applicationLogger->error("Configuration check failed, see logs for more information");
-        return nullptr;
+    // only configurations that passed their checks make it into the cache, so a hit needs neither.
+    bool useCache = !ctx.args->noManifestCache;
+    string cacheKey = useCache ? ManifestCacheKey(manifestContents) : "";
+    if (useCache && LoadCachedConfiguration(ctx, cacheKey, config)) {
+        SPDLOG_LOGGER_DEBUG(ctx.applicationLogger, "Using cached configuration for \"{}\"", configurationFilePath);
+    } else {
+        ParseManifest(configurationFilePath, manifestContents, config);
+
+        if (!CheckConfiguration(ctx, config, mode)) {
+            ctx.applicationLogger->error("Configuration check failed, see logs for more information");
+            return false;
+        }
+
+        if (useCache) {
+            StoreCachedConfiguration(ctx, cacheKey, config);
+        }
     }
 
-    ctx.applicationLogger->info("Config for package \"{}\" OK", config->packageInformation.name);
-    return config;
+    ReconcileWithLockFile(ctx, config, mode);
+
+    ctx.applicationLogger->info("Config for package \"{}\" OK", config.packageInformation.name);
+    return true;
 }
 
 
@@ -166,33 +318,86 @@ configuration* ParseAndCheckConfiguration(application_context& ctx, string& conf
  ***************************************************/
 
 
-toml::table DependencyToTable(dependency* dep) {
+toml::table DependencyToTable(application_context& ctx, dependency& dep) {
     toml::table result;
 
-    result.insert("name", dep->name);
-    result.insert("version", dep->lockDependency.resolvedVersion);
-    result.insert("source", dep->lockDependency.resolvedSource);
-    result.insert("path", dep->lockDependency.localPath);
+    result.insert("name", dep.name);
+    result.insert("version", dep.lockDependency.resolvedVersion);
+    result.insert("source", dep.lockDependency.resolvedSource);
+    result.insert("path", ctx.RelativeToProjectRoot(dep.lockDependency.localPath));
+
+    if (!dep.lockDependency.submodules.empty()) {
+        toml::array submodulesArray;
+        for (locked_submodule& submodule : dep.lockDependency.submodules) {
+            toml::table submoduleTable;
+            submoduleTable.insert("path", submodule.path);
+            submoduleTable.insert("version", submodule.resolvedVersion);
+            submoduleTable.insert("source", submodule.resolvedSource);
+
+            submodulesArray.push_back(submoduleTable);
+        }
+        result.insert("submodules", submodulesArray);
+    }
 
     return result;
 }
 
 
-bool WriteConfiguration(application_context& ctx, string& outputPath, configuration* config) {
+bool WriteConfiguration(application_context& ctx, string& outputPath, configuration& config) {
     toml::table outputTable;
 
     toml::array packagesArray;
-    for (dependency* dep : config->dependencies) {
-        packagesArray.push_back(DependencyToTable(dep));
+    for (dependency& dep : config.dependencies) {
+        packagesArray.push_back(DependencyToTable(ctx, dep));
     }
     outputTable.insert("packages", packagesArray);
 
     // NOTE it would be worth it to add a "package" section to the lock file.
 
-    ofstream outputStream;
-    outputStream.open(outputPath);
-    outputStream << outputTable;
-    outputStream.close();
+    // written under a temporary name and renamed, so that an interrupted write never leaves a truncated lock behind
+    ostringstream temporaryPathStream;
+    temporaryPathStream << outputPath << ".tmp." << getpid();
+    string temporaryPath = temporaryPathStream.str();
+
+    {
+        ofstream outputStream(temporaryPath, ios::trunc);
+        outputStream << outputTable;
+        outputStream.close();
+
+        if (!outputStream) {
+            ctx.applicationLogger->error("Failed while writing \"{}\"", temporaryPath);
+
+            std::error_code removalError;
+            fs::remove(temporaryPath, removalError);
+
+            return false;
+        }
+    }
+
+    // the lock must be on disk before the journal (which only records what is missing from it) is removed: synced
+    // before it is renamed into place, so that the rename never exposes an empty file, and its directory after
+    if (!utils::SyncPath(temporaryPath)) {
+        ctx.applicationLogger->error("Failed while syncing \"{}\": {}", temporaryPath, strerror(errno));
+
+        std::error_code removalError;
+        fs::remove(temporaryPath, removalError);
+
+        return false;
+    }
+
+    std::error_code renameError;
+    fs::rename(temporaryPath, outputPath, renameError);
+    if (renameError) {
+        ctx.applicationLogger->error("Failed while replacing \"{}\": {}", outputPath, renameError.message());
+        fs::remove(temporaryPath, renameError);
+
+        return false;
+    }
+
+    if (!utils::SyncParentDirectory(outputPath)) {
+        ctx.applicationLogger->error("Failed while syncing the directory of \"{}\": {}", outputPath, strerror(errno));
+        return false;
+    }
 
     return true;
 }
@@ -1,34 +1,80 @@
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <mutex>
 #include <stdio.h>
+#include <unordered_map>
 
 #include "dependency_resolver.hpp"
+#include "file_lock.hpp"
 #include "git_lib.cpp"
+#include "archive_lib.cpp"
+#include "lock_journal.hpp"
+#include "thread_pool.hpp"
+
+
+// Returns the first of `tags` that satisfies `version`, or an empty string if none does.
+string FindMatchingTag(application_context& ctx, version_t& version, tag_list& tags) {
+    size_t comparedTags = 0;
+    string matchingTag;
+    for (string_view repositoryTag : tags.names) {
+        comparedTags++;
+        if (version.VersionsMatch(repositoryTag)) {
+            matchingTag = string(repositoryTag);
+            break;
+        }
+    }
 
+    if (ctx.metrics) {
+        ctx.metrics->tagScans.fetch_add(1, memory_order_relaxed);
+        ctx.metrics->tagsScanned.fetch_add(comparedTags, memory_order_relaxed);
+    }
 
-string MatchVersionRange(application_context& ctx, version_t& version, repository* repo) {
-    vector<string*>* repositoryTags = GetTagsForRepository(ctx, repo);
-    if (repositoryTags->empty()) {
-        delete repositoryTags;
+    return matchingTag;
+}
 
+
+string MatchVersionRange(application_context& ctx, version_t& version, repository& repo) {
+    tag_list repositoryTags = GetTagsForRepository(ctx, repo);
+
+    return FindMatchingTag(ctx, version, repositoryTags);
+}
+
+
+// A semver dependency whose locked checkout is still on disk, and still satisfies the requested version, does not
+// have to be fetched again. Returns the tag of that checkout, or an empty string if there is none.
+string GetLockedSemVerTag(dependency& dep) {
+    version_t& requestedVersion = dep.inputDependency.specifiedVersion;
+    string& lockedPath = dep.lockDependency.localPath;
+    if (requestedVersion.type != version_type::VERSION_TYPE_SEMVER || !utils::DirectoryExists(lockedPath)) {
         return "";
     }
 
-    string result = "";
-    for (string* repositoryTag : *repositoryTags) {
-        if (result.empty() && version.VersionsMatch(*repositoryTag)) {
-            result = *repositoryTag;
-        }
-
-        delete repositoryTag;
+    string lockedDirectoryName = utils::ExtractFileName(lockedPath.c_str());
+    string targetDirectoryPrefix = dep.name + "-";
+    if (lockedDirectoryName.compare(0, targetDirectoryPrefix.size(), targetDirectoryPrefix)) {
+        return "";
     }
 
-    delete repositoryTags;
+    string lockedTag = lockedDirectoryName.substr(targetDirectoryPrefix.size());
+    return requestedVersion.VersionsMatch(lockedTag) ? lockedTag : "";
+}
 
-    return result;
+
+// path format is $PWD/target/dependencies/name-version
+// unless we're dealing with a semver range, which will be fixed _after_ fetching, in which case we
+// append a `temp` suffix
+string GetGitTargetDirectoryName(dependency& dep) {
+    if (dep.inputDependency.specifiedVersion.IsExact()) {
+        return dep.name + "-" + dep.inputDependency.specifiedVersion.exact;
+    }
+
+    return dep.name + RANGE_CHECKOUT_SUFFIX;
 }
 
 
-resolution_result* ResolveGitDependency(application_context& ctx, dependency* dep) {
-    ctx.applicationLogger->info("Proceeding to resolve git dependency \"{}\"", dep->name);
+resolution_result ResolveGitDependency(application_context& ctx, dependency& dep) {
+    SPDLOG_LOGGER_INFO(ctx.applicationLogger, "Proceeding to resolve git dependency \"{}\"", dep.name);
 
     /* Steps
     *  1) figure out a file path
@@ -39,46 +85,67 @@ resolution_result* ResolveGitDependency(application_context& ctx, dependency* de
     *  4) potentially rename the target directory
     */
 
-    // path format is $PWD/target/dependencies/name-version
-    // unless we're dealing with a semver range, which will be fixed _after_ fetching, in which case we
-    // append a `temp` suffix
-    string targetDirectoryPrefix = dep->name + "-";
-    string targetDirectoryName;
+    string targetDirectoryPrefix = dep.name + "-";
+    string targetDirectoryName = GetGitTargetDirectoryName(dep);
+    bool shouldMoveAfterFetching = !dep.inputDependency.specifiedVersion.IsExact();
+
+    std::string targetDirectoryPath = ctx.DependencyPathPrefix() + targetDirectoryName;
+
+    SPDLOG_LOGGER_DEBUG(ctx.applicationLogger, "Dependency working directory is \"{}\"", targetDirectoryPath);
+
+    resolution_result resolutionResult;
+    version_t& requestedVersion = dep.inputDependency.specifiedVersion;
 
-    bool shouldMoveAfterFetching = false;
-    if (dep->inputDependency.specifiedVersion.IsExact()) {
-        targetDirectoryName = targetDirectoryPrefix + dep->inputDependency.specifiedVersion.exact;
-    } else {
-        shouldMoveAfterFetching = true;
-        targetDirectoryName = targetDirectoryPrefix + "temp";
+    string lockedTag = GetLockedSemVerTag(dep);
+    if (!lockedTag.empty()) {
+        targetDirectoryPath = dep.lockDependency.localPath;
     }
 
-    std::ostringstream targetDirectoryPathStream;
-    targetDirectoryPathStream << ctx.dependencyPathPrefix << targetDirectoryName;
-    std::string targetDirectoryPath = targetDirectoryPathStream.str();
+    bool tracksBranch = requestedVersion.type == version_type::VERSION_TYPE_BRANCH ||
+        requestedVersion.type == version_type::VERSION_TYPE_DEFAULT;
+    bool refreshes = ctx.args->refresh && tracksBranch;
 
-    ctx.applicationLogger->info("Dependency working directory is \"{}\"", targetDirectoryPath);
+    // shared while only looking at an existing checkout, exclusive while creating (or refreshing) one. Another
+    // process may create the checkout while the lock is converted, hence the second look.
+    file_lock directoryLock;
+    if (!LockDependencyPath(ctx, directoryLock, targetDirectoryPath, file_lock_mode::FILE_LOCK_SHARED)) {
+        return resolutionResult;
+    }
 
-    resolution_result* resolutionResult = NULL;
-    version_t requestedVersion = dep->inputDependency.specifiedVersion;
+    bool needsExclusiveLock = refreshes || !utils::DirectoryExists(targetDirectoryPath);
+    if (needsExclusiveLock &&
+            !LockDependencyPath(ctx, directoryLock, targetDirectoryPath, file_lock_mode::FILE_LOCK_EXCLUSIVE)) {
+        return resolutionResult;
+    }
 
     if (utils::DirectoryExists(targetDirectoryPath)) {
-        ctx.applicationLogger->info("Dependency \"{}\" already resolved, skipping.", targetDirectoryName);
+        SPDLOG_LOGGER_INFO(ctx.applicationLogger, "Dependency \"{}\" already resolved, skipping.", targetDirectoryName);
+        if (ctx.metrics) {
+            ctx.metrics->dependenciesAlreadyPresent.fetch_add(1, memory_order_relaxed);
+        }
+
+        resolutionResult = CreateResolutionResultFromLocalGitRepo(ctx, dep.inputDependency.source,
+                                                                  targetDirectoryPath, requestedVersion);
+        if (!resolutionResult.resolutionSuccessful) {
+            return resolutionResult;
+        }
 
-        resolutionResult = CreateResolutionResultFromLocalGitRepo(ctx, dep->inputDependency.source,
-                                                                  targetDirectoryPath,
-                                                                  dep->inputDependency.specifiedVersion);
+        if (refreshes && !RefreshRepository(ctx, resolutionResult)) {
+            // the previous checkout is still usable, so this is not a resolution failure
+            ctx.userLogger->warn("Could not refresh \"{}\", keeping its current version", dep.name);
+        }
 
-        if (resolutionResult->tag.empty()) {
+        if (resolutionResult.tag.empty()) {
             if (requestedVersion.type == version_type::VERSION_TYPE_SEMVER) {
-                resolutionResult->tag = MatchVersionRange(ctx, requestedVersion, resolutionResult->repo);
+                resolutionResult.tag = lockedTag.empty() ? MatchVersionRange(ctx, requestedVersion,
+                                                                             resolutionResult.repo) : lockedTag;
             }
-        } else if (resolutionResult->tag == "latest") {
+        } else if (resolutionResult.tag == "latest") {
             // FIXME if the user has specified no version, we want to read the fixed (in other words, resolved) version
             // that we checked out earlier, and set that as the tag. tbh, this is kind of hacky, but will work for now.
             // Ideally this should not be here, but it definitely does not belong in `git_lib`, so this seemed like the best
             // place for it for now.
-            resolutionResult->tag = resolutionResult->version;
+            resolutionResult.tag = resolutionResult.version;
         }
 
         return resolutionResult;
@@ -87,50 +154,72 @@ resolution_result* ResolveGitDependency(application_context& ctx, dependency* de
     switch (requestedVersion.type) {
         case (version_type::VERSION_TYPE_DEFAULT):
             {
-                resolutionResult = CloneRepo(ctx, dep->inputDependency.source, targetDirectoryPath);
+                resolutionResult = CloneRepo(ctx, dep.inputDependency.source, targetDirectoryPath);
                 break;
             }
         case (version_type::VERSION_TYPE_SEMVER):
             {
-                resolutionResult = CloneRepo(ctx, dep->inputDependency.source, targetDirectoryPath);
-                if (!resolutionResult) {
+                resolutionResult = CloneRepo(ctx, dep.inputDependency.source, targetDirectoryPath);
+                if (!resolutionResult.resolutionSuccessful) {
                     break;
                 }
 
                 string tag = requestedVersion.IsExact() ? requestedVersion.exact : MatchVersionRange(ctx,
                                                                                                      requestedVersion,
-                                                                                                     resolutionResult->repo);
+                                                                                                     resolutionResult.repo);
                 if (tag.empty()) {
-                    resolutionResult->resolutionSuccessful = false;
+                    resolutionResult.resolutionSuccessful = false;
                     break;
                 }
-                // resolutionResult->tag = tag;
+                // resolutionResult.tag = tag;
 
                 Checkout(ctx, resolutionResult, tag);
                 break;
             }
+        case (version_type::VERSION_TYPE_COMMIT_HASH):
+            {
+                resolutionResult = FetchCommit(ctx, dep.inputDependency.source, targetDirectoryPath,
+                                               requestedVersion.exact);
+                break;
+            }
         default:
             {
-                resolutionResult = CloneAndCheckout(ctx, dep->inputDependency.source, targetDirectoryPath,
+                resolutionResult = CloneAndCheckout(ctx, dep.inputDependency.source, targetDirectoryPath,
                                                     requestedVersion.exact);
                 break;
             }
     }
 
-    if (!resolutionResult || !resolutionResult->resolutionSuccessful) {
-        ctx.userLogger->warn("Could not resolve git dependency \"{}\"", dep->name);
+    if (!resolutionResult.resolutionSuccessful) {
+        ctx.userLogger->warn("Could not resolve git dependency \"{}\"", dep.name);
+
+        return resolutionResult;
     }
 
     if (shouldMoveAfterFetching) {
-        string finalDirectory = ctx.dependencyPathPrefix + targetDirectoryPrefix + resolutionResult->tag;
+        // the repository has files open under the temporary directory
+        resolutionResult.repo = repository();
+
+        string finalDirectory = ctx.DependencyPathPrefix() + targetDirectoryPrefix + resolutionResult.tag;
+
+        // always taken after the lock of the temporary directory, so that processes cannot wait on each other
+        file_lock finalDirectoryLock;
+        if (!LockDependencyPath(ctx, finalDirectoryLock, finalDirectory, file_lock_mode::FILE_LOCK_EXCLUSIVE)) {
+            utils::DeleteDirAndContents(ctx, targetDirectoryPath);
+            resolutionResult.resolutionSuccessful = false;
+
+            return resolutionResult;
+        }
+
         if (utils::DirectoryExists(finalDirectory)) {
             // FIXME this means that we should not have fetched this dependency. We should have created a repo
             // without cloning the target, looked through the tags, and skipped cloning if we found a match.
             utils::DeleteDirAndContents(ctx, targetDirectoryPath);
         } else {
-            resolutionResult->resolutionSuccessful = utils::RenameNode(ctx, targetDirectoryPath, finalDirectory);
-            resolutionResult->localPath = finalDirectory;
+            resolutionResult.resolutionSuccessful = utils::RenameNode(ctx, targetDirectoryPath, finalDirectory);
         }
+
+        resolutionResult.localPath = finalDirectory;
     }
 
 
@@ -138,61 +227,114 @@ resolution_result* ResolveGitDependency(application_context& ctx, dependency* de
 }
 
 
-void UpdateResolvedDependency(dependency* dep, resolution_result* resolutionResult) {
-    lock_dependency* dependencyToUpdate = &dep->lockDependency;
+// Archives are pinned by checksum, so an extracted archive never goes stale: if its directory exists, it is done.
+resolution_result ResolveArchiveDependency(application_context& ctx, dependency& dep) {
+    SPDLOG_LOGGER_INFO(ctx.applicationLogger, "Proceeding to resolve archive dependency \"{}\"", dep.name);
+
+    string checksum = dep.inputDependency.specifiedVersion.exact;
+    string targetDirectoryPath = ctx.DependencyPathPrefix() + dep.name + "-" + checksum;
+
+    // as for git dependencies: shared to look, exclusive to extract
+    file_lock directoryLock;
+    bool directoryLocked = LockDependencyPath(ctx, directoryLock, targetDirectoryPath,
+                                              file_lock_mode::FILE_LOCK_SHARED) &&
+        (utils::DirectoryExists(targetDirectoryPath) ||
+         LockDependencyPath(ctx, directoryLock, targetDirectoryPath, file_lock_mode::FILE_LOCK_EXCLUSIVE));
+    if (!directoryLocked) {
+        return resolution_result();
+    }
+
+    if (utils::DirectoryExists(targetDirectoryPath)) {
+        SPDLOG_LOGGER_INFO(ctx.applicationLogger, "Dependency \"{}\" already resolved, skipping.", dep.name);
+        if (ctx.metrics) {
+            ctx.metrics->dependenciesAlreadyPresent.fetch_add(1, memory_order_relaxed);
+        }
+
+        resolution_result resolutionResult(true);
+        resolutionResult.localPath = targetDirectoryPath;
+        resolutionResult.remote = dep.inputDependency.source;
+        resolutionResult.version = checksum;
+
+        return resolutionResult;
+    }
 
-    dependencyToUpdate->localPath = resolutionResult->localPath;
-    dependencyToUpdate->resolvedVersion = resolutionResult->version;
+    resolution_result resolutionResult = FetchArchive(ctx, dep.inputDependency.source, checksum, targetDirectoryPath);
+    if (!resolutionResult.resolutionSuccessful) {
+        ctx.userLogger->warn("Could not resolve archive dependency \"{}\"", dep.name);
+    }
+
+    return resolutionResult;
+}
+
+
+void UpdateResolvedDependency(dependency& dep, resolution_result& resolutionResult) {
+    lock_dependency* dependencyToUpdate = &dep.lockDependency;
+
+    dependencyToUpdate->localPath = resolutionResult.localPath;
+    dependencyToUpdate->resolvedVersion = resolutionResult.version;
+    if (!dep.inputDependency.submodules) {
+        dependencyToUpdate->submodules.clear();
+    }
 
     std::ostringstream resolvedSourceStream;
-    resolvedSourceStream << SourceTypeToString(dep->inputDependency.sourceType) << '+';
-    resolvedSourceStream << dep->inputDependency.source << '#';
-    resolvedSourceStream << (resolutionResult->tag.empty() ? resolutionResult->version : resolutionResult->tag);
+    resolvedSourceStream << SourceTypeToString(dep.inputDependency.sourceType) << '+';
+    resolvedSourceStream << dep.inputDependency.source << '#';
+    resolvedSourceStream << (resolutionResult.tag.empty() ? resolutionResult.version : resolutionResult.tag);
     dependencyToUpdate->resolvedSource = resolvedSourceStream.str();
 }
 
 
-bool FetchRemoteDependency(application_context& ctx, dependency* dep) {
-    bool directoryCreationSuccessful = utils::MakeDirs(ctx, ctx.dependencyPathPrefix,
+bool FetchRemoteDependency(application_context& ctx, dependency& dep) {
+    bool directoryCreationSuccessful = utils::MakeDirs(ctx, ctx.DependencyPathPrefix(),
                                                        utils::directory_creation_mode::IGNORE_IF_EXISTS);
 
     if (!directoryCreationSuccessful) {
         ctx.applicationLogger->error("Could not process entry \"{}\", failed to create target directory",
-                                     dep->name);
+                                     dep.name);
 
         return false;
     }
 
-    resolution_result* resolutionResult = NULL;
-    switch (dep->inputDependency.sourceType) {
+    resolution_result resolutionResult;
+    switch (dep.inputDependency.sourceType) {
         case (source_type::SOURCE_TYPE_GIT):
             {
                 resolutionResult = ResolveGitDependency(ctx, dep);
                 break;
             }
+        case (source_type::SOURCE_TYPE_ARCHIVE):
+            {
+                resolutionResult = ResolveArchiveDependency(ctx, dep);
+                break;
+            }
         default:
             {
-                ctx.applicationLogger->warn("Unsupported source type {}, ignoring.", dep->inputDependency.sourceType);
+                ctx.applicationLogger->warn("Unsupported source type {}, ignoring.",
+                                            SourceTypeToString(dep.inputDependency.sourceType));
                 break;
             }
     }
 
 
-    if (!resolutionResult || !resolutionResult->resolutionSuccessful) {
+    if (!resolutionResult.resolutionSuccessful) {
         return false;
     }
 
     UpdateResolvedDependency(dep, resolutionResult);
 
-    delete resolutionResult;
-
     return true;
 }
 
 
-bool DeleteDependency(application_context& ctx, dependency* dep) {
-    string localPath = dep->lockDependency.localPath;
+bool DeleteDependency(application_context& ctx, dependency& dep) {
+    string localPath = dep.lockDependency.localPath;
 
+    file_lock directoryLock;
+    if (!LockDependencyPath(ctx, directoryLock, localPath, file_lock_mode::FILE_LOCK_EXCLUSIVE)) {
+        return false;
+    }
+
+    scheduled_slot diskSlot(ctx.DiskSlots());
     bool directoryDeletionSuccessful = utils::DeleteDirAndContents(ctx, localPath);
     if (!directoryDeletionSuccessful) {
         ctx.applicationLogger->error("Could not delete dependency at path \"{}\"", localPath);
@@ -203,26 +345,415 @@ bool DeleteDependency(application_context& ctx, dependency* dep) {
 }
 
 
-void ResolveDependencies(application_context& ctx, vector<dependency*> dependencies) {
-    for (vector<dependency*>::iterator i = dependencies.begin(); i != dependencies.end(); i++) {
-        dependency* dep = *i;
-        bool resolutionSuccessful = false;
+// Exceptions must not escape pool jobs: one that did would terminate the process (with `libldh`, the caller's). What
+// `work` throws is logged, and taken as it failing.
+bool RunCatchingExceptions(application_context& ctx, const string& description, const function<bool()>& work) {
+    try {
+        return work();
+    } catch (const exception& error) {
+        ctx.userLogger->error("{} failed: {}", description, error.what());
+    } catch (...) {
+        ctx.userLogger->error("{} failed", description);
+    }
+
+    return false;
+}
 
-        if (!dep->inputDependency.HasValue()) {
-            resolutionSuccessful = DeleteDependency(ctx, dep);
 
-            if (resolutionSuccessful) {
-                // FIXME I think it makes sense to only remove from the lock file if we _actually_ managed
-                // to delete the dependency's local contents, but I might be wrong...
-                dependencies.erase(i);
-                delete dep;
-            }
+bool ResolveDependency(application_context& ctx, dependency& dep) {
+    if (ctx.Cancelled()) {
+        SPDLOG_LOGGER_DEBUG(ctx.applicationLogger, "Run cancelled, not resolving \"{}\"", dep.name);
+        return false;
+    }
+
+    // gone from `dep` once deleted, but needed to journal the deletion
+    string previousPath = dep.lockDependency.localPath;
+
+    bool resolutionSuccessful = RunCatchingExceptions(ctx, "Resolution of \"" + dep.name + "\"", [&ctx, &dep] {
+        if (dep.inputDependency.HasValue()) {
+            return FetchRemoteDependency(ctx, dep);
+        }
+
+        bool deletionSuccessful = DeleteDependency(ctx, dep);
+        if (deletionSuccessful) {
+            // FIXME I think it makes sense to only remove from the lock file if we _actually_ managed
+            // to delete the dependency's local contents, but I might be wrong...
+            dep.lockDependency = lock_dependency();
+        }
+
+        return deletionSuccessful;
+    });
+
+    if (!resolutionSuccessful) {
+        ctx.applicationLogger->warn("Resolution of \"{}\" failed.", dep.name);
+    } else if (ctx.journal) {
+        if (dep.inputDependency.HasValue()) {
+            ctx.journal->RecordResolved(ctx, dep);
         } else {
-            resolutionSuccessful = FetchRemoteDependency(ctx, dep);
+            ctx.journal->RecordDeleted(ctx, dep, previousPath);
+        }
+    }
+
+    if (ctx.metrics) {
+        atomic<size_t>& counter = !resolutionSuccessful ? ctx.metrics->dependenciesFailed :
+            !dep.inputDependency.HasValue() ? ctx.metrics->dependenciesDeleted : ctx.metrics->dependenciesResolved;
+        counter.fetch_add(1, memory_order_relaxed);
+    }
+
+    return resolutionSuccessful;
+}
+
+
+// `ctx.pool` if the caller brought one, otherwise a pool of `--jobs` threads, owned by `ownedPool`. The caller's
+// pool may be running other work (even other resolutions), so jobs go through a `job_group` and only it is waited for.
+thread_pool& GetResolutionPool(application_context& ctx, unique_ptr<thread_pool>& ownedPool) {
+    if (ctx.pool) {
+        return *ctx.pool;
+    }
+
+    ownedPool = make_unique<thread_pool>(ctx.args->jobs);
+    return *ownedPool;
+}
+
+
+/***************************************************
+ * Prefetching
+ ***************************************************/
+
+
+// Fills the staging repository `ResolveGitDependency` would clone into, and checks that the requested version is
+// in there, so that resolving the dependency later is a purely local checkout.
+bool PrefetchGitDependency(application_context& ctx, dependency& dep) {
+    version_t& requestedVersion = dep.inputDependency.specifiedVersion;
+    string targetDirectoryPath = ctx.DependencyPathPrefix() + GetGitTargetDirectoryName(dep);
+
+    // the staging repository is written to, so this is exclusive even if there turns out to be nothing to do
+    file_lock directoryLock;
+    if (!LockDependencyPath(ctx, directoryLock, targetDirectoryPath, file_lock_mode::FILE_LOCK_EXCLUSIVE)) {
+        return false;
+    }
+
+    if (!GetLockedSemVerTag(dep).empty() || utils::DirectoryExists(targetDirectoryPath)) {
+        SPDLOG_LOGGER_INFO(ctx.applicationLogger, "Dependency \"{}\" already resolved, skipping.", dep.name);
+        return true;
+    }
+
+    if (requestedVersion.type == version_type::VERSION_TYPE_COMMIT_HASH) {
+        if (!PrefetchCommit(ctx, dep.inputDependency.source, targetDirectoryPath, requestedVersion.exact)) {
+            ctx.userLogger->error("Could not fetch commit {} of \"{}\"", requestedVersion.exact, dep.name);
+            return false;
+        }
+
+        ctx.userLogger->info("Prefetched \"{}\" at {}", dep.name, requestedVersion.exact);
+        return true;
+    }
+
+    resolution_result resolutionResult = PrefetchRepo(ctx, dep.inputDependency.source, targetDirectoryPath);
+    if (!resolutionResult.resolutionSuccessful) {
+        return false;
+    }
+
+    string version = resolutionResult.tag;
+    if (requestedVersion.type == version_type::VERSION_TYPE_SEMVER) {
+        version = MatchVersionRange(ctx, requestedVersion, resolutionResult.repo);
+    } else if (requestedVersion.type != version_type::VERSION_TYPE_DEFAULT) {
+        version = requestedVersion.exact;
+    }
+
+    string commit = version.empty() ? "" : ResolveToCommitId(ctx, resolutionResult.repo, version);
+    if (commit.empty()) {
+        ctx.userLogger->error("\"{}\" has no version matching \"{}\"", dep.name,
+                              requestedVersion.exact.empty() ? requestedVersion.versionRange : requestedVersion.exact);
+        return false;
+    }
+
+    ctx.userLogger->info("Prefetched \"{}\" at {} ({})", dep.name, version, commit.substr(0, 12));
+    return true;
+}
+
+
+bool PrefetchDependency(application_context& ctx, dependency& dep) {
+    switch (dep.inputDependency.sourceType) {
+        case (source_type::SOURCE_TYPE_GIT):
+            {
+                return PrefetchGitDependency(ctx, dep);
+            }
+        case (source_type::SOURCE_TYPE_ARCHIVE):
+            {
+                string checksum = dep.inputDependency.specifiedVersion.exact;
+                if (utils::DirectoryExists(ctx.DependencyPathPrefix() + dep.name + "-" + checksum)) {
+                    return true;
+                }
+
+                return PrefetchArchive(ctx, dep.inputDependency.source, checksum);
+            }
+        default:
+            {
+                ctx.applicationLogger->warn("Unsupported source type {}, ignoring.",
+                                            SourceTypeToString(dep.inputDependency.sourceType));
+                return false;
+            }
+    }
+}
+
+
+/* `ldh fetch`: downloads everything the dependencies need into staging repositories and the archive cache, without
+ * writing any checkout, so that a later `update` does not need the network. Submodules are not prefetched, as
+ * finding them takes a checkout.
+ */
+bool PrefetchDependencies(application_context& ctx, vector<dependency>& dependencies) {
+    if (!InitializeLibrary(ctx)) {
+        return false;
+    }
+
+    utils::MakeDirs(ctx, ctx.DependencyPathPrefix(), utils::directory_creation_mode::IGNORE_IF_EXISTS);
+
+    // as for `ResolveDependencies`: same-named dependencies may share staging directories
+    unordered_map<string_view, vector<dependency*>> dependenciesByName;
+    for (dependency& dep : dependencies) {
+        if (dep.inputDependency.HasValue()) {
+            dependenciesByName[dep.name].push_back(&dep);
         }
+    }
 
-        if (!resolutionSuccessful) {
-            ctx.applicationLogger->warn("Resolution of \"{}\" failed.", dep->name);
+    atomic<size_t> failedPrefetches = 0;
+    {
+        unique_ptr<thread_pool> ownedPool;
+        job_group prefetchJobs(GetResolutionPool(ctx, ownedPool));
+        for (auto& [_, sameNameDependencies] : dependenciesByName) {
+            prefetchJobs.Submit([&ctx, &sameNameDependencies, &failedPrefetches] {
+                for (dependency* dep : sameNameDependencies) {
+                    if (ctx.Cancelled()) {
+                        break;
+                    }
+
+                    bool prefetchSuccessful = RunCatchingExceptions(ctx, "Prefetch of \"" + dep->name + "\"",
+                                                                    [&ctx, dep] {
+                        return PrefetchDependency(ctx, *dep);
+                    });
+                    if (!prefetchSuccessful) {
+                        ctx.userLogger->warn("Prefetch of \"{}\" failed", dep->name);
+                        failedPrefetches.fetch_add(1, memory_order_relaxed);
+                    }
+                }
+            });
         }
+        prefetchJobs.Wait();
     }
+
+    ShutdownLibrary(ctx);
+
+    return failedPrefetches.load() == 0 && !ctx.Cancelled();
+}
+
+
+/***************************************************
+ * Submodules
+ ***************************************************/
+
+
+// A submodule checkout to bring up to date, inside the checkout of `owner`; nested submodules are jobs of the same
+// owner, with a longer `path`.
+struct submodule_job {
+    dependency* owner;
+    string path;
+    string url;
+    string commit;
+
+    string CheckoutPath() {
+        return this->owner->lockDependency.localPath + "/" + this->path;
+    }
+};
+
+
+// Lists the submodules of `repositoryPath` (relative to `owner`'s checkout, empty for the checkout itself) as jobs.
+bool QueueSubmodules(application_context& ctx, dependency& owner, const string& repositoryPath,
+                     vector<submodule_job>& jobs) {
+    string pathPrefix = repositoryPath.empty() ? "" : repositoryPath + "/";
+
+    vector<submodule_entry> submodules;
+    if (!ListSubmodules(ctx, owner.lockDependency.localPath + "/" + repositoryPath, submodules)) {
+        ctx.userLogger->warn("Could not list the submodules of \"{}\"", owner.lockDependency.localPath + "/" +
+                             repositoryPath);
+        return false;
+    }
+
+    for (submodule_entry& submodule : submodules) {
+        jobs.push_back({ &owner, pathPrefix + submodule.path, move(submodule.url), move(submodule.commit) });
+    }
+
+    return true;
+}
+
+
+// A submodule is left alone if the lock says it is at the right commit (and it is still there), or if its checkout
+// is at that commit anyway. Otherwise, it is replaced by a checkout of the commit, whose objects come from
+// `localCheckouts` or other checkouts of the same URL if they have them, and from the remote only if not.
+bool ResolveSubmodule(application_context& ctx, submodule_job& job, const vector<locked_submodule>& lockedSubmodules,
+                      const vector<string>& localCheckouts) {
+    string checkoutPath = job.CheckoutPath();
+
+    // held shared for as long as the submodule is worked on, so that no other process replaces (or deletes) the
+    // owner's checkout around it meanwhile; always taken before the submodule's own lock
+    file_lock ownerLock;
+    if (!LockDependencyPath(ctx, ownerLock, job.owner->lockDependency.localPath, file_lock_mode::FILE_LOCK_SHARED)) {
+        return false;
+    }
+
+    file_lock checkoutLock;
+    if (!LockDependencyPath(ctx, checkoutLock, checkoutPath, file_lock_mode::FILE_LOCK_EXCLUSIVE)) {
+        return false;
+    }
+
+    auto locked = find_if(lockedSubmodules.begin(), lockedSubmodules.end(), [&job](const locked_submodule& entry) {
+        return entry.path == job.path;
+    });
+    bool lockedAtCommit = locked != lockedSubmodules.end() && locked->resolvedVersion == job.commit;
+
+    bool upToDate = (lockedAtCommit && utils::DirectoryExists(checkoutPath + "/.git")) ||
+        GetHeadIdAtPath(checkoutPath) == job.commit;
+    if (upToDate) {
+        SPDLOG_LOGGER_INFO(ctx.applicationLogger, "Submodule \"{}\" already at {}, skipping.", checkoutPath,
+                           job.commit);
+        return true;
+    }
+
+    // whatever is there (an empty directory left by the superproject's checkout, or an outdated checkout) goes
+    if (utils::DirectoryExists(checkoutPath)) {
+        scheduled_slot diskSlot(ctx.DiskSlots());
+        if (!utils::DeleteDirAndContents(ctx, checkoutPath)) {
+            return false;
+        }
+    }
+
+    resolution_result resolutionResult = FetchCommit(ctx, job.url, checkoutPath, job.commit, localCheckouts);
+    if (!resolutionResult.resolutionSuccessful) {
+        ctx.userLogger->warn("Could not check out submodule \"{}\" of \"{}\"", job.path, job.owner->name);
+    }
+
+    return resolutionResult.resolutionSuccessful;
+}
+
+
+/* Submodules of `owners` (dependencies with `submodules = true` that were just resolved) are resolved on `pool`,
+ * once every top-level dependency is done, so that they can reuse the objects of any of them. Submodules are
+ * resolved in waves, one level of nesting at a time; within a wave, checkouts of the same URL are resolved one
+ * after the other by the same job, so that only the first of them may need to hit the network.
+ */
+void ResolveSubmodules(application_context& ctx, thread_pool& pool, vector<dependency*>& owners) {
+    // the lock's view of each owner's submodules, replaced by what actually gets checked out
+    unordered_map<dependency*, vector<locked_submodule>> lockedSubmodulesByOwner;
+    vector<submodule_job> pendingJobs;
+    for (dependency* owner : owners) {
+        lockedSubmodulesByOwner[owner] = move(owner->lockDependency.submodules);
+        owner->lockDependency.submodules.clear();
+
+        QueueSubmodules(ctx, *owner, "", pendingJobs);
+    }
+
+    mutex resultsMutex;
+    while (!pendingJobs.empty() && !ctx.Cancelled()) {
+        unordered_map<string_view, vector<submodule_job*>> jobsByUrl;
+        for (submodule_job& job : pendingJobs) {
+            jobsByUrl[job.url].push_back(&job);
+        }
+
+        vector<submodule_job> nestedJobs;
+        job_group wave(pool);
+        for (auto& [_, sameUrlJobs] : jobsByUrl) {
+            wave.Submit([&ctx, &sameUrlJobs, &lockedSubmodulesByOwner, &resultsMutex, &nestedJobs] {
+                vector<string> localCheckouts;
+                for (submodule_job* job : sameUrlJobs) {
+                    if (ctx.Cancelled()) {
+                        break;
+                    }
+
+                    vector<submodule_job> jobNestedJobs;
+                    string description = "Resolution of submodule \"" + job->path + "\" of \"" + job->owner->name +
+                        "\"";
+                    bool resolutionSuccessful = RunCatchingExceptions(ctx, description, [&] {
+                        if (!ResolveSubmodule(ctx, *job, lockedSubmodulesByOwner.at(job->owner), localCheckouts)) {
+                            return false;
+                        }
+
+                        localCheckouts.push_back(job->CheckoutPath());
+                        QueueSubmodules(ctx, *job->owner, job->path, jobNestedJobs);
+                        return true;
+                    });
+
+                    lock_guard<mutex> lock(resultsMutex);
+                    if (resolutionSuccessful) {
+                        string resolvedSource = string(SourceTypeToString(source_type::SOURCE_TYPE_GIT)) + "+" +
+                            job->url + "#" + job->commit;
+                        job->owner->lockDependency.submodules.push_back({ job->path, resolvedSource, job->commit });
+                    }
+                    move(jobNestedJobs.begin(), jobNestedJobs.end(), back_inserter(nestedJobs));
+                }
+            });
+        }
+        wave.Wait();
+
+        pendingJobs = move(nestedJobs);
+    }
+
+    for (dependency* owner : owners) {
+        vector<locked_submodule>& submodules = owner->lockDependency.submodules;
+        sort(submodules.begin(), submodules.end(), [](const locked_submodule& lhs, const locked_submodule& rhs) {
+            return lhs.path < rhs.path;
+        });
+
+        // supersedes the record made when the owner itself was resolved
+        if (ctx.journal && !submodules.empty()) {
+            ctx.journal->RecordResolved(ctx, *owner);
+        }
+    }
+}
+
+
+/* Dependencies are resolved concurrently, on `--jobs` threads (or on the caller's pool). How many of them actually
+ * talk to the same host, or hit the disk, at any one time is up to `ctx.scheduler`.
+ */
+void ResolveDependencies(application_context& ctx, vector<dependency>& dependencies) {
+    if (!InitializeLibrary(ctx)) {
+        return;
+    }
+
+    // shared by every job, so created up front rather than raced for
+    utils::MakeDirs(ctx, ctx.DependencyPathPrefix(), utils::directory_creation_mode::IGNORE_IF_EXISTS);
+
+    // dependencies with the same name (possible in workspaces) share checkout directories, e.g. `name-temp`, so
+    // they are resolved one after the other, by the same job.
+    unordered_map<string_view, vector<dependency*>> dependenciesByName;
+    for (dependency& dep : dependencies) {
+        dependenciesByName[dep.name].push_back(&dep);
+    }
+
+    {
+        unique_ptr<thread_pool> ownedPool;
+        thread_pool& pool = GetResolutionPool(ctx, ownedPool);
+
+        mutex ownersMutex;
+        vector<dependency*> submoduleOwners;
+        job_group resolutionJobs(pool);
+        for (auto& [_, sameNameDependencies] : dependenciesByName) {
+            resolutionJobs.Submit([&ctx, &sameNameDependencies, &ownersMutex, &submoduleOwners] {
+                for (dependency* dep : sameNameDependencies) {
+                    if (ResolveDependency(ctx, *dep) && dep->inputDependency.submodules) {
+                        lock_guard<mutex> lock(ownersMutex);
+                        submoduleOwners.push_back(dep);
+                    }
+                }
+            });
+        }
+        resolutionJobs.Wait();
+
+        ResolveSubmodules(ctx, pool, submoduleOwners);
+    }
+
+    // entries that were both removed from the configuration and deleted from disk have nothing left to record
+    dependencies.erase(remove_if(dependencies.begin(), dependencies.end(), [](dependency& dep) {
+        return !dep.inputDependency.HasValue() && !dep.lockDependency.HasValue();
+    }), dependencies.end());
+
+    ShutdownLibrary(ctx);
 }
@@ -0,0 +1,139 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "file_lock.hpp"
+#include "utils.hpp"
+
+
+namespace fs = std::filesystem;
+
+
+bool file_lock::Open(application_context& ctx, const string& lockPath) {
+    if (this->descriptor >= 0 && this->path == lockPath) {
+        return true;
+    }
+    this->Release();
+
+    string lockDirectory = fs::path(lockPath).parent_path().string();
+    bool directoryCreated = lockDirectory.empty() ||
+        utils::MakeDirs(ctx, lockDirectory, utils::directory_creation_mode::IGNORE_IF_EXISTS);
+    if (!directoryCreated) {
+        return false;
+    }
+
+    int lockDescriptor = open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lockDescriptor < 0) {
+        ctx.applicationLogger->error("Could not open lock file \"{}\": {}", lockPath, strerror(errno));
+        return false;
+    }
+
+    this->descriptor = lockDescriptor;
+    this->path = lockPath;
+
+    return true;
+}
+
+
+bool file_lock::Acquire(application_context& ctx, const string& lockPath, file_lock_mode mode) {
+    if (!this->Open(ctx, lockPath)) {
+        return false;
+    }
+
+    int operation = mode == file_lock_mode::FILE_LOCK_EXCLUSIVE ? LOCK_EX : LOCK_SH;
+    if (!flock(this->descriptor, operation | LOCK_NB)) {
+        return true;
+    }
+
+    if (errno == EWOULDBLOCK) {
+        ctx.userLogger->info("Waiting for another ldh process to release \"{}\"", lockPath);
+    }
+
+    int rc;
+    while ((rc = flock(this->descriptor, operation)) && errno == EINTR) {}
+
+    if (rc) {
+        ctx.applicationLogger->error("Could not lock \"{}\": {}", lockPath, strerror(errno));
+        this->Release();
+
+        return false;
+    }
+
+    return true;
+}
+
+
+bool file_lock::TryAcquire(application_context& ctx, const string& lockPath, file_lock_mode mode) {
+    if (!this->Open(ctx, lockPath)) {
+        return false;
+    }
+
+    int operation = mode == file_lock_mode::FILE_LOCK_EXCLUSIVE ? LOCK_EX : LOCK_SH;
+    return !flock(this->descriptor, operation | LOCK_NB);
+}
+
+
+void file_lock::Release() {
+    if (this->descriptor >= 0) {
+        close(this->descriptor);  // also drops the lock
+    }
+
+    this->descriptor = -1;
+    this->path.clear();
+}
+
+
+// `<directory>/.locks/<entry>.lock`, `/`s in `entry` (i.e. entries nested below other entries) escaped.
+string GetFileLockPath(const string& directory, const string& entry) {
+    string lockName;
+    lockName.reserve(entry.size());
+
+    for (char c : entry) {
+        if (c == '%') {
+            lockName += "%25";
+        } else if (c == '/') {
+            lockName += "%2F";
+        } else {
+            lockName.push_back(c);
+        }
+    }
+
+    return (fs::path(directory) / FILE_LOCK_DIRECTORY_NAME / (lockName + FILE_LOCK_EXTENSION)).string();
+}
+
+
+// Dependency paths (including their staging directories, which share the lock of the path they are staged for) are
+// all under `dependencyPathPrefix`.
+string GetDependencyLockPath(application_context& ctx, const string& dependencyPath) {
+    string dependencyPathPrefix = ctx.DependencyPathPrefix();
+
+    string entry = dependencyPath;
+    if (!entry.compare(0, dependencyPathPrefix.size(), dependencyPathPrefix)) {
+        entry = entry.substr(dependencyPathPrefix.size());
+    }
+
+    while (!entry.empty() && entry.back() == '/') {
+        entry.pop_back();
+    }
+
+    return GetFileLockPath(dependencyPathPrefix, entry);
+}
+
+
+bool LockDependencyPath(application_context& ctx, file_lock& lock, const string& dependencyPath,
+                        file_lock_mode mode) {
+    return lock.Acquire(ctx, GetDependencyLockPath(ctx, dependencyPath), mode);
+}
+
+
+string GetProjectLockPath(const string& dependencyDirectory) {
+    return GetFileLockPath(dependencyDirectory, PROJECT_LOCK_ENTRY);
+}
+
+
+bool LockProject(application_context& ctx, file_lock& lock, file_lock_mode mode) {
+    return lock.Acquire(ctx, GetProjectLockPath(ctx.DependencyPathPrefix()), mode);
+}
@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <filesystem>
+#include <mutex>
+#include <unordered_set>
+
+#include "archive_lib.hpp"
+#include "file_lock.hpp"
+#include "garbage_collector.hpp"
+#include "lock_registry.hpp"
+#include "thread_pool.hpp"
+#include "toml.hpp"
+#include "utils.hpp"
+
+
+namespace fs = std::filesystem;
+
+
+string NormalizePath(fs::path path) {
+    std::error_code pathError;
+    fs::path normalizedPath = fs::weakly_canonical(path, pathError);
+
+    return pathError ? path.lexically_normal().string() : normalizedPath.string();
+}
+
+
+// Marks every dependency path referenced by `entry`'s lock file as reachable. Returns false if the lock file
+// no longer exists, in which case the registry entry is stale.
+bool MarkReachableFromLock(application_context& ctx, registered_lock& entry, unordered_set<string>& reachable) {
+    if (!utils::FileExists(entry.lockFilePath)) {
+        ctx.applicationLogger->info("Registered lock file \"{}\" no longer exists", entry.lockFilePath);
+        return false;
+    }
+
+    try {
+        toml::parse_result lockFileDict = toml::parse_file(entry.lockFilePath);
+        toml::array* packages = lockFileDict["packages"].as_array();
+        if (!packages) {
+            return true;
+        }
+
+        for (auto&& package : *packages) {
+            toml::table* packageTable = package.as_table();
+            if (!packageTable) {
+                continue;
+            }
+
+            string localPath = (*packageTable)["path"].value_or("");
+            if (localPath.empty()) {
+                continue;
+            }
+
+            reachable.insert(NormalizePath(fs::path(entry.projectRoot) / localPath));
+
+            // downloads stay cached for as long as some lock still refers to the archive
+            string source = (*packageTable)["source"].value_or("");
+            if (!source.compare(0, 8, "archive+")) {
+                reachable.insert(NormalizePath(GetArchiveCachePath((*packageTable)["version"].value_or(""))));
+            }
+        }
+    } catch (const toml::parse_error& parseError) {
+        // we cannot tell what a broken lock file refers to, so err on the side of keeping everything around.
+        ctx.userLogger->warn("Could not parse lock file \"{}\", its project will not be collected",
+                             entry.lockFilePath);
+        reachable.insert(NormalizePath(fs::path(entry.projectRoot) / application_context::dependencyPathPrefix));
+        reachable.insert(NormalizePath(GetArchiveCacheDirectory()));
+    }
+
+    return true;
+}
+
+
+void ScanDependencyDirectory(application_context& ctx, string directoryPath, unordered_set<string>& reachable,
+                             thread_pool& pool, mutex& reportMutex, gc_report& report) {
+    // a project whose lock file could not be parsed marks its whole dependency directory as reachable
+    if (reachable.count(directoryPath)) {
+        return;
+    }
+
+    std::error_code iterationError;
+    for (const fs::directory_entry& child : fs::directory_iterator(directoryPath, iterationError)) {
+        string childPath = NormalizePath(child.path());
+
+        {
+            lock_guard<mutex> lock(reportMutex);
+            report.scannedEntries++;
+        }
+
+        if (reachable.count(childPath) || child.path().filename() == FILE_LOCK_DIRECTORY_NAME) {
+            continue;
+        }
+
+        pool.Submit([childPath, &reportMutex, &report] {
+            uintmax_t childSize = utils::DirectorySize(childPath);
+
+            lock_guard<mutex> lock(reportMutex);
+            report.unreachableEntries.push_back({childPath, childSize, false});
+        });
+    }
+
+    if (iterationError) {
+        ctx.applicationLogger->warn("Failed while scanning \"{}\": {}", directoryPath, iterationError.message());
+    }
+}
+
+
+// The lock covering an entry of a scanned directory (see `file_lock.hpp`): staging directories and partial
+// downloads share the lock of whatever they are for.
+string GetEntryLockPath(const fs::path& entryPath) {
+    string entryName = entryPath.filename().string();
+
+    size_t temporarySuffixIndex = entryName.find(".tmp.");
+    if (temporarySuffixIndex != string::npos) {
+        entryName.resize(temporarySuffixIndex);
+    } else if (entryName.size() > STAGING_DIRECTORY_SUFFIX.size() &&
+               !entryName.compare(entryName.size() - STAGING_DIRECTORY_SUFFIX.size(), string::npos,
+                                  STAGING_DIRECTORY_SUFFIX)) {
+        entryName.resize(entryName.size() - STAGING_DIRECTORY_SUFFIX.size());
+    }
+
+    return GetFileLockPath(entryPath.parent_path().string(), entryName);
+}
+
+
+void DeleteUnreachableEntries(application_context& ctx, thread_pool& pool, gc_report& report) {
+    mutex reportMutex;
+
+    for (gc_entry& entry : report.unreachableEntries) {
+        gc_entry* entryPtr = &entry;
+        pool.Submit([&ctx, entryPtr, &reportMutex, &report] {
+            // whatever another `ldh` process is still working on (e.g. an interrupted clone it is retrying) is left
+            // alone
+            file_lock entryLock;
+            if (!entryLock.TryAcquire(ctx, GetEntryLockPath(entryPtr->path), file_lock_mode::FILE_LOCK_EXCLUSIVE)) {
+                ctx.userLogger->warn("\"{}\" is in use by another ldh process, not deleting", entryPtr->path);
+                return;
+            }
+
+            std::error_code removalError;
+            fs::remove_all(entryPtr->path, removalError);
+
+            if (removalError) {
+                ctx.userLogger->error("Failed while trying to delete \"{}\"", entryPtr->path);
+                ctx.userLogger->error("Reason: {}", removalError.message());
+
+                lock_guard<mutex> lock(reportMutex);
+                report.failedDeletions++;
+                return;
+            }
+
+            entryPtr->deleted = true;
+        });
+    }
+
+    pool.Wait();
+}
+
+
+void PrintGarbageCollectionReport(application_context& ctx, gc_report& report, bool dryRun) {
+    for (gc_entry& entry : report.unreachableEntries) {
+        if (dryRun) {
+            ctx.userLogger->info("would delete {} ({})", entry.path, utils::FormatByteCount(entry.sizeInBytes));
+        } else if (entry.deleted) {
+            ctx.userLogger->info("deleted {} ({})", entry.path, utils::FormatByteCount(entry.sizeInBytes));
+        }
+    }
+
+    uintmax_t reclaimedBytes = 0;
+    size_t reclaimedEntries = 0;
+    for (gc_entry& entry : report.unreachableEntries) {
+        if (dryRun || entry.deleted) {
+            reclaimedBytes += entry.sizeInBytes;
+            reclaimedEntries++;
+        }
+    }
+
+    ctx.userLogger->info("Scanned {} entries, {} unreachable; {} {} in {} entries", report.scannedEntries,
+                         report.unreachableEntries.size(), dryRun ? "would reclaim" : "reclaimed",
+                         utils::FormatByteCount(reclaimedBytes), reclaimedEntries);
+
+    if (report.failedDeletions) {
+        ctx.userLogger->warn("{} entries could not be deleted", report.failedDeletions);
+    }
+}
+
+
+bool CollectGarbage(application_context& ctx, bool dryRun) {
+    vector<registered_lock> registeredLocks = ReadLockRegistry(ctx);
+    if (registeredLocks.empty()) {
+        ctx.userLogger->info("No lock files registered on this host, nothing to collect");
+        return true;
+    }
+
+    /* Steps
+     *  0) lock the dependency directory of every registered project, so that no update can add checkouts that are in
+     *     no lock file yet while we look
+     *  1) compute the set of reachable paths from every registered lock file
+     *  2) list the dependency directory of every registered project (and the archive cache), and size up whatever
+     *     is not reachable
+     *  3) delete unreachable entries (unless this is a dry run)
+     */
+    unordered_set<string> reachable;
+    vector<registered_lock> staleLocks;
+    vector<string> scanRoots;
+    vector<file_lock> projectLocks;
+
+    string archiveCacheDirectory = NormalizePath(GetArchiveCacheDirectory());
+
+    for (registered_lock& entry : registeredLocks) {
+        string dependencyDirectory = NormalizePath(fs::path(entry.projectRoot) /
+                                                   application_context::dependencyPathPrefix);
+        if (!utils::DirectoryExists(dependencyDirectory) ||
+                find(scanRoots.begin(), scanRoots.end(), dependencyDirectory) != scanRoots.end()) {
+            continue;
+        }
+        scanRoots.push_back(dependencyDirectory);
+
+        // an update under way may have checkouts (and downloads) that no lock file refers to yet
+        file_lock& projectLock = projectLocks.emplace_back();
+        string projectLockPath = GetProjectLockPath(dependencyDirectory);
+        if (!projectLock.TryAcquire(ctx, projectLockPath, file_lock_mode::FILE_LOCK_EXCLUSIVE)) {
+            ctx.userLogger->warn("\"{}\" is being updated by another ldh process, not collecting it",
+                                 dependencyDirectory);
+            reachable.insert(dependencyDirectory);
+            reachable.insert(archiveCacheDirectory);
+        }
+    }
+
+    for (registered_lock& entry : registeredLocks) {
+        if (!MarkReachableFromLock(ctx, entry, reachable)) {
+            staleLocks.push_back(entry);
+        }
+    }
+
+    if (utils::DirectoryExists(archiveCacheDirectory)) {
+        scanRoots.push_back(archiveCacheDirectory);
+    }
+
+    gc_report report = {};
+    mutex reportMutex;
+    {
+        thread_pool pool;
+
+        for (string& scanRoot : scanRoots) {
+            pool.Submit([&ctx, scanRoot, &reachable, &pool, &reportMutex, &report] {
+                ScanDependencyDirectory(ctx, scanRoot, reachable, pool, reportMutex, report);
+            });
+        }
+        pool.Wait();
+
+        sort(report.unreachableEntries.begin(), report.unreachableEntries.end(),
+             [](const gc_entry& lhs, const gc_entry& rhs) { return lhs.path < rhs.path; });
+
+        if (!dryRun) {
+            DeleteUnreachableEntries(ctx, pool, report);
+        }
+    }
+
+    PrintGarbageCollectionReport(ctx, report, dryRun);
+
+    if (!dryRun && !staleLocks.empty()) {
+        UnregisterLockFiles(ctx, staleLocks);
+    }
+
+    return report.failedDeletions == 0;
+}
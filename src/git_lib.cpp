@@ -1,11 +1,51 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <thread>
+
+#include "file_lock.hpp"
 #include "git_lib.hpp"
+#include "url_rewrite.hpp"
+
+
+// libgit2's caches are shared by every repository in the process, so they are capped once, for the whole run (or,
+// with `libldh`, for the whole process: the session opened last sets them).
+bool ConfigureMemoryBudget(application_context& ctx) {
+    size_t memoryBudget = ctx.scheduler ? ctx.scheduler->MemoryBudget() : 0;
+    if (!memoryBudget) {
+        return true;
+    }
+
+    size_t mappedLimit = memoryBudget / MEMORY_BUDGET_MWINDOW_DIVISOR;
+    ssize_t objectCacheLimit = (ssize_t) (memoryBudget / MEMORY_BUDGET_OBJECT_CACHE_DIVISOR);
+
+    int operationError = git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, mappedLimit);
+    operationError = operationError ? operationError : git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, objectCacheLimit);
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "set memory limits", operationError, false);
+
+    SPDLOG_LOGGER_INFO(ctx.applicationLogger, "Memory budget {}: {} for pack windows, {} for the object cache",
+                       utils::FormatByteCount(memoryBudget), utils::FormatByteCount(mappedLimit),
+                       utils::FormatByteCount(objectCacheLimit));
+    return true;
+}
 
 
 bool InitializeLibrary(application_context& ctx) {
     if (git_libgit2_init() < 0) {
         ctx.applicationLogger->error("Could not initialize libgit2.");
-        ctx.applicationLogger->error("Reason: {}", git_error_last()->message);
+        ctx.applicationLogger->error("Reason: {}", GetGitErrorMessage());
+
+        return false;
+    }
 
+    // callers only shut libgit2 down after a successful initialization
+    if (!ConfigureMemoryBudget(ctx)) {
+        git_libgit2_shutdown();
         return false;
     }
 
@@ -16,7 +56,7 @@ bool InitializeLibrary(application_context& ctx) {
 bool ShutdownLibrary(application_context& ctx) {
     if (git_libgit2_shutdown() < 0) {
         ctx.applicationLogger->error("Could not shut libgit2 down.");
-        ctx.applicationLogger->error("Reason: {}", git_error_last()->message);
+        ctx.applicationLogger->error("Reason: {}", GetGitErrorMessage());
 
         return false;
     }
@@ -25,6 +65,75 @@ bool ShutdownLibrary(application_context& ctx) {
 }
 
 
+int TransferProgressCallback(const git_indexer_progress* stats, void* payload) {
+    transfer_progress* progress = (transfer_progress*) payload;
+
+    progress->receivedBytes.store(stats->received_bytes, memory_order_relaxed);
+    progress->receivedObjects.store(stats->received_objects, memory_order_relaxed);
+    progress->indexedObjects.store(stats->indexed_objects, memory_order_relaxed);
+    progress->totalObjects.store(stats->total_objects, memory_order_relaxed);
+
+    if (progress->reporter) {
+        progress->reporter->MaybeRender();
+    }
+
+    return 0;
+}
+
+
+void CheckoutProgressCallback([[maybe_unused]] const char* path, size_t completedSteps, size_t totalSteps,
+                              void* payload) {
+    transfer_progress* progress = (transfer_progress*) payload;
+
+    progress->checkedOutFiles.store(completedSteps, memory_order_relaxed);
+    progress->totalFiles.store(totalSteps, memory_order_relaxed);
+
+    if (progress->reporter) {
+        progress->reporter->MaybeRender();
+    }
+}
+
+
+// When only metrics are collected, the entry is not attached to any reporter, and just accumulates counts.
+transfer_progress* BeginProgress(application_context& ctx, const string& path) {
+    if (ctx.progress) {
+        return ctx.progress->Begin(utils::ExtractFileName(path.c_str()));
+    }
+
+    if (ctx.metrics) {
+        return new transfer_progress(nullptr, utils::ExtractFileName(path.c_str()));
+    }
+
+    return NULL;
+}
+
+
+void EndProgress(application_context& ctx, transfer_progress* progress, bool successful) {
+    if (progress && ctx.metrics) {
+        ctx.metrics->checkedOutFiles.fetch_add(progress->checkedOutFiles.load(memory_order_relaxed),
+                                               memory_order_relaxed);
+    }
+
+    if (ctx.progress) {
+        ctx.progress->End(progress, successful);
+    } else {
+        delete progress;
+    }
+}
+
+
+void RecordFetch(application_context& ctx, git_remote* remote) {
+    if (!ctx.metrics) {
+        return;
+    }
+
+    const git_indexer_progress* stats = git_remote_stats(remote);
+    ctx.metrics->fetches.fetch_add(1, memory_order_relaxed);
+    ctx.metrics->fetchedBytes.fetch_add(stats->received_bytes, memory_order_relaxed);
+    ctx.metrics->fetchedObjects.fetch_add(stats->received_objects, memory_order_relaxed);
+}
+
+
 string GetHeadId(application_context& ctx, git_repository* repo) {
     git_oid commitObjectId;
 
@@ -35,263 +144,1300 @@ string GetHeadId(application_context& ctx, git_repository* repo) {
 }
 
 
-resolution_result* CloneRepo(application_context& ctx, string remoteUrl, string path) {
-    resolution_result* rs = new resolution_result(false);
-    rs->localPath = path;
-    rs->remote = remoteUrl;
+git_repository_handle GetGitRepositoryAtPath(application_context& ctx, const string& path) {
+    git_repository_handle repo;
+
+    int operationError = git_repository_open(repo.Out(), path.c_str());
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "repository open", operationError, git_repository_handle());
+
+    return repo;
+}
+
+
+// What the server answers about missing repositories and objects, or denied access, does not change on a retry.
+bool IsPermanentServerError(const string& message) {
+    for (const char* permanentError : { "not our ref", "not found", "not valid", "denied" }) {
+        if (message.find(permanentError) != string::npos) {
+            return true;
+        }
+    }
+
+    // libgit2 reports HTTP errors as `unexpected http status code: <code>`; timeouts and rate limiting are worth
+    // waiting out, other client errors are not
+    size_t statusCodeIndex = message.find("status code: ");
+    if (statusCodeIndex == string::npos) {
+        return false;
+    }
+
+    int statusCode = atoi(message.c_str() + statusCodeIndex + strlen("status code: "));
+    return statusCode >= 400 && statusCode < 500 && statusCode != 408 && statusCode != 429;
+}
+
+
+bool IsRetryableError(int operationError, const git_error* error) {
+    if (!error || operationError == GIT_EAUTH || operationError == GIT_ECERTIFICATE ||
+            operationError == GIT_ENOTFOUND) {
+        return false;
+    }
+
+    if (error->message && IsPermanentServerError(error->message)) {
+        return false;
+    }
+
+    switch (error->klass) {
+        case GIT_ERROR_NET:
+        case GIT_ERROR_SSL:
+        case GIT_ERROR_SSH:
+        case GIT_ERROR_HTTP:
+        case GIT_ERROR_ZLIB:
+        case GIT_ERROR_INDEXER:  // truncated packs surface as indexer errors
+            {
+                return true;
+            }
+        default:
+            {
+                return false;
+            }
+    }
+}
+
+
+// Runs `operation` until it succeeds, fails with an error that retrying will not fix, or we run out of attempts.
+// Waits between attempts grow exponentially (with some jitter, so that parallel jobs do not retry in lockstep).
+int RunWithRetries(application_context& ctx, const char* operationName, const fetch_source& source,
+                   function<int()> operation) {
+    unsigned int maxAttempts = source.attempts;
+    chrono::milliseconds delay = FETCH_RETRY_INITIAL_DELAY;
+
+    thread_local mt19937 jitterGenerator(random_device{}());
+
+    int operationError = 0;
+    for (unsigned int attempt = 1; attempt <= maxAttempts; attempt++) {
+        {
+            // only held while talking to the remote, not while waiting to retry
+            scheduled_slot transferSlot(ctx.TransferSlots(source.url));
+            scheduled_memory transferMemory(ctx.JobMemory(), FETCH_MEMORY_ESTIMATE);
+            operationError = operation();
+        }
+
+        if (!operationError || attempt == maxAttempts || ctx.Cancelled() ||
+                !IsRetryableError(operationError, git_error_last())) {
+            break;
+        }
+
+        uniform_int_distribution<long> jitter(0, delay.count() / 4);
+        chrono::milliseconds wait = delay + chrono::milliseconds(jitter(jitterGenerator));
+
+        ctx.userLogger->warn("{} from \"{}\" failed (attempt {}/{}): {}; retrying in {}ms", operationName, source.url,
+                             attempt, maxAttempts, GetGitErrorMessage(), wait.count());
+        this_thread::sleep_for(wait);
+
+        delay = min(delay * 2, FETCH_RETRY_MAX_DELAY);
+    }
+
+    return operationError;
+}
+
+
+// Runs `operation` against each mirror of `remoteUrl` in turn (see `url_rewrite.hpp`), then against `remoteUrl`
+// itself, until one of them succeeds. A mirror `operation` succeeded on is only used if `mirrorComplete` (when given)
+// agrees, as mirrors lagging behind their upstream fetch just fine, only without the latest commits. Only the
+// in-memory `remote` is pointed at the mirrors: the URL configured in the repository stays the canonical one.
+int RunWithMirrors(application_context& ctx, git_remote* remote, const string& remoteUrl,
+                   function<int(const fetch_source&)> operation, function<bool()> mirrorComplete = nullptr) {
+#if LIBGIT2_VER_MAJOR > 1 || LIBGIT2_VER_MINOR >= 4
+    for (const string& mirrorUrl : GetMirrorUrls(ctx, remoteUrl)) {
+        int operationError = git_remote_set_instance_url(remote, mirrorUrl.c_str());
+        operationError = operationError ? operationError : operation({mirrorUrl, MIRROR_FETCH_ATTEMPTS});
+        if (!operationError && (!mirrorComplete || mirrorComplete())) {
+            SPDLOG_LOGGER_DEBUG(ctx.applicationLogger, "Fetched \"{}\" from mirror \"{}\"", remoteUrl, mirrorUrl);
+            return 0;
+        }
+
+        if (ctx.Cancelled()) {
+            return operationError ? operationError : GIT_EUSER;
+        }
+
+        if (operationError) {
+            ctx.userLogger->warn("Mirror \"{}\" failed for \"{}\": {}; trying the next source", mirrorUrl, remoteUrl,
+                                 GetGitErrorMessage());
+        } else {
+            ctx.userLogger->warn("Mirror \"{}\" is missing what is needed from \"{}\"; trying the next source",
+                                 mirrorUrl, remoteUrl);
+        }
+    }
+
+    int operationError = git_remote_set_instance_url(remote, remoteUrl.c_str());
+    if (operationError) {
+        return operationError;
+    }
+#endif
+
+    return operation({remoteUrl, ctx.args->fetchRetries + 1});
+}
 
-    if (!InitializeLibrary(ctx)) {
+
+// Remotes without a URL (e.g. set up by hand with only a push URL) match nothing.
+bool RemoteHasUrl(git_remote* remote, const string& remoteUrl) {
+    const char* url = git_remote_url(remote);
+    return url && remoteUrl == url;
+}
+
+
+// Opens the staging repository left behind by an earlier, interrupted clone, or creates a new one. Either way,
+// its `origin` remote points to `remoteUrl`.
+git_repository_handle OpenStagingRepository(application_context& ctx, const string& remoteUrl,
+                                            const string& stagingPath) {
+    git_repository_handle repo;
+
+    if (utils::DirectoryExists(stagingPath)) {
+        if (!git_repository_open(repo.Out(), stagingPath.c_str())) {
+            ctx.userLogger->info("Resuming interrupted fetch in \"{}\"", stagingPath);
+        } else {
+            ctx.applicationLogger->warn("Discarding unusable staging directory \"{}\"", stagingPath);
+            utils::DeleteDirAndContents(ctx, stagingPath);
+        }
+    }
+
+    if (!repo) {
+        int operationError = git_repository_init(repo.Out(), stagingPath.c_str(), 0);
+        GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "repository init", operationError, git_repository_handle());
+    }
+
+    git_remote_handle remote;
+    int operationError = git_remote_lookup(remote.Out(), repo.Get(), STAGING_REMOTE_NAME);
+    if (operationError == GIT_ENOTFOUND) {
+        operationError = git_remote_create(remote.Out(), repo.Get(), STAGING_REMOTE_NAME, remoteUrl.c_str());
+    } else if (!operationError && !RemoteHasUrl(remote.Get(), remoteUrl)) {
+        operationError = git_remote_set_url(repo.Get(), STAGING_REMOTE_NAME, remoteUrl.c_str());
+    }
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "set up remote", operationError, git_repository_handle());
+
+    return repo;
+}
+
+
+// Whether `commitHash` (possibly abbreviated) names a commit in `repo`.
+bool RepositoryHasCommit(git_repository* repo, const string& commitHash) {
+    git_object_handle object;
+    return !git_revparse_single(object.Out(), repo, commitHash.c_str()) &&
+        git_object_type(object.Get()) == GIT_OBJECT_COMMIT;
+}
+
+
+/* Fetches everything a clone would into the staging repository. This happens in stages, each retried on its
+ * own: first the remote's default branch (usually the bulk of the history), then all other branches and tags.
+ * Objects from completed stages stay in the staging repository, and are offered to the server as already
+ * present on later attempts (or runs), so an interruption only costs the stage it happened in. Mirrors that turn out
+ * not to have `requiredCommit` (if any) are moved on from, to the next mirror or the remote itself.
+ */
+bool FetchIntoStagingRepository(application_context& ctx, git_repository* repo, const string& remoteUrl,
+                                transfer_progress* progress, string& defaultBranch, const string& requiredCommit) {
+    git_remote_handle remote;
+    int operationError = git_remote_lookup(remote.Out(), repo, STAGING_REMOTE_NAME);
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "remote lookup", operationError, false);
+
+    git_fetch_options fetchOptions;
+    git_fetch_options_init(&fetchOptions, GIT_FETCH_OPTIONS_VERSION);
+    if (progress) {
+        fetchOptions.callbacks.transfer_progress = TransferProgressCallback;
+        fetchOptions.callbacks.payload = progress;
+    }
+
+    const char* failedOperation = "fetch";
+    operationError = RunWithMirrors(ctx, remote.Get(), remoteUrl, [&](const fetch_source& source) {
+        failedOperation = "connect";
+        int sourceError = RunWithRetries(ctx, "Connecting", source, [&] {
+            return git_remote_connect(remote.Get(), GIT_DIRECTION_FETCH, &fetchOptions.callbacks, NULL, NULL);
+        });
+        if (sourceError) {
+            return sourceError;
+        }
+
+        failedOperation = "find default branch";
+        git_buf defaultBranchBuffer = { NULL, 0, 0 };
+        sourceError = git_remote_default_branch(&defaultBranchBuffer, remote.Get());
+        git_remote_disconnect(remote.Get());
+        if (sourceError) {
+            return sourceError;
+        }
+
+        defaultBranch = string(defaultBranchBuffer.ptr, defaultBranchBuffer.size);
+        git_buf_dispose(&defaultBranchBuffer);
+
+        string defaultBranchRefspec = "+" + defaultBranch + ":refs/remotes/" + STAGING_REMOTE_NAME + "/" +
+            defaultBranch.substr(strlen("refs/heads/"));
+        string allBranchesRefspec = string("+refs/heads/*:refs/remotes/") + STAGING_REMOTE_NAME + "/*";
+
+        pair<string*, git_remote_autotag_option_t> stages[] = {
+            {&defaultBranchRefspec, GIT_REMOTE_DOWNLOAD_TAGS_NONE},
+            {&allBranchesRefspec, GIT_REMOTE_DOWNLOAD_TAGS_ALL},
+        };
+
+        failedOperation = "fetch";
+        for (auto& [refspec, downloadTags] : stages) {
+            char* refspecCStr = (char*) refspec->c_str();
+            git_strarray refspecs = { &refspecCStr, 1 };
+            fetchOptions.download_tags = downloadTags;
+
+            sourceError = RunWithRetries(ctx, "Fetching", source, [&] {
+                return git_remote_fetch(remote.Get(), &refspecs, &fetchOptions, NULL);
+            });
+            if (sourceError) {
+                return sourceError;
+            }
+
+            RecordFetch(ctx, remote.Get());
+        }
+
+        return 0;
+    }, [&] {
+        return requiredCommit.empty() || RepositoryHasCommit(repo, requiredCommit);
+    });
+    GIT_LIB_ERROR_CHECK(ctx.userLogger, failedOperation, operationError, false);
+
+    return true;
+}
+
+
+// Equivalent to what `git clone` does once the objects are in: create a local branch for the remote's default
+// branch, and check it out.
+bool CheckoutDefaultBranch(application_context& ctx, git_repository* repo, const string& defaultBranch,
+                           transfer_progress* progress) {
+    string branchName = defaultBranch.substr(strlen("refs/heads/"));
+    string upstreamName = string(STAGING_REMOTE_NAME) + "/" + branchName;
+
+    git_oid upstreamId;
+    int operationError = git_reference_name_to_id(&upstreamId, repo, ("refs/remotes/" + upstreamName).c_str());
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "lookup of default branch", operationError, false);
+
+    git_commit_handle upstreamCommit;
+    operationError = git_commit_lookup(upstreamCommit.Out(), repo, &upstreamId);
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "lookup of default branch commit", operationError, false);
+
+    // forced, since an earlier interrupted run may already have created the branch
+    git_reference_handle branch;
+    operationError = git_branch_create(branch.Out(), repo, branchName.c_str(), upstreamCommit.Get(), 1);
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "branch creation", operationError, false);
+
+    operationError = git_branch_set_upstream(branch.Get(), upstreamName.c_str());
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "setting upstream", operationError, false);
+
+    operationError = git_repository_set_head(repo, defaultBranch.c_str());
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "setting HEAD", operationError, false);
+
+    git_checkout_options checkoutOptions;
+    git_checkout_options_init(&checkoutOptions, GIT_CHECKOUT_OPTIONS_VERSION);
+    checkoutOptions.checkout_strategy = GIT_CHECKOUT_FORCE;  // nothing in the staging work tree is worth keeping
+    if (progress) {
+        checkoutOptions.progress_cb = CheckoutProgressCallback;
+        checkoutOptions.progress_payload = progress;
+    }
+
+    {
+        scheduled_slot diskSlot(ctx.DiskSlots());
+        scheduled_memory checkoutMemory(ctx.JobMemory(), CHECKOUT_MEMORY_ESTIMATE);
+        operationError = git_checkout_head(repo, &checkoutOptions);
+    }
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "checkout", operationError, false);
+
+    return true;
+}
+
+
+bool CheckoutHead(application_context& ctx, const string& path) {
+    git_repository_handle repo = GetGitRepositoryAtPath(ctx, path);
+    if (!repo) {
+        return false;
+    }
+
+    git_checkout_options checkoutOptions;
+    git_checkout_options_init(&checkoutOptions, GIT_CHECKOUT_OPTIONS_VERSION);
+    checkoutOptions.checkout_strategy = GIT_CHECKOUT_FORCE;
+
+    int operationError;
+    {
+        scheduled_slot diskSlot(ctx.DiskSlots());
+        scheduled_memory checkoutMemory(ctx.JobMemory(), CHECKOUT_MEMORY_ESTIMATE);
+        operationError = git_checkout_head(repo.Get(), &checkoutOptions);
+    }
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "checkout", operationError, false);
+
+    return true;
+}
+
+
+string GetPrefetchMarkerPath(git_repository* repo) {
+    return string(git_repository_path(repo)) + PREFETCH_MARKER_FILE_NAME;
+}
+
+
+// The default branch recorded by `ldh fetch`, or an empty string if `repo` was not (completely) prefetched.
+string ReadPrefetchMarker(git_repository* repo) {
+    ifstream markerStream(GetPrefetchMarkerPath(repo));
+
+    string defaultBranch;
+    getline(markerStream, defaultBranch);
+
+    return defaultBranch;
+}
+
+
+bool WritePrefetchMarker(application_context& ctx, git_repository* repo, const string& defaultBranch) {
+    string markerPath = GetPrefetchMarkerPath(repo);
+
+    ofstream markerStream(markerPath, ios::trunc);
+    markerStream << defaultBranch << "\n";
+    markerStream.close();
+
+    if (!markerStream) {
+        ctx.applicationLogger->error("Failed while writing \"{}\"", markerPath);
+        return false;
+    }
+
+    return true;
+}
+
+
+void RemovePrefetchMarker(git_repository* repo) {
+    std::error_code removalError;
+    filesystem::remove(GetPrefetchMarkerPath(repo), removalError);
+}
+
+
+resolution_result CloneRepo(application_context& ctx, const string& remoteUrl, const string& path,
+                            const string& requiredCommit) {
+    resolution_result rs(false);
+    rs.localPath = path;
+    rs.remote = remoteUrl;
+
+    SPDLOG_LOGGER_DEBUG(ctx.applicationLogger, "Attempting to clone from remote \"{}\" into \"{}\"", remoteUrl, path);
+
+    // everything happens in a staging directory, which only gets its final name once it is complete. If we fail
+    // midway, it is kept around so that the next run can pick up from where this one stopped.
+    string stagingPath = path + STAGING_DIRECTORY_SUFFIX;
+    git_repository_handle stagingRepository = OpenStagingRepository(ctx, remoteUrl, stagingPath);
+    if (!stagingRepository) {
+        ctx.userLogger->error("Could not set up staging repository for \"{}\" in \"{}\"", remoteUrl, stagingPath);
         return rs;
     }
 
-    ctx.applicationLogger->info("Attempting to clone from remote \"{}\" into \"{}\"", remoteUrl, path);
+    transfer_progress* progress = BeginProgress(ctx, path);
+
+    // a complete prefetch (see `PrefetchRepo`) needs no network access at all
+    string defaultBranch = ReadPrefetchMarker(stagingRepository.Get());
+    if (!defaultBranch.empty()) {
+        SPDLOG_LOGGER_INFO(ctx.applicationLogger, "Using objects prefetched into \"{}\"", stagingPath);
+    }
 
-    git_repository* out = NULL;
-    int cloneError = git_clone(&out, remoteUrl.c_str(), path.c_str(), NULL);
+    bool cloneSuccessful = (!defaultBranch.empty() || FetchIntoStagingRepository(ctx, stagingRepository.Get(),
+                                                                                 remoteUrl, progress, defaultBranch,
+                                                                                 requiredCommit)) &&
+        CheckoutDefaultBranch(ctx, stagingRepository.Get(), defaultBranch, progress);
 
-    if (cloneError) {
+    EndProgress(ctx, progress, cloneSuccessful);
+
+    if (!cloneSuccessful) {
         ctx.userLogger->error("Failed while trying to clone repository \"{}\" into directory \"{}\"",
                               remoteUrl, path);
-        ctx.userLogger->error("Reason: {}", git_error_last()->message);
+        ctx.userLogger->error("Fetched objects are kept in \"{}\", the next run will resume from there",
+                              stagingPath);
 
         return rs;
     }
 
-    rs->repo = new repository(out, path);
-    rs->version = GetHeadId(ctx, rs->repo->libRepository);
+    // has to be closed before being moved
+    RemovePrefetchMarker(stagingRepository.Get());
+    stagingRepository.Reset();
+    if (!utils::RenameNode(ctx, stagingPath, path)) {
+        return rs;
+    }
 
-    ShutdownLibrary(ctx);
+    git_repository_handle out = GetGitRepositoryAtPath(ctx, path);
+    if (!out) {
+        return rs;
+    }
+
+    rs.repo = repository(move(out), path);
+    rs.version = GetHeadId(ctx, rs.repo.Get());
 
-    rs->resolutionSuccessful = true;
+    rs.resolutionSuccessful = true;
     return rs;
 }
 
 
-git_annotated_commit* ResolveRemoteReference(application_context& ctx, git_repository* repo, const char* targetReference) {
-    git_strarray remotes = { NULL, 0 };
-    git_annotated_commit *result = NULL;
+bool RepositoryHasObject(git_repository* repo, const git_oid* objectId) {
+    git_odb_handle odb;
+    if (git_repository_odb(odb.Out(), repo)) {
+        return false;
+    }
 
-    int libError = git_remote_list(&remotes, repo);
-    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "list remotes", libError, NULL);
+    return git_odb_exists(odb.Get(), objectId);
+}
 
-    git_reference *remoteReference = NULL;
-    for (unsigned int i = 0; (i < remotes.count && !remoteReference); i++) {
-        char *refname = NULL;
 
-        // figure out the "appropriate" length for `refname`
-        unsigned int reflen = snprintf(refname, 0, "refs/remotes/%s/%s", remotes.strings[i], targetReference);
-        if (reflen < 0 || !(refname = (char *) malloc(reflen + 1))) {
-            break;
+// Staging repositories, and range dependencies' checkouts, are still being set up by whichever job owns them.
+bool IsTransientCheckoutPath(const string& path) {
+    for (const string& suffix : { STAGING_DIRECTORY_SUFFIX, RANGE_CHECKOUT_SUFFIX }) {
+        if (path.size() > suffix.size() && !path.compare(path.size() - suffix.size(), string::npos, suffix)) {
+            return true;
         }
-        snprintf(refname, reflen + 1, "refs/remotes/%s/%s", remotes.strings[i], targetReference);
+    }
+
+    return false;
+}
+
 
-        libError = git_reference_lookup(&remoteReference, repo, refname);
-        free(refname);
-        GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "reference lookup", libError, NULL);
+// Checkouts are only looked at while their lock can be had shared; `candidateLock` keeps holding it on success. Not
+// waiting for the lock also keeps jobs that hold their own checkout's lock from waiting for each other.
+bool CheckoutHasCommit(application_context& ctx, const string& candidatePath, const string& remoteUrl,
+                       const git_oid* commitId, file_lock& candidateLock) {
+    string candidateLockPath = GetDependencyLockPath(ctx, candidatePath);
+    if (IsTransientCheckoutPath(candidatePath) ||
+            !candidateLock.TryAcquire(ctx, candidateLockPath, file_lock_mode::FILE_LOCK_SHARED)) {
+        return false;
     }
-    git_strarray_dispose(&remotes);
 
-    if (!remoteReference) {
-        return NULL;
+    git_repository_handle candidate;
+    git_remote_handle candidateRemote;
+
+    bool hasCommit = !git_repository_open(candidate.Out(), candidatePath.c_str()) &&
+        !git_remote_lookup(candidateRemote.Out(), candidate.Get(), STAGING_REMOTE_NAME) &&
+        RemoteHasUrl(candidateRemote.Get(), remoteUrl) &&
+        RepositoryHasObject(candidate.Get(), commitId);
+    if (!hasCommit) {
+        candidateLock.Release();
+    }
+
+    return hasCommit;
+}
+
+
+// Returns the first other checkout of `remoteUrl` that has `commitId`, or an empty string, with `candidateLock`
+// holding its lock (shared). `extraCandidates` (e.g. submodule checkouts, which live inside other dependencies) are
+// looked at first, then every checkout under the dependency directory (e.g. another pinned version of the same
+// package).
+string FindLocalCheckoutWithCommit(application_context& ctx, const string& remoteUrl, const git_oid* commitId,
+                                   const string& excludedPath, file_lock& candidateLock,
+                                   const vector<string>& extraCandidates = {}) {
+    for (const string& candidatePath : extraCandidates) {
+        if (candidatePath != excludedPath && CheckoutHasCommit(ctx, candidatePath, remoteUrl, commitId,
+                                                               candidateLock)) {
+            SPDLOG_LOGGER_DEBUG(ctx.applicationLogger, "Found commit {} in \"{}\"", git_oid_tostr_s(commitId),
+                                candidatePath);
+            return candidatePath;
+        }
     }
 
-    libError = git_annotated_commit_from_ref(&result, repo, remoteReference);
-    git_reference_free(remoteReference);
-    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "annotated commit from ref", libError, NULL);
+    std::error_code iterationError;
+    filesystem::directory_iterator it(ctx.DependencyPathPrefix(), iterationError);
+    for (; !iterationError && it != filesystem::directory_iterator(); it.increment(iterationError)) {
+        string candidatePath = it->path().string();
+        if (candidatePath == excludedPath || !it->is_directory() || it->path().filename() == FILE_LOCK_DIRECTORY_NAME) {
+            continue;
+        }
 
-    return result;
+        if (!CheckoutHasCommit(ctx, candidatePath, remoteUrl, commitId, candidateLock)) {
+            continue;
+        }
+
+        SPDLOG_LOGGER_DEBUG(ctx.applicationLogger, "Found commit {} in \"{}\"", git_oid_tostr_s(commitId),
+                            candidatePath);
+        return candidatePath;
+    }
+
+    return "";
 }
 
 
-git_annotated_commit* ResolveLocalReference(application_context& ctx, git_repository* repo, const char* targetReference) {
-    git_reference *ref;
-    git_annotated_commit *result = NULL;
+// Packs `commitId` and its history from another local checkout straight into `repo`, so that no network access is
+// needed at all.
+bool CopyCommitFromLocalCheckout(application_context& ctx, git_repository* repo, const string& remoteUrl,
+                                 const git_oid* commitId, const string& excludedPath,
+                                 const vector<string>& extraCandidates) {
+    file_lock sourceLock;
+    string sourcePath = FindLocalCheckoutWithCommit(ctx, remoteUrl, commitId, excludedPath, sourceLock,
+                                                    extraCandidates);
+    if (sourcePath.empty()) {
+        return false;
+    }
+
+    git_repository_handle source = GetGitRepositoryAtPath(ctx, sourcePath);
+    if (!source) {
+        return false;
+    }
+
+    git_revwalk_handle walk;
+    git_packbuilder_handle packBuilder;
+    string packDirectory = string(git_repository_path(repo)) + "objects/pack";
+
+    // packing walks and deltifies the same objects a fetch would index
+    scheduled_memory packMemory(ctx.JobMemory(), FETCH_MEMORY_ESTIMATE);
 
-    int operationError = git_reference_dwim(&ref, repo, targetReference);
+    int operationError = git_revwalk_new(walk.Out(), source.Get());
+    operationError = operationError ? operationError : git_revwalk_push(walk.Get(), commitId);
+    operationError = operationError ? operationError : git_packbuilder_new(packBuilder.Out(), source.Get());
+    operationError = operationError ? operationError : git_packbuilder_insert_walk(packBuilder.Get(), walk.Get());
+    operationError = operationError ? operationError : git_packbuilder_write(packBuilder.Get(), packDirectory.c_str(),
+                                                                             0, NULL, NULL);
     if (operationError) {
-        git_object *obj;
+        ctx.applicationLogger->warn("Could not copy commit from \"{}\": {}", sourcePath, GetGitErrorMessage());
+        return false;
+    }
 
-        operationError = git_revparse_single(&obj, repo, targetReference);
-        GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "find local tag", operationError, NULL);
+    git_odb_handle odb;
+    return !git_repository_odb(odb.Out(), repo) && !git_odb_refresh(odb.Get()) && RepositoryHasObject(repo, commitId);
+}
 
-        git_annotated_commit_lookup(&result, repo, git_object_id(obj));
-        git_object_free(obj);
-    } else {
-        git_annotated_commit_from_ref(&result, repo, ref);
-        git_reference_free(ref);
+
+bool FetchCommitIntoStagingRepository(application_context& ctx, git_repository* repo, const string& remoteUrl,
+                                      const git_oid* commitId, transfer_progress* progress) {
+    git_remote_handle remote;
+    int operationError = git_remote_lookup(remote.Out(), repo, STAGING_REMOTE_NAME);
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "remote lookup", operationError, false);
+
+    git_fetch_options fetchOptions;
+    git_fetch_options_init(&fetchOptions, GIT_FETCH_OPTIONS_VERSION);
+    fetchOptions.download_tags = GIT_REMOTE_DOWNLOAD_TAGS_NONE;
+#if LIBGIT2_VER_MAJOR > 1 || LIBGIT2_VER_MINOR >= 7
+    fetchOptions.depth = COMMIT_FETCH_DEPTH;
+#endif
+    if (progress) {
+        fetchOptions.callbacks.transfer_progress = TransferProgressCallback;
+        fetchOptions.callbacks.payload = progress;
     }
 
-    return result;
+    // the servers we care about allow asking for any reachable commit (`uploadpack.allowReachableSHA1InWant`)
+    string refspec = string("+") + git_oid_tostr_s(commitId) + ":refs/remotes/" + STAGING_REMOTE_NAME + "/pinned";
+    char* refspecCStr = (char*) refspec.c_str();
+    git_strarray refspecs = { &refspecCStr, 1 };
+
+    // a mirror lagging behind its upstream simply does not have the commit yet, and fails like any other source.
+    // Each source is only tried once: servers that do not allow this fail in all sorts of ways, and the clone
+    // `FetchCommit` then falls back to retries on its own.
+    operationError = RunWithMirrors(ctx, remote.Get(), remoteUrl, [&](const fetch_source& source) {
+        return RunWithRetries(ctx, "Fetching", { source.url, 1 }, [&] {
+            return git_remote_fetch(remote.Get(), &refspecs, &fetchOptions, NULL);
+        });
+    });
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "fetch by object id", operationError, false);
+
+    RecordFetch(ctx, remote.Get());
+
+    return RepositoryHasObject(repo, commitId);
 }
 
 
-git_annotated_commit* ResolveReference(application_context& ctx, git_repository* repo, const char* targetReference) {
-    git_annotated_commit* result = ResolveLocalReference(ctx, repo, targetReference);
-    if (!result) {
-        ctx.applicationLogger->info("Failed to resolve local reference {}, looking at remote references",
-                                    targetReference);
+bool CheckoutDetached(application_context& ctx, git_repository* repo, const git_oid* commitId,
+                      transfer_progress* progress) {
+    git_commit_handle commit;
+    int operationError = git_commit_lookup(commit.Out(), repo, commitId);
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "commit lookup", operationError, false);
 
-        return ResolveRemoteReference(ctx, repo, targetReference);
+    git_checkout_options checkoutOptions;
+    git_checkout_options_init(&checkoutOptions, GIT_CHECKOUT_OPTIONS_VERSION);
+    checkoutOptions.checkout_strategy = GIT_CHECKOUT_FORCE;  // nothing in the staging work tree is worth keeping
+    if (progress) {
+        checkoutOptions.progress_cb = CheckoutProgressCallback;
+        checkoutOptions.progress_payload = progress;
     }
 
-    return result;
+    {
+        scheduled_slot diskSlot(ctx.DiskSlots());
+        scheduled_memory checkoutMemory(ctx.JobMemory(), CHECKOUT_MEMORY_ESTIMATE);
+        operationError = git_checkout_tree(repo, (const git_object*) commit.Get(), &checkoutOptions);
+    }
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "checkout", operationError, false);
+
+    operationError = git_repository_set_head_detached(repo, commitId);
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "detaching HEAD", operationError, false);
+
+    return true;
 }
 
 
-git_repository* GetGitRepositoryAtPath(application_context& ctx, string path) {
-    git_repository* repo = NULL;
+// Whether `FetchCommit` can check `commitHash` out into `path` without any network access.
+bool HasCommitLocally(application_context& ctx, const string& remoteUrl, const string& path,
+                      const string& commitHash) {
+    git_oid commitId;
+    if (commitHash.size() != GIT_OID_HEXSZ || git_oid_fromstr(&commitId, commitHash.c_str())) {
+        return false;
+    }
 
-    int operationError = git_repository_open(&repo, path.c_str());
-    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "repository open", operationError, NULL);
+    git_repository_handle stagingRepository;
+    string stagingPath = path + STAGING_DIRECTORY_SUFFIX;
+    if (utils::DirectoryExists(stagingPath) && !git_repository_open(stagingRepository.Out(), stagingPath.c_str()) &&
+            RepositoryHasObject(stagingRepository.Get(), &commitId)) {
+        return true;
+    }
 
-    return repo;
+    file_lock candidateLock;
+    return !FindLocalCheckoutWithCommit(ctx, remoteUrl, &commitId, path, candidateLock).empty();
 }
 
 
-void CheckoutAux(application_context& ctx, resolution_result* rs, string tag) {
-    // TODO repo consistency checks.
-    ctx.applicationLogger->info("Attempting to checkout tag \"{}\" for \"{}\"", tag, rs->repo->path);
+/* Resolves a `commit = "..."` pin by asking for that single object id, instead of cloning the whole repository.
+ * Nothing is fetched if the commit already is in the staging repository (an earlier, interrupted run) or in another
+ * checkout of the same remote (see `FindLocalCheckoutWithCommit`). Abbreviated hashes cannot be asked for, and not
+ * all servers allow fetching by object id, so both fall back to `CloneAndCheckout`.
+ */
+resolution_result FetchCommit(application_context& ctx, const string& remoteUrl, const string& path,
+                              const string& commitHash, const vector<string>& localCheckouts) {
+    git_oid commitId;
+    if (commitHash.size() != GIT_OID_HEXSZ || git_oid_fromstr(&commitId, commitHash.c_str())) {
+        SPDLOG_LOGGER_DEBUG(ctx.applicationLogger, "\"{}\" is not a full object id, cloning instead", commitHash);
+        return CloneAndCheckout(ctx, remoteUrl, path, commitHash, true);
+    }
 
-    rs->resolutionSuccessful = false;
+    resolution_result rs(false);
+    rs.localPath = path;
+    rs.remote = remoteUrl;
 
-    const char* tagCStr = tag.c_str();
-    git_annotated_commit *checkoutTarget = ResolveReference(ctx, rs->repo->libRepository, tagCStr);
-    if (!checkoutTarget) {
-        InitializeLibrary(ctx);
-        return;
+    string stagingPath = path + STAGING_DIRECTORY_SUFFIX;
+    git_repository_handle stagingRepository = OpenStagingRepository(ctx, remoteUrl, stagingPath);
+    if (!stagingRepository) {
+        ctx.userLogger->error("Could not set up staging repository for \"{}\" in \"{}\"", remoteUrl, stagingPath);
+        return rs;
     }
 
-    git_commit* targetCommit = NULL;
-    int operationError = git_commit_lookup(&targetCommit, rs->repo->libRepository,
-            git_annotated_commit_id(checkoutTarget));
-    git_commit_free(targetCommit);
-    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "lookup for tag", operationError, EMPTY());
+    transfer_progress* progress = BeginProgress(ctx, path);
 
-    operationError = git_checkout_tree(rs->repo->libRepository, (const git_object *) targetCommit, NULL);
-    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "checkout", operationError, EMPTY());
+    bool commitAvailable = RepositoryHasObject(stagingRepository.Get(), &commitId) ||
+        CopyCommitFromLocalCheckout(ctx, stagingRepository.Get(), remoteUrl, &commitId, path, localCheckouts);
+    if (commitAvailable) {
+        SPDLOG_LOGGER_INFO(ctx.applicationLogger, "Commit {} is available locally, not fetching", commitHash);
+    } else {
+        commitAvailable = FetchCommitIntoStagingRepository(ctx, stagingRepository.Get(), remoteUrl, &commitId,
+                                                           progress);
+    }
+
+    bool checkoutSuccessful = commitAvailable && CheckoutDetached(ctx, stagingRepository.Get(), &commitId, progress);
+    EndProgress(ctx, progress, checkoutSuccessful);
 
-    if (!git_annotated_commit_ref(checkoutTarget)) {
-        operationError = git_repository_set_head_detached_from_annotated(rs->repo->libRepository, checkoutTarget);
-        GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "detaching HEAD", operationError, EMPTY());
+    // has to be closed before being moved, or handed over to `CloneRepo`
+    if (checkoutSuccessful) {
+        RemovePrefetchMarker(stagingRepository.Get());
     }
+    stagingRepository.Reset();
 
-    const char *targetHead;
-    git_reference *ref;
-    operationError = git_reference_lookup(&ref, rs->repo->libRepository, git_annotated_commit_ref(checkoutTarget));
-    if (operationError) {
-        ctx.applicationLogger->error("Failed while looking up {}.", git_annotated_commit_ref(checkoutTarget));
-        ctx.applicationLogger->error("Reason: {}", git_error_last()->message);
+    if (!commitAvailable) {
+        ctx.userLogger->warn("Could not fetch commit {} from \"{}\" directly, cloning instead", commitHash,
+                             remoteUrl);
+        return CloneAndCheckout(ctx, remoteUrl, path, commitHash, true);
+    }
 
-        git_reference_free(ref);
+    if (!checkoutSuccessful || !utils::RenameNode(ctx, stagingPath, path)) {
+        ctx.userLogger->error("Failed while checking out commit {} into \"{}\"", commitHash, path);
+        return rs;
+    }
 
-        return;
+    git_repository_handle out = GetGitRepositoryAtPath(ctx, path);
+    if (!out) {
+        return rs;
     }
 
-    git_reference* branch = NULL;
-    if (git_reference_is_remote(ref)) {
-        operationError = git_branch_create_from_annotated(&branch, rs->repo->libRepository, tagCStr, checkoutTarget, 0);
-        if (operationError) {
-            ctx.applicationLogger->error("Failed while creating branch from reference {}.",
-                    git_annotated_commit_ref(checkoutTarget));
-            ctx.applicationLogger->error("Reason: {}", git_error_last()->message);
+    rs.repo = repository(move(out), path);
+    rs.tag = commitHash;
+    rs.version = GetHeadId(ctx, rs.repo.Get());
+
+    rs.resolutionSuccessful = true;
+    return rs;
+}
+
+
+bool reference_map::Build(application_context& ctx, git_repository* repo) {
+    git_strarray remotes = { NULL, 0 };
+
+    int libError = git_remote_list(&remotes, repo);
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "list remotes", libError, false);
+
+    this->remoteNames.assign(remotes.strings, remotes.strings + remotes.count);
+    git_strarray_dispose(&remotes);
+    sort(this->remoteNames.begin(), this->remoteNames.end(), [](const string& a, const string& b) {
+        return a.size() > b.size();
+    });
+
+    libError = git_reference_foreach(repo, reference_map::AddReference, this);
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "list references", libError, false);
+
+    SPDLOG_LOGGER_DEBUG(ctx.applicationLogger, "Mapped {} references of \"{}\"", this->referencesByName.size(),
+                        git_repository_workdir(repo));
+    return true;
+}
+
+
+// `git_reference_foreach` hands over ownership of each reference to its callback.
+int reference_map::AddReference(git_reference* libReference, void* payload) {
+    reference_map* references = (reference_map*) payload;
+    git_reference_handle reference(libReference);
+
+    // references that do not lead to a commit (e.g. tags of trees, dangling symbolic references) are no
+    // checkout targets
+    git_object_handle commit;
+    if (git_reference_peel(commit.Out(), reference.Get(), GIT_OBJECT_COMMIT)) {
+        git_error_clear();
+        return 0;
+    }
+
+    reference_entry entry;
+    entry.name = git_reference_name(reference.Get());
+    entry.commitId = *git_object_id(commit.Get());
+    entry.kind = reference_kind::REFERENCE_KIND_OTHER;
+
+    string_view name(entry.name);
+    if (name.substr(0, 11) == "refs/heads/") {
+        entry.kind = reference_kind::REFERENCE_KIND_LOCAL_BRANCH;
+    } else if (name.substr(0, 10) == "refs/tags/") {
+        entry.kind = reference_kind::REFERENCE_KIND_TAG;
+    } else if (name.substr(0, 13) == "refs/remotes/") {
+        string_view remoteBranch = name.substr(13);
+
+        for (const string& remoteName : references->remoteNames) {
+            bool isRemoteOf = remoteBranch.size() > remoteName.size() + 1 &&
+                remoteBranch.substr(0, remoteName.size()) == remoteName && remoteBranch[remoteName.size()] == '/';
+            if (!isRemoteOf) {
+                continue;
+            }
+
+            entry.kind = reference_kind::REFERENCE_KIND_REMOTE_BRANCH;
+            entry.branchName = remoteBranch.substr(remoteName.size() + 1);
+
+            // `refs/remotes/<remote>/HEAD` is only an alias of the remote's default branch
+            if (entry.branchName != "HEAD") {
+                auto inserted = references->remoteBranchesByBranchName.emplace(entry.branchName, entry.name);
+                if (!inserted.second && remoteName == STAGING_REMOTE_NAME) {
+                    inserted.first->second = entry.name;
+                }
+            }
+
+            break;
+        }
+    }
+
+    references->Add(move(entry));
+    return 0;
+}
+
+
+void reference_map::Add(reference_entry entry) {
+    string name = entry.name;
+    this->referencesByName[move(name)] = move(entry);
+}
 
-            git_reference_free(ref);
 
-            return;
+const reference_entry* reference_map::Find(const string& shorthand) const {
+    // same candidates, in the same order, as `git_reference_dwim`
+    const string candidates[] = {
+        shorthand,
+        "refs/" + shorthand,
+        "refs/tags/" + shorthand,
+        "refs/heads/" + shorthand,
+        "refs/remotes/" + shorthand,
+        "refs/remotes/" + shorthand + "/HEAD",
+    };
+
+    for (const string& candidate : candidates) {
+        auto match = this->referencesByName.find(candidate);
+        if (match != this->referencesByName.end()) {
+            return &match->second;
         }
+    }
 
-        targetHead = git_reference_name(branch);
-    } else {
-        targetHead = git_annotated_commit_ref(checkoutTarget);
+    auto remoteBranch = this->remoteBranchesByBranchName.find(shorthand);
+    if (remoteBranch != this->remoteBranchesByBranchName.end()) {
+        return &this->referencesByName.at(remoteBranch->second);
     }
 
-    operationError = git_repository_set_head(rs->repo->libRepository, targetHead);
-    git_commit_free(targetCommit);
-    git_reference_free(ref);
-    git_reference_free(branch);
+    return nullptr;
+}
 
-    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "setting HEAD", operationError, EMPTY());
 
-    rs->tag = tag;
-    rs->version = GetHeadId(ctx, rs->repo->libRepository);
-    rs->resolutionSuccessful = true;
+reference_map* GetReferenceMap(application_context& ctx, repository& repo) {
+    if (!repo.references) {
+        unique_ptr<reference_map> references = make_unique<reference_map>();
+        if (!references->Build(ctx, repo.Get())) {
+            return nullptr;
+        }
+
+        repo.references = move(references);
+    }
+
+    return repo.references.get();
 }
 
 
-void Checkout(application_context& ctx, resolution_result* rs, string tag) {
-    InitializeLibrary(ctx);
+// Resolves `targetReference` to a commit, through the repository's reference map or, for anything that is not a
+// reference (commit hashes, `HEAD~2`, ...), through revparse. `reference` is left null in the latter case.
+bool ResolveReference(application_context& ctx, repository& repo, const string& targetReference,
+                      const reference_entry*& reference, git_oid& commitId) {
+    reference_map* references = GetReferenceMap(ctx, repo);
+    if (!references) {
+        return false;
+    }
 
-    // since C++ does not have `finally` blocks in exception handlers...
-    CheckoutAux(ctx, rs, tag);
+    reference = references->Find(targetReference);
+    if (reference) {
+        commitId = reference->commitId;
+        return true;
+    }
+
+    SPDLOG_LOGGER_DEBUG(ctx.applicationLogger, "\"{}\" is not a reference, parsing it as a revision", targetReference);
+
+    git_object_handle obj;
+    git_object_handle commit;
+    int operationError = git_revparse_single(obj.Out(), repo.Get(), targetReference.c_str());
+    operationError = operationError ? operationError : git_object_peel(commit.Out(), obj.Get(), GIT_OBJECT_COMMIT);
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "find local tag", operationError, false);
 
-    ShutdownLibrary(ctx);
+    commitId = *git_object_id(commit.Get());
+    return true;
 }
 
 
-resolution_result* CloneAndCheckout(application_context& ctx, string remoteUrl, string path, string tag) {
-    resolution_result* resolutionResult = NULL;
-    if (!InitializeLibrary(ctx)) {
-        return resolutionResult;
+// The commit `name` (a branch, a tag, or anything else revparse understands) resolves to, or an empty string.
+string ResolveToCommitId(application_context& ctx, repository& repo, const string& name) {
+    const reference_entry* reference = nullptr;
+    git_oid commitId;
+    if (!ResolveReference(ctx, repo, name, reference, commitId)) {
+        return "";
+    }
+
+    return git_oid_tostr_s(&commitId);
+}
+
+
+// Points HEAD at a local branch for `reference` (creating one that tracks it for a remote branch), or detaches it
+// at `commit` when there is no branch to point it to.
+bool UpdateHead(application_context& ctx, repository& repo, const reference_entry* reference,
+                const git_commit* commit) {
+    git_repository* libRepository = repo.Get();
+    const git_oid* commitId = git_commit_id(commit);
+
+    string targetHead;
+    if (reference && reference->kind == reference_kind::REFERENCE_KIND_LOCAL_BRANCH) {
+        targetHead = reference->name;
+    } else if (reference && reference->kind == reference_kind::REFERENCE_KIND_REMOTE_BRANCH) {
+        // the local branch is named after the branch on the remote, i.e. `feature/x` for both `feature/x` and
+        // `origin/feature/x`, rather than after whatever the dependency spelled it as
+        string localBranch = "refs/heads/" + reference->branchName;
+        const reference_entry* existing = repo.references->Find(localBranch);
+
+        if (!existing) {
+            git_reference_handle branch;
+            int operationError = git_branch_create(branch.Out(), libRepository, reference->branchName.c_str(),
+                                                   commit, 0);
+            GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "create branch", operationError, false);
+
+            operationError = git_branch_set_upstream(branch.Get(), reference->name.c_str() + strlen("refs/remotes/"));
+            GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "set upstream", operationError, false);
+
+            repo.references->Add({ localBranch, reference_kind::REFERENCE_KIND_LOCAL_BRANCH, *commitId, "" });
+            targetHead = localBranch;
+        } else if (git_oid_equal(&existing->commitId, commitId)) {
+            targetHead = localBranch;
+        } else {
+            SPDLOG_LOGGER_DEBUG(ctx.applicationLogger, "\"{}\" already exists at another commit, detaching HEAD",
+                                localBranch);
+        }
+    }
+
+    if (targetHead.empty()) {
+        // tags, commit hashes, etc.: there is nothing to point HEAD to but the commit itself.
+        int operationError = git_repository_set_head_detached(libRepository, commitId);
+        GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "detaching HEAD", operationError, false);
+
+        return true;
+    }
+
+    int operationError = git_repository_set_head(libRepository, targetHead.c_str());
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "setting HEAD", operationError, false);
+
+    return true;
+}
+
+
+void CheckoutAux(application_context& ctx, resolution_result& rs, const string& tag) {
+    // TODO repo consistency checks.
+    SPDLOG_LOGGER_DEBUG(ctx.applicationLogger, "Attempting to checkout tag \"{}\" for \"{}\"", tag, rs.repo.path);
+
+    rs.resolutionSuccessful = false;
+
+    git_repository* libRepository = rs.repo.Get();
+    const reference_entry* reference = nullptr;
+    git_oid targetId;
+    if (!ResolveReference(ctx, rs.repo, tag, reference, targetId)) {
+        return;
+    }
+
+    git_commit_handle targetCommit;
+    int operationError = git_commit_lookup(targetCommit.Out(), libRepository, &targetId);
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "lookup for tag", operationError, EMPTY());
+
+    git_checkout_options checkoutOptions;
+    git_checkout_options_init(&checkoutOptions, GIT_CHECKOUT_OPTIONS_VERSION);
+
+    transfer_progress* progress = BeginProgress(ctx, rs.repo.path);
+    if (progress) {
+        checkoutOptions.progress_cb = CheckoutProgressCallback;
+        checkoutOptions.progress_payload = progress;
+    }
+
+    {
+        scheduled_slot diskSlot(ctx.DiskSlots());
+        scheduled_memory checkoutMemory(ctx.JobMemory(), CHECKOUT_MEMORY_ESTIMATE);
+        operationError = git_checkout_tree(libRepository, (const git_object *) targetCommit.Get(), &checkoutOptions);
+    }
+    EndProgress(ctx, progress, !operationError);
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "checkout", operationError, EMPTY());
+
+    if (!UpdateHead(ctx, rs.repo, reference, targetCommit.Get())) {
+        return;
     }
 
-    resolutionResult = CloneRepo(ctx, remoteUrl, path);
-    if (!resolutionResult || !resolutionResult->resolutionSuccessful) {
+    // HEAD is now at the commit that was just checked out, so there is no need to look it up again
+    rs.tag = tag;
+    rs.version = git_oid_tostr_s(&targetId);
+    rs.resolutionSuccessful = true;
+}
+
+
+void Checkout(application_context& ctx, resolution_result& rs, const string& tag) {
+    CheckoutAux(ctx, rs, tag);
+}
+
+
+// `tagIsCommit` when `tag` is a commit hash, which mirrors then need to have.
+resolution_result CloneAndCheckout(application_context& ctx, const string& remoteUrl, const string& path,
+                                   const string& tag, bool tagIsCommit) {
+    resolution_result resolutionResult = CloneRepo(ctx, remoteUrl, path, tagIsCommit ? tag : "");
+    if (!resolutionResult.resolutionSuccessful) {
         ctx.userLogger->error("Could not clone repo \"{}\" to \"{}\", aborting", remoteUrl, path);
 
-        GIT_LIB_SHUTDOWN_AND_RETURN(ctx, resolutionResult);
+        return resolutionResult;
     }
 
     CheckoutAux(ctx, resolutionResult, tag);
-    if (!resolutionResult->resolutionSuccessful) {
+    if (!resolutionResult.resolutionSuccessful) {
         ctx.userLogger->error("Could not checkout tag \"{}\" for \"{}\", aborting", tag, path);
-        // cleanup after clone, so that we can retry this cleanly on the next run.
-        utils::DeleteDirAndContents(ctx, path);  // FIXME catch error result
 
-        GIT_LIB_SHUTDOWN_AND_RETURN(ctx, resolutionResult);
+        // cleanup after clone, so that we can retry this cleanly on the next run. The repository has to be
+        // closed first, as it still holds open files inside `path`.
+        resolutionResult.repo = repository();
+        utils::DeleteDirAndContents(ctx, path);  // FIXME catch error result
     }
 
-    GIT_LIB_SHUTDOWN_AND_RETURN(ctx, resolutionResult);
+    return resolutionResult;
 }
 
 
-resolution_result* CreateResolutionResultFromLocalGitRepo(application_context& ctx, string remoteUrl, string path, version_t& version) {
-    InitializeLibrary(ctx);
-    resolution_result* rs = new resolution_result(true);
+resolution_result CreateResolutionResultFromLocalGitRepo(application_context& ctx, const string& remoteUrl,
+                                                         const string& path, version_t& version) {
+    resolution_result rs(true);
 
-    git_repository* libRepository = GetGitRepositoryAtPath(ctx, path);
+    git_repository_handle libRepository = GetGitRepositoryAtPath(ctx, path);
     if (!libRepository) {
-        rs->resolutionSuccessful = false;
+        rs.resolutionSuccessful = false;
 
         return rs;
     }
 
-    rs->repo = new repository(libRepository, path);
-    rs->localPath = path;
-    rs->remote = remoteUrl;
+    rs.repo = repository(move(libRepository), path);
+    rs.localPath = path;
+    rs.remote = remoteUrl;
 
-    rs->version = GetHeadId(ctx, rs->repo->libRepository);
-    rs->tag = version.exact;
+    rs.version = GetHeadId(ctx, rs.repo.Get());
+    rs.tag = version.exact;
 
-    ShutdownLibrary(ctx);
     return rs;
 }
 
 
-vector<string*>* GetTagsForRepository(application_context& ctx, repository* repo) {
-    InitializeLibrary(ctx);
+/* Brings an existing branch checkout up to date with its remote: only objects the repository does not have yet
+ * are fetched, and the branch is fast-forwarded with a checkout of just the files that differ between the old and
+ * the new commit. Branches that cannot be fast-forwarded (e.g. after a force push) are left alone.
+ */
+bool RefreshRepository(application_context& ctx, resolution_result& rs) {
+    git_repository* repo = rs.repo.Get();
+
+    git_reference_handle head;
+    int operationError = git_repository_head(head.Out(), repo);
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "HEAD lookup", operationError, false);
+
+    if (!git_reference_is_branch(head.Get())) {
+        ctx.applicationLogger->warn("\"{}\" is not on a branch, not refreshing", rs.localPath);
+        return false;
+    }
+
+    string branchName = git_reference_shorthand(head.Get());
+    string trackingReference = string("refs/remotes/") + STAGING_REMOTE_NAME + "/" + branchName;
+    string refspec = "+refs/heads/" + branchName + ":" + trackingReference;
+
+    git_remote_handle remote;
+    operationError = git_remote_lookup(remote.Out(), repo, STAGING_REMOTE_NAME);
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "remote lookup", operationError, false);
+
+    git_fetch_options fetchOptions;
+    git_fetch_options_init(&fetchOptions, GIT_FETCH_OPTIONS_VERSION);
+    fetchOptions.download_tags = GIT_REMOTE_DOWNLOAD_TAGS_AUTO;
+
+    transfer_progress* progress = BeginProgress(ctx, rs.localPath);
+    if (progress) {
+        fetchOptions.callbacks.transfer_progress = TransferProgressCallback;
+        fetchOptions.callbacks.payload = progress;
+    }
+
+    char* refspecCStr = (char*) refspec.c_str();
+    git_strarray refspecs = { &refspecCStr, 1 };
+    operationError = RunWithMirrors(ctx, remote.Get(), rs.remote, [&](const fetch_source& source) {
+        return RunWithRetries(ctx, "Fetching", source, [&] {
+            return git_remote_fetch(remote.Get(), &refspecs, &fetchOptions, NULL);
+        });
+    });
+    if (operationError) {
+        EndProgress(ctx, progress, false);
+    }
+    GIT_LIB_ERROR_CHECK(ctx.userLogger, "fetch", operationError, false);
+
+    RecordFetch(ctx, remote.Get());
+    rs.repo.references.reset();
+
+    git_reference_handle upstream;
+    git_annotated_commit_handle upstreamCommit;
+    operationError = git_reference_lookup(upstream.Out(), repo, trackingReference.c_str());
+    operationError = operationError ? operationError : git_annotated_commit_from_ref(upstreamCommit.Out(), repo,
+                                                                                     upstream.Get());
+    if (operationError) {
+        EndProgress(ctx, progress, false);
+    }
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "upstream lookup", operationError, false);
+
+    git_merge_analysis_t analysis;
+    git_merge_preference_t preference;
+    const git_annotated_commit* mergeHeads[] = { upstreamCommit.Get() };
+    operationError = git_merge_analysis(&analysis, &preference, repo, mergeHeads, 1);
+    if (operationError) {
+        EndProgress(ctx, progress, false);
+    }
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "merge analysis", operationError, false);
+
+    if (analysis & GIT_MERGE_ANALYSIS_UP_TO_DATE) {
+        EndProgress(ctx, progress, true);
+        SPDLOG_LOGGER_INFO(ctx.applicationLogger, "\"{}\" is up to date", rs.localPath);
+
+        return true;
+    }
+
+    if (!(analysis & GIT_MERGE_ANALYSIS_FASTFORWARD)) {
+        EndProgress(ctx, progress, false);
+        ctx.userLogger->warn("\"{}\" has diverged from \"{}\", not refreshing", rs.localPath, trackingReference);
+
+        return false;
+    }
 
-    vector<string*>* res = new vector<string*>();
+    const git_oid* targetId = git_annotated_commit_id(upstreamCommit.Get());
+    git_commit_handle targetCommit;
+    operationError = git_commit_lookup(targetCommit.Out(), repo, targetId);
+    if (operationError) {
+        EndProgress(ctx, progress, false);
+    }
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "commit lookup", operationError, false);
+
+    // the baseline defaults to HEAD's tree, so only files that differ between the two commits are written
+    git_checkout_options checkoutOptions;
+    git_checkout_options_init(&checkoutOptions, GIT_CHECKOUT_OPTIONS_VERSION);
+    checkoutOptions.checkout_strategy = GIT_CHECKOUT_SAFE;
+    if (progress) {
+        checkoutOptions.progress_cb = CheckoutProgressCallback;
+        checkoutOptions.progress_payload = progress;
+    }
+
+    {
+        scheduled_slot diskSlot(ctx.DiskSlots());
+        scheduled_memory checkoutMemory(ctx.JobMemory(), CHECKOUT_MEMORY_ESTIMATE);
+        operationError = git_checkout_tree(repo, (const git_object*) targetCommit.Get(), &checkoutOptions);
+    }
+    EndProgress(ctx, progress, !operationError);
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "checkout", operationError, false);
+
+    git_reference_handle updatedHead;
+    operationError = git_reference_set_target(updatedHead.Out(), head.Get(), targetId, "ldh: fast-forward");
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "fast-forward", operationError, false);
+
+    string previousVersion = rs.version;
+    rs.version = GetHeadId(ctx, repo);
+    ctx.userLogger->info("Refreshed \"{}\" ({} -> {})", rs.localPath, previousVersion.substr(0, 12),
+                         rs.version.substr(0, 12));
+
+    return true;
+}
+
+
+tag_list GetTagsForRepository(application_context& ctx, repository& repo) {
+    tag_list res;
     git_strarray tagNames;
 
-    int libError = git_tag_list(&tagNames, repo->libRepository);
-    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "get tag list", libError, NULL);
+    int libError = git_tag_list(&tagNames, repo.Get());
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "get tag list", libError, res);
 
+    size_t arenaSize = 0;
+    for (size_t i = 0; i < tagNames.count; i++) {
+        arenaSize += strlen(tagNames.strings[i]);
+    }
+
+    // views are only taken once the arena is complete, as appending may reallocate it
+    vector<size_t> tagLengths;
+    tagLengths.reserve(tagNames.count);
+    res.arena.reserve(arenaSize);
     for (int i = tagNames.count - 1; i > -1; i--) {
-        res->push_back(new string(tagNames.strings[i]));
+        size_t tagLength = strlen(tagNames.strings[i]);
+
+        res.arena.append(tagNames.strings[i], tagLength);
+        tagLengths.push_back(tagLength);
     }
 
-    git_strarray_free(&tagNames);
-    ShutdownLibrary(ctx);
+    res.names.reserve(tagNames.count);
+    const char* tagStart = res.arena.data();
+    for (size_t tagLength : tagLengths) {
+        res.names.emplace_back(tagStart, tagLength);
+        tagStart += tagLength;
+    }
+
+    git_strarray_dispose(&tagNames);
 
     return res;
 }
+
+
+struct submodule_listing {
+    git_repository* repo;
+    vector<submodule_entry>* submodules;
+};
+
+
+int ListSubmodulesCallback(git_submodule* submodule, [[maybe_unused]] const char* name, void* payload) {
+    submodule_listing* listing = (submodule_listing*) payload;
+
+    // declared in `.gitmodules`, but not (or no longer) part of the tree
+    const git_oid* commitId = git_submodule_head_id(submodule);
+    const char* url = git_submodule_url(submodule);
+    if (!commitId || !url) {
+        return 0;
+    }
+
+    // relative URLs (`../other.git`) are relative to the superproject's remote
+    git_buf resolvedUrl = { NULL, 0, 0 };
+    int operationError = git_submodule_resolve_url(&resolvedUrl, listing->repo, url);
+    if (operationError) {
+        return operationError;
+    }
+
+    listing->submodules->push_back({ git_submodule_path(submodule), string(resolvedUrl.ptr, resolvedUrl.size),
+                                     git_oid_tostr_s(commitId) });
+    git_buf_dispose(&resolvedUrl);
+
+    return 0;
+}
+
+
+bool ListSubmodules(application_context& ctx, const string& path, vector<submodule_entry>& submodules) {
+    git_repository_handle repo = GetGitRepositoryAtPath(ctx, path);
+    if (!repo) {
+        return false;
+    }
+
+    submodule_listing listing = { repo.Get(), &submodules };
+    int operationError = git_submodule_foreach(repo.Get(), ListSubmodulesCallback, &listing);
+    GIT_LIB_ERROR_CHECK(ctx.applicationLogger, "list submodules", operationError, false);
+
+    return true;
+}
+
+
+// Like `GetHeadId`, but for paths that may well not be repositories (yet), so failures are not logged.
+string GetHeadIdAtPath(const string& path) {
+    git_repository_handle repo;
+    git_oid commitObjectId;
+    if (git_repository_open(repo.Out(), path.c_str()) ||
+            git_reference_name_to_id(&commitObjectId, repo.Get(), "HEAD")) {
+        return "";
+    }
+
+    return git_oid_tostr_s(&commitObjectId);
+}
+
+
+/* Fetches everything `CloneRepo` would into the staging repository of `path`, without checking anything out, and
+ * marks it as prefetched. On success, the result holds the (open) staging repository, and the remote's default
+ * branch as its tag.
+ */
+resolution_result PrefetchRepo(application_context& ctx, const string& remoteUrl, const string& path,
+                               const string& requiredCommit) {
+    resolution_result rs(false);
+    rs.localPath = path;
+    rs.remote = remoteUrl;
+
+    string stagingPath = path + STAGING_DIRECTORY_SUFFIX;
+    git_repository_handle stagingRepository = OpenStagingRepository(ctx, remoteUrl, stagingPath);
+    if (!stagingRepository) {
+        ctx.userLogger->error("Could not set up staging repository for \"{}\" in \"{}\"", remoteUrl, stagingPath);
+        return rs;
+    }
+
+    transfer_progress* progress = BeginProgress(ctx, path);
+
+    string defaultBranch;
+    bool fetchSuccessful = FetchIntoStagingRepository(ctx, stagingRepository.Get(), remoteUrl, progress,
+                                                      defaultBranch, requiredCommit) &&
+        WritePrefetchMarker(ctx, stagingRepository.Get(), defaultBranch);
+
+    EndProgress(ctx, progress, fetchSuccessful);
+
+    if (!fetchSuccessful) {
+        ctx.userLogger->error("Failed while trying to fetch repository \"{}\" into \"{}\"", remoteUrl, stagingPath);
+        return rs;
+    }
+
+    rs.repo = repository(move(stagingRepository), stagingPath);
+    rs.tag = defaultBranch.substr(strlen("refs/heads/"));
+    rs.version = ResolveToCommitId(ctx, rs.repo, rs.tag);
+
+    rs.resolutionSuccessful = !rs.version.empty();
+    return rs;
+}
+
+
+// Gets `commitHash` into the staging repository of `path` the way `FetchCommit` would, without checking it out.
+bool PrefetchCommit(application_context& ctx, const string& remoteUrl, const string& path,
+                    const string& commitHash) {
+    git_oid commitId;
+    if (commitHash.size() != GIT_OID_HEXSZ || git_oid_fromstr(&commitId, commitHash.c_str())) {
+        resolution_result rs = PrefetchRepo(ctx, remoteUrl, path, commitHash);
+        return rs.resolutionSuccessful && !ResolveToCommitId(ctx, rs.repo, commitHash).empty();
+    }
+
+    string stagingPath = path + STAGING_DIRECTORY_SUFFIX;
+    git_repository_handle stagingRepository = OpenStagingRepository(ctx, remoteUrl, stagingPath);
+    if (!stagingRepository) {
+        ctx.userLogger->error("Could not set up staging repository for \"{}\" in \"{}\"", remoteUrl, stagingPath);
+        return false;
+    }
+
+    transfer_progress* progress = BeginProgress(ctx, path);
+
+    bool commitAvailable = RepositoryHasObject(stagingRepository.Get(), &commitId) ||
+        CopyCommitFromLocalCheckout(ctx, stagingRepository.Get(), remoteUrl, &commitId, path, {}) ||
+        FetchCommitIntoStagingRepository(ctx, stagingRepository.Get(), remoteUrl, &commitId, progress);
+    EndProgress(ctx, progress, commitAvailable);
+
+    if (commitAvailable) {
+        return true;
+    }
+
+    // like `FetchCommit`, which then clones into the same staging repository
+    ctx.userLogger->warn("Could not fetch commit {} from \"{}\" directly, fetching everything instead", commitHash,
+                         remoteUrl);
+    stagingRepository.Reset();
+
+    resolution_result rs = PrefetchRepo(ctx, remoteUrl, path, commitHash);
+    return rs.resolutionSuccessful && RepositoryHasObject(rs.repo.Get(), &commitId);
+}
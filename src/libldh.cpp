@@ -0,0 +1,323 @@
+#include "ldh.hpp"
+
+// Everything the sources below include from outside the tree, included first so that their include guards keep
+// them out of `ldh::detail`.
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <curl/curl.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <zstd.h>
+
+#include "clipp.h"
+#include "git2.h"
+#include "spdlog/spdlog.h"
+#include "spdlog/async.h"
+#include "spdlog/sinks/ostream_sink.h"
+#include "spdlog/sinks/stdout_color_sinks.h"
+#include "toml.hpp"
+
+
+// `ldh` itself is one translation unit with everything at global scope. Here it goes in a namespace of its own
+// instead, so that none of it clashes with the names (and symbols) of whatever `libldh` is linked into.
+namespace ldh::detail {
+#include "application_context.hpp"
+#include "build_stamps.cpp"
+#include "bundle.cpp"
+#include "configuration_io.cpp"
+#include "dependency_resolver.cpp"
+#include "file_lock.cpp"
+#include "garbage_collector.cpp"
+#include "lock_journal.cpp"
+#include "lock_registry.cpp"
+#include "logger_manager.hpp"
+#include "manifest_cache.cpp"
+#include "plan.cpp"
+#include "progress_reporter.cpp"
+#include "resolution_scheduler.cpp"
+#include "run_metrics.cpp"
+#include "update.cpp"
+#include "url_rewrite.cpp"
+#include "validation.cpp"
+#include "workspace.cpp"
+
+
+    // A single call's context, pointing to its own arguments.
+    struct call_context {
+        execution_arguments args;
+        application_context ctx;
+
+        call_context(const execution_arguments& sessionArgs, const application_context& sessionCtx,
+                     const string& manifestPath, const string& lockFilePath,
+                     const cancellation_token* cancellation = nullptr): args(sessionArgs), ctx(sessionCtx) {
+            this->args.configurationFilePath = manifestPath;
+            this->args.lockFilePath = lockFilePath.empty() ? GenerateLockFilePath(manifestPath) : lockFilePath;
+
+            this->ctx.args = &this->args;
+            this->ctx.cancellation = cancellation;
+
+            // checkouts go next to the manifest, whatever the process' working directory
+            std::error_code pathError;
+            fs::path manifestDirectory = fs::absolute(manifestPath, pathError).parent_path();
+            this->ctx.projectRoot = manifestDirectory.lexically_normal().string();
+        }
+    };
+
+
+    // Manifests (and lock files) that do not even parse, or cannot be read, are reported like any other
+    // configuration error, rather than thrown at the caller.
+    bool ParseProject(application_context& ctx, configuration_modes mode, configuration& config) {
+        try {
+            return ParseAndCheckConfiguration(ctx, ctx.args->configurationFilePath, mode, config);
+        } catch (const toml::parse_error& parseError) {
+            const toml::source_region& source = parseError.source();
+            ctx.userLogger->error("Failed while parsing \"{}\": {} (line {}, column {})",
+                                  source.path ? *source.path : ctx.args->configurationFilePath,
+                                  parseError.description(), source.begin.line, source.begin.column);
+            return false;
+        } catch (const exception& error) {
+            ctx.userLogger->error("Failed while reading \"{}\": {}", ctx.args->configurationFilePath, error.what());
+            return false;
+        }
+    }
+
+
+    void DescribeProject(application_context& ctx, configuration& config, ldh::project& result) {
+        result.name = config.packageInformation.name;
+        result.manifestPath = ctx.args->configurationFilePath;
+        result.lockFilePath = ctx.args->lockFilePath;
+
+        result.dependencies.clear();
+        for (dependency& dep : config.dependencies) {
+            // entries only kept around to be deleted are not part of the project anymore
+            if (!dep.inputDependency.HasValue()) {
+                continue;
+            }
+
+            lock_dependency& locked = dep.lockDependency;
+            result.dependencies.push_back({dep.name, locked.resolvedSource, locked.resolvedVersion, locked.localPath});
+        }
+    }
+
+
+    void DescribePlan(vector<planned_action>& plan, vector<ldh::planned_dependency>& result) {
+        result.clear();
+        for (planned_action& entry : plan) {
+            result.push_back({entry.name, PlanActionToString(entry.action), entry.path, entry.reason});
+        }
+    }
+}
+
+using namespace ldh::detail;
+
+
+ldh::session_options::session_options():
+    pool(nullptr),
+    jobs(DEFAULT_RESOLUTION_JOBS),
+    fetchRetries(DEFAULT_FETCH_RETRIES),
+    transfersPerHost(DEFAULT_TRANSFERS_PER_HOST),
+    diskJobs(DEFAULT_DISK_JOBS),
+    noManifestCache(false),
+    refresh(false) {}
+
+
+// Everything calls share. Each call works on its own copy of `ctx` and `args`, so that calls can run concurrently.
+struct ldh::session::state {
+    execution_arguments args;
+    application_context ctx;
+
+    bool opened;
+    bool libraryInitialized;
+};
+
+
+ldh::session::session(): impl(make_unique<state>()) {}
+
+
+ldh::session::~session() {
+    application_context& ctx = this->impl->ctx;
+    if (this->impl->libraryInitialized) {
+        ShutdownLibrary(ctx);
+    }
+
+    delete ctx.scheduler;
+    delete ctx.mirrors;
+}
+
+
+bool ldh::session::Open(const session_options& options) {
+    application_context& ctx = this->impl->ctx;
+    execution_arguments& args = this->impl->args;
+
+    // whatever a first call set up (and, if it failed, how far it got) stays as it is
+    if (this->impl->opened) {
+        ctx.userLogger->error("Session is already open");
+        return false;
+    }
+    this->impl->opened = true;
+
+    ctx.binaryName = "libldh";
+    ctx.applicationLogger = options.applicationLogger ? options.applicationLogger :
+        logger_manager::GetInstance()->GetLogger(APPLICATION_LOGGER_NAME);
+    ctx.userLogger = options.userLogger ? options.userLogger :
+        logger_manager::GetInstance()->GetLogger(USER_LOGGER_NAME);
+    ctx.pool = options.pool;
+    ctx.args = &args;
+
+    args.currentMode = mode::MODE_UPDATE;
+    args.memoryBudget = options.memoryBudget;
+    args.noProgress = true;
+    args.noManifestCache = options.noManifestCache;
+    args.refresh = options.refresh;
+    args.fetchRetries = options.fetchRetries;
+    args.jobs = options.jobs;
+    args.transfersPerHost = options.transfersPerHost;
+    args.diskJobs = options.diskJobs;
+
+    uintmax_t memoryBudget = 0;
+    string memoryBudgetSetting = GetMemoryBudgetSetting(args.memoryBudget);
+    if (!memoryBudgetSetting.empty() && !utils::ParseByteCount(memoryBudgetSetting, memoryBudget)) {
+        ctx.userLogger->error("Invalid memory budget \"{}\", expected a size like 512M or 2G", memoryBudgetSetting);
+        return false;
+    }
+
+    ctx.scheduler = new resolution_scheduler(args.transfersPerHost, args.diskJobs, memoryBudget);
+
+    if (!LoadUrlRewriter(ctx)) {
+        return false;
+    }
+
+    // held for the whole session, so that libgit2's caches outlive any single call
+    this->impl->libraryInitialized = InitializeLibrary(ctx);
+    return this->impl->libraryInitialized;
+}
+
+
+bool ldh::session::Parse(const std::string& manifestPath, project& result, const std::string& lockFilePath) {
+    if (!this->impl->libraryInitialized) {
+        return false;
+    }
+
+    call_context call(this->impl->args, this->impl->ctx, manifestPath, lockFilePath);
+
+    configuration config;
+    if (!ParseProject(call.ctx, configuration_modes::CONFIGURATION_MODE_INPUT |
+                      configuration_modes::CONFIGURATION_MODE_OUTPUT, config)) {
+        return false;
+    }
+
+    DescribeProject(call.ctx, config, result);
+    return true;
+}
+
+
+bool ldh::session::Plan(const std::string& manifestPath, std::vector<planned_dependency>& result,
+                        const std::string& lockFilePath) {
+    if (!this->impl->libraryInitialized) {
+        return false;
+    }
+
+    call_context call(this->impl->args, this->impl->ctx, manifestPath, lockFilePath);
+
+    configuration config;
+    if (!ParseProject(call.ctx, configuration_modes::CONFIGURATION_MODE_INPUT |
+                      configuration_modes::CONFIGURATION_MODE_OUTPUT, config)) {
+        return false;
+    }
+
+    vector<planned_action> plan = PlanDependencies(call.ctx, config.dependencies);
+    DescribePlan(plan, result);
+    return true;
+}
+
+
+// Valid and up to date: `Resolve` would not change anything, on disk or in the lock file.
+bool ldh::session::Verify(const std::string& manifestPath, verification& result, const std::string& lockFilePath) {
+    result = verification();
+    if (!this->impl->libraryInitialized) {
+        return false;
+    }
+
+    call_context call(this->impl->args, this->impl->ctx, manifestPath, lockFilePath);
+
+    manifest_validation validation;
+    validation.configurationFilePath = manifestPath;
+    ValidateManifest(call.ctx, validation);
+
+    result.valid = validation.valid;
+    result.diagnostics = move(validation.diagnostics);
+    if (!result.valid) {
+        return false;
+    }
+
+    vector<planned_dependency> plan;
+    if (!this->Plan(manifestPath, plan, call.args.lockFilePath)) {
+        return false;
+    }
+
+    for (planned_dependency& entry : plan) {
+        if (entry.action != PlanActionToString(plan_action::PLAN_ACTION_NONE)) {
+            result.pending.push_back(move(entry));
+        }
+    }
+
+    result.upToDate = result.pending.empty();
+    return result.upToDate;
+}
+
+
+bool ldh::session::Resolve(const std::string& manifestPath, project& result, const cancellation_token* cancellation,
+                           const std::string& lockFilePath) {
+    if (!this->impl->libraryInitialized) {
+        return false;
+    }
+
+    call_context call(this->impl->args, this->impl->ctx, manifestPath, lockFilePath, cancellation);
+
+    configuration config;
+    if (!ParseProject(call.ctx, configuration_modes::CONFIGURATION_MODE_INPUT |
+                      configuration_modes::CONFIGURATION_MODE_OUTPUT, config)) {
+        return false;
+    }
+
+    bool updateSuccessful = UpdateProject(call.ctx, config);
+    DescribeProject(call.ctx, config, result);
+
+    return updateSuccessful;
+}
@@ -0,0 +1,300 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "lock_journal.hpp"
+#include "utils.hpp"
+
+
+namespace fs = std::filesystem;
+
+
+/***************************************************
+ * Record encoding
+ ***************************************************/
+
+
+string EscapeJournalField(const string& field) {
+    string escaped;
+    escaped.reserve(field.size());
+
+    for (char c : field) {
+        switch (c) {
+            case '\\':
+                {
+                    escaped += "\\\\";
+                    break;
+                }
+            case '\t':
+                {
+                    escaped += "\\t";
+                    break;
+                }
+            case '\n':
+                {
+                    escaped += "\\n";
+                    break;
+                }
+            default:
+                {
+                    escaped.push_back(c);
+                    break;
+                }
+        }
+    }
+
+    return escaped;
+}
+
+
+string UnescapeJournalField(string_view field) {
+    string unescaped;
+    unescaped.reserve(field.size());
+
+    for (size_t i = 0; i < field.size(); i++) {
+        if (field[i] != '\\' || i + 1 == field.size()) {
+            unescaped.push_back(field[i]);
+            continue;
+        }
+
+        char escapedCharacter = field[++i];
+        unescaped.push_back(escapedCharacter == 't' ? '\t' : escapedCharacter == 'n' ? '\n' : escapedCharacter);
+    }
+
+    return unescaped;
+}
+
+
+vector<string> SplitJournalRecord(string_view record) {
+    vector<string> fields;
+
+    size_t fieldStart = 0;
+    while (true) {
+        size_t separatorIndex = record.find('\t', fieldStart);
+        fields.push_back(UnescapeJournalField(record.substr(fieldStart, separatorIndex - fieldStart)));
+
+        if (separatorIndex == string_view::npos) {
+            break;
+        }
+        fieldStart = separatorIndex + 1;
+    }
+
+    return fields;
+}
+
+
+/***************************************************
+ * Writing
+ ***************************************************/
+
+
+lock_journal::~lock_journal() {
+    close(this->descriptor);
+}
+
+
+bool lock_journal::RecordResolved(application_context& ctx, dependency& dep) {
+    lock_dependency& lockDependency = dep.lockDependency;
+
+    string record = "+\t" + EscapeJournalField(dep.name) + "\t" +
+        EscapeJournalField(lockDependency.resolvedVersion) + "\t" +
+        EscapeJournalField(lockDependency.resolvedSource) + "\t" +
+        EscapeJournalField(ctx.RelativeToProjectRoot(lockDependency.localPath));
+
+    for (locked_submodule& submodule : lockDependency.submodules) {
+        record += "\t" + EscapeJournalField(submodule.path) + "\t" + EscapeJournalField(submodule.resolvedVersion) +
+            "\t" + EscapeJournalField(submodule.resolvedSource);
+    }
+
+    return this->Append(ctx, record);
+}
+
+
+bool lock_journal::RecordDeleted(application_context& ctx, dependency& dep, const string& localPath) {
+    return this->Append(ctx, "-\t" + EscapeJournalField(dep.name) + "\t" +
+                        EscapeJournalField(ctx.RelativeToProjectRoot(localPath)));
+}
+
+
+// Each record goes out in a single `write` on an `O_APPEND` descriptor, and is synced before returning, so a
+// record that made it into the journal survives the process (or the machine) going away right after.
+bool lock_journal::Append(application_context& ctx, const string& record) {
+    string line = record + "\n";
+
+    lock_guard<mutex> lock(this->appendMutex);
+    if (this->appendFailed) {
+        return false;
+    }
+
+    size_t written = 0;
+    while (written < line.size()) {
+        ssize_t rc = write(this->descriptor, line.data() + written, line.size() - written);
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (rc < 0) {
+            break;
+        }
+        written += rc;
+    }
+
+    if (written < line.size() || fdatasync(this->descriptor)) {
+        // the journal is only an aid for resuming, so this is not fatal; later records are not attempted, as
+        // they would follow a torn one.
+        ctx.userLogger->warn("Failed while writing lock journal \"{}\": {}; an interrupted run will not be resumed",
+                             this->path, strerror(errno));
+        this->appendFailed = true;
+
+        return false;
+    }
+
+    return true;
+}
+
+
+string GetLockJournalPath(const string& lockFilePath) {
+    return lockFilePath + ".journal";
+}
+
+
+// Records left over from an interrupted run are kept: they have already been replayed into the configuration,
+// and still describe work this run will not redo.
+lock_journal* OpenLockJournal(application_context& ctx, const string& lockFilePath) {
+    string journalPath = GetLockJournalPath(lockFilePath);
+
+    int descriptor = open(journalPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (descriptor < 0) {
+        ctx.userLogger->warn("Could not open lock journal \"{}\": {}", journalPath, strerror(errno));
+        return nullptr;
+    }
+
+    lock_journal* journal = new lock_journal(descriptor, journalPath);
+
+    off_t journalSize = lseek(descriptor, 0, SEEK_END);
+    char lastCharacter = '\n';
+    if (journalSize > 0 && pread(descriptor, &lastCharacter, 1, journalSize - 1) != 1) {
+        lastCharacter = '\0';
+    }
+
+    // a torn last record is terminated, so that it stays a (malformed, hence skipped) line of its own
+    bool journalUsable = journalSize == 0 ? journal->Append(ctx, LOCK_JOURNAL_HEADER) :
+        lastCharacter == '\n' || journal->Append(ctx, "");
+    if (!journalUsable) {
+        delete journal;
+        return nullptr;
+    }
+
+    return journal;
+}
+
+
+// Closes the journal of this run, if any, and removes the journal file; called once the lock has been written.
+bool FinishLockJournal(application_context& ctx, const string& lockFilePath) {
+    delete ctx.journal;
+    ctx.journal = nullptr;
+
+    string journalPath = GetLockJournalPath(lockFilePath);
+
+    std::error_code removalError;
+    fs::remove(journalPath, removalError);
+    if (removalError) {
+        ctx.applicationLogger->warn("Could not remove lock journal \"{}\": {}", journalPath, removalError.message());
+        return false;
+    }
+
+    return true;
+}
+
+
+/***************************************************
+ * Replay
+ ***************************************************/
+
+
+// Applies the records of a leftover journal to `lockEntries` (as read from the lock file): resolutions replace or
+// add entries, deletions remove them (unless the entry has been resolved to another path since).
+bool ReplayLockJournal(application_context& ctx, const string& lockFilePath, vector<dependency>& lockEntries) {
+    string journalPath = GetLockJournalPath(lockFilePath);
+    if (!utils::FileExists(journalPath)) {
+        return true;
+    }
+
+    ifstream journalStream(journalPath, ios::binary);
+    ostringstream journalBuffer;
+    journalBuffer << journalStream.rdbuf();
+    string journalContents = journalBuffer.str();
+    if (journalContents.empty()) {
+        return true;
+    }
+
+    string_view remaining(journalContents);
+    remaining = remaining.substr(0, remaining.rfind('\n') + 1);  // drops a torn last record
+
+    size_t headerEnd = remaining.find('\n');
+    if (headerEnd == string_view::npos || remaining.substr(0, headerEnd) != LOCK_JOURNAL_HEADER) {
+        ctx.userLogger->warn("Ignoring lock journal \"{}\" of unknown format", journalPath);
+        return false;
+    }
+    remaining.remove_prefix(headerEnd + 1);
+
+    unordered_map<string, size_t> entryIndexByName;
+    for (size_t i = 0; i < lockEntries.size(); i++) {
+        entryIndexByName[lockEntries[i].name] = i;
+    }
+
+    size_t replayedRecords = 0;
+    while (!remaining.empty()) {
+        size_t recordEnd = remaining.find('\n');
+        vector<string> fields = SplitJournalRecord(remaining.substr(0, recordEnd));
+        remaining.remove_prefix(recordEnd + 1);
+
+        if (fields.size() >= 5 && (fields.size() - 5) % 3 == 0 && fields[0] == "+") {
+            auto match = entryIndexByName.find(fields[1]);
+            if (match == entryIndexByName.end()) {
+                match = entryIndexByName.emplace(fields[1], lockEntries.size()).first;
+                lockEntries.emplace_back().name = fields[1];
+            }
+
+            lock_dependency& lockDependency = lockEntries[match->second].lockDependency;
+            lockDependency.resolvedVersion = move(fields[2]);
+            lockDependency.resolvedSource = move(fields[3]);
+            lockDependency.localPath = move(fields[4]);
+
+            lockDependency.submodules.clear();
+            for (size_t i = 5; i < fields.size(); i += 3) {
+                lockDependency.submodules.push_back({ move(fields[i]), move(fields[i + 2]), move(fields[i + 1]) });
+            }
+        } else if (fields.size() == 3 && fields[0] == "-") {
+            auto match = entryIndexByName.find(fields[1]);
+            if (match != entryIndexByName.end() && lockEntries[match->second].lockDependency.localPath == fields[2]) {
+                // emptied now, dropped below, so that the indices of the other entries stay valid meanwhile
+                lockEntries[match->second].name.clear();
+                entryIndexByName.erase(match);
+            }
+        } else {
+            if (!(fields.size() == 1 && fields[0].empty())) {
+                ctx.applicationLogger->warn("Skipping malformed record in lock journal \"{}\"", journalPath);
+            }
+            continue;
+        }
+
+        replayedRecords++;
+    }
+
+    lockEntries.erase(remove_if(lockEntries.begin(), lockEntries.end(), [](dependency& entry) {
+        return entry.name.empty();
+    }), lockEntries.end());
+
+    if (replayedRecords) {
+        ctx.userLogger->info("Resuming an interrupted update, replayed {} journaled lock updates", replayedRecords);
+    }
+
+    return true;
+}
@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+#include "file_lock.hpp"
+#include "lock_registry.hpp"
+#include "utils.hpp"
+
+
+namespace fs = std::filesystem;
+
+
+string GetLockRegistryPath() {
+    return utils::GetLdhHomeDirectory() + "/registry";
+}
+
+
+// Changes to the registry read it, and write it back, so they are serialized (across processes) by this lock.
+bool LockRegistry(application_context& ctx, file_lock& registryLock) {
+    return registryLock.Acquire(ctx, GetFileLockPath(utils::GetLdhHomeDirectory(), "registry"),
+                                file_lock_mode::FILE_LOCK_EXCLUSIVE);
+}
+
+
+vector<registered_lock> ReadLockRegistry(application_context& ctx) {
+    vector<registered_lock> result;
+
+    string registryPath = GetLockRegistryPath();
+    if (!utils::FileExists(registryPath)) {
+        return result;
+    }
+
+    ifstream registryStream(registryPath);
+    string line;
+    while (getline(registryStream, line)) {
+        // entry format: `<lock file path>\t<project root>`, both absolute
+        size_t separatorIndex = line.find('\t');
+        if (separatorIndex == string::npos) {
+            ctx.applicationLogger->warn("Ignoring malformed lock registry entry \"{}\"", line);
+            continue;
+        }
+
+        result.push_back({line.substr(0, separatorIndex), line.substr(separatorIndex + 1)});
+    }
+
+    return result;
+}
+
+
+bool WriteLockRegistry(application_context& ctx, vector<registered_lock>& entries) {
+    if (!utils::MakeDirs(ctx, utils::GetLdhHomeDirectory(), utils::directory_creation_mode::IGNORE_IF_EXISTS)) {
+        return false;
+    }
+
+    // written under a temporary name and renamed, so that readers (which do not take the lock) never see a
+    // partially written registry
+    string registryPath = GetLockRegistryPath();
+    ostringstream temporaryPathStream;
+    temporaryPathStream << registryPath << ".tmp." << getpid();
+    string temporaryPath = temporaryPathStream.str();
+
+    {
+        ofstream registryStream(temporaryPath, ios::trunc);
+        for (registered_lock& entry : entries) {
+            registryStream << entry.lockFilePath << '\t' << entry.projectRoot << '\n';
+        }
+        registryStream.close();
+
+        if (!registryStream) {
+            ctx.userLogger->error("Failed while writing lock registry \"{}\"", temporaryPath);
+
+            std::error_code removalError;
+            fs::remove(temporaryPath, removalError);
+
+            return false;
+        }
+    }
+
+    std::error_code renameError;
+    fs::rename(temporaryPath, registryPath, renameError);
+    if (renameError) {
+        ctx.userLogger->error("Failed while replacing lock registry \"{}\": {}", registryPath, renameError.message());
+        fs::remove(temporaryPath, renameError);
+
+        return false;
+    }
+
+    return true;
+}
+
+
+bool RegisterLockFile(application_context& ctx, string& lockFilePath) {
+    std::error_code pathError;
+    string absoluteLockFilePath = fs::weakly_canonical(fs::absolute(lockFilePath), pathError).string();
+    string projectRoot = ctx.projectRoot.empty() ? fs::current_path(pathError).string() : ctx.projectRoot;
+
+    if (pathError) {
+        ctx.applicationLogger->warn("Could not register lock file \"{}\": {}", lockFilePath, pathError.message());
+        return false;
+    }
+
+    file_lock registryLock;
+    if (!utils::MakeDirs(ctx, utils::GetLdhHomeDirectory(), utils::directory_creation_mode::IGNORE_IF_EXISTS) ||
+            !LockRegistry(ctx, registryLock)) {
+        return false;
+    }
+
+    vector<registered_lock> entries = ReadLockRegistry(ctx);
+    for (registered_lock& entry : entries) {
+        if (entry.lockFilePath == absoluteLockFilePath && entry.projectRoot == projectRoot) {
+            return true;
+        }
+    }
+
+    ctx.applicationLogger->debug("Registering lock file \"{}\" (root \"{}\")", absoluteLockFilePath, projectRoot);
+
+    entries.push_back({absoluteLockFilePath, projectRoot});
+    return WriteLockRegistry(ctx, entries);
+}
+
+
+// Drops `staleEntries` from the registry, keeping whatever was registered since it was read.
+bool UnregisterLockFiles(application_context& ctx, vector<registered_lock>& staleEntries) {
+    file_lock registryLock;
+    if (!LockRegistry(ctx, registryLock)) {
+        return false;
+    }
+
+    vector<registered_lock> entries = ReadLockRegistry(ctx);
+    entries.erase(remove_if(entries.begin(), entries.end(), [&staleEntries](registered_lock& entry) {
+        return find_if(staleEntries.begin(), staleEntries.end(), [&entry](registered_lock& staleEntry) {
+            return staleEntry.lockFilePath == entry.lockFilePath && staleEntry.projectRoot == entry.projectRoot;
+        }) != staleEntries.end();
+    }), entries.end());
+
+    return WriteLockRegistry(ctx, entries);
+}
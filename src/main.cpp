@@ -1,10 +1,28 @@
 #include <iostream>
 
 #include "application_context.hpp"
+#include "build_stamps.cpp"
+#include "bundle.cpp"
 #include "command_line.cpp"
 #include "configuration_io.cpp"
 #include "dependency_resolver.cpp"
+#include "file_lock.cpp"
+#include "garbage_collector.cpp"
+#include "lock_journal.cpp"
+#include "lock_registry.cpp"
 #include "logger_manager.hpp"
+#include "manifest_cache.cpp"
+#include "plan.cpp"
+#include "progress_reporter.cpp"
+#include "resolution_scheduler.cpp"
+#include "run_metrics.cpp"
+#include "update.cpp"
+#include "url_rewrite.cpp"
+#include "validation.cpp"
+#include "workspace.cpp"
+
+
+const chrono::milliseconds PROGRESS_RENDER_INTERVAL = chrono::milliseconds(1000);
 
 
 void PrintUsageString(application_context& ctx) {
@@ -17,18 +35,84 @@ void PrintManPage(application_context& ctx) {
 }
 
 
-string GenerateLockFilePath(string configurationFilePath) {  // FIXME move somewhere else
-    string sourceString = configurationFilePath;
-    size_t substringIndex = 0;
-    size_t lastIndex = 0;
+int RunMode(application_context* ctx) {
+    if (ctx->args->currentMode == mode::MODE_VALIDATE) {
+        phase_timer validateTimer(ctx->metrics, "validate");
+        return ValidateManifests(*ctx, ctx->args->validationPaths) ? 0 : 1;
+    }
+
+    if (ctx->args->currentMode == mode::MODE_GC) {
+        phase_timer gcTimer(ctx->metrics, "gc");
+        return CollectGarbage(*ctx, ctx->args->dryRun) ? 0 : 1;
+    }
+
+    if (ctx->args->currentMode == mode::MODE_BUNDLE_EXPORT || ctx->args->currentMode == mode::MODE_BUNDLE_IMPORT) {
+        if (ctx->args->lockFilePath.empty()) {
+            ctx->args->lockFilePath = "ldh.lock";
+        }
+
+        phase_timer bundleTimer(ctx->metrics, ModeToString(ctx->args->currentMode));
+        bool bundleSuccessful = ctx->args->currentMode == mode::MODE_BUNDLE_EXPORT ?
+            ExportBundle(*ctx, ctx->args->bundleFilePath, ctx->args->lockFilePath, ctx->args->gitOnly) :
+            ImportBundle(*ctx, ctx->args->bundleFilePath, ctx->args->lockFilePath);
+
+        return bundleSuccessful ? 0 : 1;
+    }
+
+    bool resolves = ctx->args->currentMode == mode::MODE_UPDATE || ctx->args->currentMode == mode::MODE_WORKSPACE ||
+        ctx->args->currentMode == mode::MODE_FETCH;
+    if (resolves && !ctx->args->noProgress) {
+        ctx->progress = new progress_reporter(ctx->userLogger, PROGRESS_RENDER_INTERVAL);
+    }
+
+    if (resolves) {
+        uintmax_t memoryBudget = 0;
+        string memoryBudgetSetting = GetMemoryBudgetSetting(ctx->args->memoryBudget);
+        if (!memoryBudgetSetting.empty() && !utils::ParseByteCount(memoryBudgetSetting, memoryBudget)) {
+            ctx->userLogger->error("Invalid memory budget \"{}\", expected a size like 512M or 2G",
+                                   memoryBudgetSetting);
+            return 1;
+        }
+
+        ctx->scheduler = new resolution_scheduler(ctx->args->transfersPerHost, ctx->args->diskJobs, memoryBudget);
+
+        if (!LoadUrlRewriter(*ctx)) {
+            return 1;
+        }
+    }
+
+    if (ctx->args->currentMode == mode::MODE_WORKSPACE) {
+        return UpdateWorkspace(*ctx, ctx->args->configurationFilePath) ? 0 : 1;
+    }
 
-    // locate index of last backslash
-    // NOTE this is platform dependent.
-    while ((substringIndex = sourceString.find('/', substringIndex)) != string::npos) {
-        lastIndex = substringIndex++;
+    if (ctx->args->lockFilePath.empty()) {
+        ctx->args->lockFilePath = GenerateLockFilePath(ctx->args->configurationFilePath);
     }
 
-    return sourceString.replace(sourceString.begin() + lastIndex, sourceString.end(), "/ldh.lock");
+    configuration_modes mode = configuration_modes::CONFIGURATION_MODE_INPUT |
+        configuration_modes::CONFIGURATION_MODE_OUTPUT;
+
+    configuration config;
+    {
+        phase_timer parseTimer(ctx->metrics, "parse");
+        if (!ParseAndCheckConfiguration(*ctx, ctx->args->configurationFilePath, mode, config)) {
+            return 1;
+        }
+    }
+
+    if (ctx->args->currentMode == mode::MODE_FETCH) {
+        phase_timer fetchTimer(ctx->metrics, "fetch");
+        return PrefetchDependencies(*ctx, config.dependencies) ? 0 : 1;
+    }
+
+    if (ctx->args->currentMode == mode::MODE_PLAN) {
+        phase_timer planTimer(ctx->metrics, "plan");
+        vector<planned_action> plan = PlanDependencies(*ctx, config.dependencies);
+        return PrintPlan(*ctx, plan);
+    }
+
+    ctx->applicationLogger->info("will resolve");
+    return UpdateProject(*ctx, config) ? 0 : 1;
 }
 
 
@@ -50,30 +134,16 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
-    if (ctx->args->lockFilePath.empty()) {
-        ctx->args->lockFilePath = GenerateLockFilePath(ctx->args->configurationFilePath);
+    string metricsFilePath = GetMetricsOutputPath(ctx->args->metricsFilePath);
+    if (!metricsFilePath.empty()) {
+        ctx->metrics = new run_metrics(metricsFilePath);
     }
 
-    configuration_modes mode = configuration_modes::CONFIGURATION_MODE_INPUT | (
-            ctx->args->currentMode == mode::MODE_VALIDATE ? configuration_modes::CONFIGURATION_MODE_NONE : configuration_modes::CONFIGURATION_MODE_OUTPUT );
+    int exitCode = RunMode(ctx);
 
-    configuration* config = ParseAndCheckConfiguration(*ctx, ctx->args->configurationFilePath, mode);
-    assert(config);
-
-    if (ctx->args->currentMode == mode::MODE_VALIDATE) {
-        return 0;
-    }
-
-    ctx->applicationLogger->info("will resolve");
-    // vector<dependency*>* dependenciesToResolve = FilterUnmodified(*ctx, config->dependencies);
-    vector<dependency*>* dependenciesToResolve = &config->dependencies;
-    ResolveDependencies(*ctx, *dependenciesToResolve);
-
-    if (!WriteConfiguration(*ctx, ctx->args->lockFilePath, config)) {
-        ctx->applicationLogger->error("Failed while writing lock file to \"{}\"", ctx->args->lockFilePath);
-
-        return 1;
+    if (ctx->metrics) {
+        WriteRunMetrics(*ctx, exitCode);
     }
 
-    return 0;
+    return exitCode;
 }
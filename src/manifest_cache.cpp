@@ -0,0 +1,241 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+#include "manifest_cache.hpp"
+#include "sha256.hpp"
+#include "utils.hpp"
+
+
+namespace fs = std::filesystem;
+
+
+const char MANIFEST_CACHE_MAGIC[4] = {'L', 'D', 'H', 'M'};
+
+
+/***************************************************
+ * Binary encoding
+ ***************************************************/
+
+
+void WriteU32(string& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back((char) ((value >> (8 * i)) & 0xff));
+    }
+}
+
+
+void WriteString(string& out, const string& value) {
+    WriteU32(out, (uint32_t) value.size());
+    out.append(value);
+}
+
+
+struct binary_reader {
+    const char* cursor;
+    const char* end;
+
+    bool ReadU32(uint32_t& value) {
+        if (this->end - this->cursor < 4) {
+            return false;
+        }
+
+        value = 0;
+        for (int i = 0; i < 4; i++) {
+            value |= (uint32_t) (uint8_t) this->cursor[i] << (8 * i);
+        }
+        this->cursor += 4;
+
+        return true;
+    }
+
+    bool ReadString(string& value) {
+        uint32_t length;
+        if (!this->ReadU32(length) || (size_t) (this->end - this->cursor) < length) {
+            return false;
+        }
+
+        value.assign(this->cursor, length);
+        this->cursor += length;
+
+        return true;
+    }
+
+    template <typename E>
+    bool ReadEnum(E& value, E upperBound) {
+        uint32_t rawValue;
+        if (!this->ReadU32(rawValue) || rawValue >= (uint32_t) upperBound) {
+            return false;
+        }
+
+        value = (E) rawValue;
+        return true;
+    }
+};
+
+
+string SerializeConfiguration(configuration& config) {
+    string out;
+    out.append(MANIFEST_CACHE_MAGIC, sizeof(MANIFEST_CACHE_MAGIC));
+    WriteU32(out, MANIFEST_CACHE_FORMAT_VERSION);
+
+    WriteString(out, config.packageInformation.name);
+    WriteString(out, config.packageInformation.version);
+    WriteU32(out, (uint32_t) config.packageInformation.authors.size());
+    for (string& author : config.packageInformation.authors) {
+        WriteString(out, author);
+    }
+
+    WriteU32(out, (uint32_t) config.dependencies.size());
+    for (dependency& dep : config.dependencies) {
+        input_dependency& input = dep.inputDependency;
+
+        WriteString(out, dep.name);
+        WriteU32(out, (uint32_t) input.sourceType);
+        WriteString(out, input.source);
+        WriteU32(out, (uint32_t) input.specifiedVersion.type);
+        WriteString(out, input.specifiedVersion.exact);
+        WriteString(out, input.specifiedVersion.versionRange);
+        WriteU32(out, input.submodules ? 1 : 0);
+    }
+
+    return out;
+}
+
+
+bool DeserializeConfiguration(const string& serialized, configuration& config) {
+    binary_reader reader = { serialized.data(), serialized.data() + serialized.size() };
+
+    if (serialized.compare(0, sizeof(MANIFEST_CACHE_MAGIC), MANIFEST_CACHE_MAGIC, sizeof(MANIFEST_CACHE_MAGIC))) {
+        return false;
+    }
+    reader.cursor += sizeof(MANIFEST_CACHE_MAGIC);
+
+    uint32_t formatVersion;
+    if (!reader.ReadU32(formatVersion) || formatVersion != MANIFEST_CACHE_FORMAT_VERSION) {
+        return false;
+    }
+
+    uint32_t authorCount;
+    if (!reader.ReadString(config.packageInformation.name) || !reader.ReadString(config.packageInformation.version) ||
+            !reader.ReadU32(authorCount)) {
+        return false;
+    }
+
+    config.packageInformation.authors.resize(authorCount);
+    for (string& author : config.packageInformation.authors) {
+        if (!reader.ReadString(author)) {
+            return false;
+        }
+    }
+
+    uint32_t dependencyCount;
+    if (!reader.ReadU32(dependencyCount)) {
+        return false;
+    }
+
+    config.dependencies.resize(dependencyCount);
+    for (dependency& dep : config.dependencies) {
+        input_dependency& input = dep.inputDependency;
+
+        bool entryRead = reader.ReadString(dep.name) &&
+            reader.ReadEnum(input.sourceType, source_type::SOURCE_TYPE_COUNT) &&
+            reader.ReadString(input.source) &&
+            reader.ReadEnum(input.specifiedVersion.type, version_type::VERSION_TYPE_COUNT) &&
+            reader.ReadString(input.specifiedVersion.exact) &&
+            reader.ReadString(input.specifiedVersion.versionRange);
+
+        uint32_t submodules;
+        if (!entryRead || !reader.ReadU32(submodules)) {
+            return false;
+        }
+        input.submodules = submodules != 0;
+    }
+
+    return reader.cursor == reader.end;
+}
+
+
+/***************************************************
+ * Cache
+ ***************************************************/
+
+
+string GetManifestCacheDirectory() {
+    return utils::GetLdhHomeDirectory() + "/cache/manifests";
+}
+
+
+string ManifestCacheKey(const string& manifestContents) {
+    sha256 hasher;
+    hasher.Update(LDH_VERSION);
+    hasher.Update("\0", 1);
+
+    uint32_t formatVersion = MANIFEST_CACHE_FORMAT_VERSION;
+    hasher.Update(&formatVersion, sizeof(formatVersion));
+    hasher.Update(manifestContents);
+
+    return sha256::ToHex(hasher.Finalize());
+}
+
+
+bool LoadCachedConfiguration(application_context& ctx, const string& cacheKey, configuration& config) {
+    string entryPath = GetManifestCacheDirectory() + "/" + cacheKey;
+
+    ifstream entryStream(entryPath, ios::binary);
+    if (!entryStream) {
+        return false;
+    }
+
+    ostringstream entryContents;
+    entryContents << entryStream.rdbuf();
+
+    configuration cachedConfig;
+    if (!DeserializeConfiguration(entryContents.str(), cachedConfig)) {
+        ctx.applicationLogger->warn("Ignoring corrupt manifest cache entry \"{}\"", entryPath);
+        return false;
+    }
+
+    config = move(cachedConfig);
+    return true;
+}
+
+
+bool StoreCachedConfiguration(application_context& ctx, const string& cacheKey, configuration& config) {
+    string cacheDirectory = GetManifestCacheDirectory();
+    if (!utils::MakeDirs(ctx, cacheDirectory, utils::directory_creation_mode::IGNORE_IF_EXISTS)) {
+        return false;
+    }
+
+    // written under a temporary name and renamed, so that concurrent readers never see a partial entry. The
+    // name includes the thread id, since workspace members are parsed (and cached) concurrently.
+    string entryPath = cacheDirectory + "/" + cacheKey;
+    ostringstream temporaryPathStream;
+    temporaryPathStream << entryPath << ".tmp." << getpid() << "." << this_thread::get_id();
+    string temporaryPath = temporaryPathStream.str();
+
+    {
+        ofstream entryStream(temporaryPath, ios::binary | ios::trunc);
+        string serialized = SerializeConfiguration(config);
+        entryStream.write(serialized.data(), serialized.size());
+
+        if (!entryStream) {
+            ctx.applicationLogger->warn("Failed while writing manifest cache entry \"{}\"", temporaryPath);
+            return false;
+        }
+    }
+
+    std::error_code renameError;
+    fs::rename(temporaryPath, entryPath, renameError);
+    if (renameError) {
+        ctx.applicationLogger->warn("Failed while storing manifest cache entry \"{}\": {}", entryPath,
+                                    renameError.message());
+        fs::remove(temporaryPath, renameError);
+
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,160 @@
+#include <iomanip>
+#include <iostream>
+
+#include "archive_lib.hpp"
+#include "dependency_resolver.hpp"
+#include "git_lib.hpp"
+#include "plan.hpp"
+#include "utils.hpp"
+
+
+// Mirrors the decisions `ResolveArchiveDependency` makes for `dep`.
+planned_action PlanArchiveDependency(application_context& ctx, dependency& dep, planned_action plan) {
+    string& checksum = dep.inputDependency.specifiedVersion.exact;
+    plan.path = ctx.DependencyPathPrefix() + dep.name + "-" + checksum;
+
+    if (!utils::DirectoryExists(plan.path)) {
+        if (IsArchiveCached(checksum)) {
+            plan.action = plan_action::PLAN_ACTION_CHECKOUT;
+            plan.reason = "extract cached archive";
+        } else {
+            plan.action = plan_action::PLAN_ACTION_FETCH;
+            plan.reason = "download archive";
+        }
+
+        // unlike git fetches, extractions cannot be picked up where they were left: they start over
+        if (utils::DirectoryExists(plan.path + STAGING_DIRECTORY_SUFFIX)) {
+            plan.reason += ", discarding interrupted extraction in " + plan.path + STAGING_DIRECTORY_SUFFIX;
+        }
+
+        return plan;
+    }
+
+    lock_dependency& lockDependency = dep.lockDependency;
+    if (lockDependency.localPath != plan.path || lockDependency.resolvedVersion != checksum) {
+        plan.action = plan_action::PLAN_ACTION_LOCK;
+        plan.reason = lockDependency.HasValue() ? "lock entry out of date" : "not in the lock file";
+    }
+
+    return plan;
+}
+
+
+// Mirrors the decisions `ResolveGitDependency` and `ResolveDependencies` make for `dep`.
+planned_action PlanDependency(application_context& ctx, dependency& dep) {
+    planned_action plan = { plan_action::PLAN_ACTION_NONE, dep.name, dep.lockDependency.localPath, "" };
+
+    if (!dep.inputDependency.HasValue()) {
+        bool presentOnDisk = utils::DirectoryExists(plan.path);
+
+        plan.action = presentOnDisk ? plan_action::PLAN_ACTION_DELETE : plan_action::PLAN_ACTION_PRUNE;
+        plan.reason = presentOnDisk ? "removed from the manifest" : "removed from the manifest, already gone from disk";
+        return plan;
+    }
+
+    if (dep.inputDependency.sourceType == source_type::SOURCE_TYPE_ARCHIVE) {
+        return PlanArchiveDependency(ctx, dep, plan);
+    }
+
+    version_t& requestedVersion = dep.inputDependency.specifiedVersion;
+    string lockedTag = GetLockedSemVerTag(dep);
+
+    if (requestedVersion.type == version_type::VERSION_TYPE_SEMVER && lockedTag.empty()) {
+        plan.action = plan_action::PLAN_ACTION_CLONE;
+        plan.path = ctx.DependencyPathPrefix() + dep.name + RANGE_CHECKOUT_SUFFIX;
+        plan.reason = "no locked checkout satisfies \"" + (requestedVersion.Empty() ? requestedVersion.versionRange :
+                                                            requestedVersion.exact) + "\"";
+        return plan;
+    }
+
+    plan.path = lockedTag.empty() ? ctx.DependencyPathPrefix() + dep.name + "-" + requestedVersion.exact :
+        dep.lockDependency.localPath;
+
+    if (!utils::DirectoryExists(plan.path)) {
+        if (utils::DirectoryExists(plan.path + STAGING_DIRECTORY_SUFFIX)) {
+            plan.action = plan_action::PLAN_ACTION_RESUME;
+            plan.reason = "interrupted fetch in " + plan.path + STAGING_DIRECTORY_SUFFIX;
+        } else if (requestedVersion.type == version_type::VERSION_TYPE_COMMIT_HASH) {
+            bool commitAvailable = HasCommitLocally(ctx, dep.inputDependency.source, plan.path, requestedVersion.exact);
+
+            plan.action = commitAvailable ? plan_action::PLAN_ACTION_CHECKOUT : plan_action::PLAN_ACTION_FETCH;
+            plan.reason = commitAvailable ? "commit present in another local checkout" : "single commit fetch";
+        } else {
+            plan.action = plan_action::PLAN_ACTION_CLONE;
+            plan.reason = "not on disk";
+        }
+
+        return plan;
+    }
+
+    bool tracksBranch = requestedVersion.type == version_type::VERSION_TYPE_BRANCH ||
+        requestedVersion.type == version_type::VERSION_TYPE_DEFAULT;
+    if (ctx.args->refresh && tracksBranch) {
+        plan.action = plan_action::PLAN_ACTION_FETCH;
+        plan.reason = "refreshing tracked branch";
+        return plan;
+    }
+
+    resolution_result resolutionResult = CreateResolutionResultFromLocalGitRepo(ctx, dep.inputDependency.source,
+                                                                                plan.path, requestedVersion);
+    if (!resolutionResult.resolutionSuccessful) {
+        plan.action = plan_action::PLAN_ACTION_FAIL;
+        plan.reason = "existing checkout is not a usable repository";
+        return plan;
+    }
+
+    lock_dependency& lockDependency = dep.lockDependency;
+    if (lockDependency.localPath != plan.path || lockDependency.resolvedVersion != resolutionResult.version) {
+        plan.action = plan_action::PLAN_ACTION_LOCK;
+        plan.reason = lockDependency.HasValue() ? "lock entry out of date" : "not in the lock file";
+    }
+
+    return plan;
+}
+
+
+vector<planned_action> PlanDependencies(application_context& ctx, vector<dependency>& dependencies) {
+    vector<planned_action> plan;
+    if (!InitializeLibrary(ctx)) {
+        return plan;
+    }
+
+    plan.reserve(dependencies.size());
+    for (dependency& dep : dependencies) {
+        plan.push_back(PlanDependency(ctx, dep));
+    }
+
+    ShutdownLibrary(ctx);
+    return plan;
+}
+
+
+int PrintPlan([[maybe_unused]] application_context& ctx, vector<planned_action>& plan) {
+    size_t actionCounts[(size_t) plan_action::PLAN_ACTION_COUNT] = {};
+
+    for (planned_action& entry : plan) {
+        actionCounts[(size_t) entry.action]++;
+        if (entry.action == plan_action::PLAN_ACTION_NONE) {
+            continue;
+        }
+
+        std::cout << std::left << std::setw(9) << PlanActionToString(entry.action) << entry.name << " (" << entry.path
+                  << "): " << entry.reason << "\n";
+    }
+
+    size_t pendingActions = plan.size() - actionCounts[(size_t) plan_action::PLAN_ACTION_NONE];
+    if (!pendingActions) {
+        std::cout << "Nothing to do, " << plan.size() << " dependencies up to date.\n";
+        return PLAN_EXIT_NOTHING_TO_DO;
+    }
+
+    std::cout << pendingActions << " of " << plan.size() << " dependencies need work:";
+    for (size_t i = 1; i < (size_t) plan_action::PLAN_ACTION_COUNT; i++) {
+        if (actionCounts[i]) {
+            std::cout << " " << actionCounts[i] << " " << PlanActionToString((plan_action) i);
+        }
+    }
+    std::cout << "\n";
+
+    return actionCounts[(size_t) plan_action::PLAN_ACTION_FAIL] ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+#include <algorithm>
+
+#include "progress_reporter.hpp"
+#include "utils.hpp"
+
+
+string FormatEta(double seconds) {
+    if (seconds < 0) {
+        return "?";
+    }
+
+    char buffer[32];
+    unsigned long totalSeconds = (unsigned long) seconds;
+    if (totalSeconds >= 3600) {
+        snprintf(buffer, sizeof(buffer), "%luh%02lum", totalSeconds / 3600, (totalSeconds % 3600) / 60);
+    } else if (totalSeconds >= 60) {
+        snprintf(buffer, sizeof(buffer), "%lum%02lus", totalSeconds / 60, totalSeconds % 60);
+    } else {
+        snprintf(buffer, sizeof(buffer), "%lus", totalSeconds);
+    }
+
+    return string(buffer);
+}
+
+
+transfer_progress* progress_reporter::Begin(string name) {
+    transfer_progress* entry = new transfer_progress(this, name);
+
+    lock_guard<mutex> lock(this->entriesMutex);
+    this->activeEntries.push_back(entry);
+
+    return entry;
+}
+
+
+void progress_reporter::End(transfer_progress* entry, bool successful) {
+    if (!entry) {
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(this->entriesMutex);
+        this->activeEntries.erase(remove(this->activeEntries.begin(), this->activeEntries.end(), entry),
+                                  this->activeEntries.end());
+        this->completedBytes += entry->receivedBytes.load(memory_order_relaxed);
+    }
+
+    size_t receivedBytes = entry->receivedBytes.load(memory_order_relaxed);
+    if (successful && receivedBytes) {
+        double elapsed = chrono::duration<double>(progress_clock::now() - entry->startTime).count();
+        uintmax_t averageRate = (uintmax_t) (elapsed > 0 ? receivedBytes / elapsed : receivedBytes);
+
+        this->logger->info("{}: fetched {} objects ({}) in {:.1f}s, {}/s", entry->name,
+                           entry->receivedObjects.load(memory_order_relaxed), utils::FormatByteCount(receivedBytes),
+                           elapsed, utils::FormatByteCount(averageRate));
+    }
+
+    delete entry;
+}
+
+
+void progress_reporter::Render() {
+    lock_guard<mutex> lock(this->entriesMutex);
+    if (this->activeEntries.empty()) {
+        return;
+    }
+
+    progress_clock::time_point now = progress_clock::now();
+
+    double aggregateRate = 0;
+    size_t aggregateBytes = this->completedBytes;
+
+    for (transfer_progress* entry : this->activeEntries) {
+        size_t receivedBytes = entry->receivedBytes.load(memory_order_relaxed);
+        double sinceLastRender = chrono::duration<double>(now - entry->lastRenderTime).count();
+        double rate = sinceLastRender > 0 ? (receivedBytes - entry->lastRenderedBytes) / sinceLastRender : 0;
+
+        entry->lastRenderedBytes = receivedBytes;
+        entry->lastRenderTime = now;
+
+        aggregateRate += rate;
+        aggregateBytes += receivedBytes;
+
+        size_t totalFiles = entry->totalFiles.load(memory_order_relaxed);
+        if (totalFiles) {
+            this->logger->info("{}: checking out {}/{} files", entry->name,
+                               entry->checkedOutFiles.load(memory_order_relaxed), totalFiles);
+            continue;
+        }
+
+        unsigned int receivedObjects = entry->receivedObjects.load(memory_order_relaxed);
+        unsigned int totalObjects = entry->totalObjects.load(memory_order_relaxed);
+
+        // estimate based on the average object rate so far, which is a lot less jumpy than the byte rate
+        double elapsed = chrono::duration<double>(now - entry->startTime).count();
+        double eta = -1;
+        if (receivedObjects && totalObjects >= receivedObjects && elapsed > 0) {
+            eta = (totalObjects - receivedObjects) / (receivedObjects / elapsed);
+        }
+
+        this->logger->info("{}: {}/{} objects, {} indexed, {} at {}/s, ETA {}", entry->name, receivedObjects,
+                           totalObjects, entry->indexedObjects.load(memory_order_relaxed),
+                           utils::FormatByteCount(receivedBytes), utils::FormatByteCount((uintmax_t) rate),
+                           FormatEta(eta));
+    }
+
+    if (this->activeEntries.size() > 1) {
+        this->logger->info("total: {} transfers, {} at {}/s", this->activeEntries.size(),
+                           utils::FormatByteCount(aggregateBytes), utils::FormatByteCount((uintmax_t) aggregateRate));
+    }
+}
@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include "resolution_scheduler.hpp"
+
+
+// Host part of a remote URL, for both `scheme://[user@]host[:port]/path` and scp-like `[user@]host:path` forms.
+// Hosts may be bracketed (IPv6 addresses, `[::1]:8080`, or git's scp-like `[host:port]:path`), brackets are not
+// part of the result. Local paths have no host, and all share the empty one.
+string GetRemoteHost(const string& remoteUrl) {
+    string authority;
+
+    size_t schemeEnd = remoteUrl.find("://");
+    if (schemeEnd != string::npos) {
+        if (remoteUrl.compare(0, schemeEnd, "file") == 0) {
+            return "";
+        }
+
+        size_t authorityStart = schemeEnd + 3;
+        authority = remoteUrl.substr(authorityStart, remoteUrl.find('/', authorityStart) - authorityStart);
+    } else {
+        // anything with a slash before the first colon (or without a colon at all) is a local path. Colons between
+        // brackets do not count.
+        size_t colonSearchStart = 0;
+        size_t bracketStart = remoteUrl.find('[');
+        if (bracketStart < remoteUrl.find(':') && bracketStart < remoteUrl.find('/')) {
+            size_t bracketEnd = remoteUrl.find(']', bracketStart);
+            colonSearchStart = bracketEnd == string::npos ? 0 : bracketEnd;
+        }
+
+        size_t colonIndex = remoteUrl.find(':', colonSearchStart);
+        if (colonIndex == string::npos || remoteUrl.find('/') < colonIndex) {
+            return "";
+        }
+
+        authority = remoteUrl.substr(0, colonIndex);
+    }
+
+    size_t userEnd = authority.rfind('@');
+    string host = authority.substr(userEnd == string::npos ? 0 : userEnd + 1);
+    if (!host.empty() && host[0] == '[') {
+        host = host.substr(1, host.find(']') - 1);
+    } else {
+        // the end of a bracketed `[user@host:port]`
+        host = host.substr(0, host.find(']'));
+    }
+
+    // IPv6 addresses have at least two colons, a port is preceded by one
+    if (count(host.begin(), host.end(), ':') == 1) {
+        host = host.substr(0, host.find(':'));
+    }
+
+    for (char& c : host) {
+        c = tolower((unsigned char) c);
+    }
+
+    return host;
+}
+
+
+slot_pool* resolution_scheduler::TransferSlots(const string& remoteUrl) {
+    string host = GetRemoteHost(remoteUrl);
+
+    unique_lock<mutex> lock(this->hostsMutex);
+    unique_ptr<slot_pool>& slots = this->hostSlots[host];
+    if (!slots) {
+        slots = make_unique<slot_pool>(this->transfersPerHost);
+    }
+
+    return slots.get();
+}
+
+
+// The command line wins over the environment; an empty result means no budget.
+string GetMemoryBudgetSetting(const string& commandLineValue) {
+    if (!commandLineValue.empty()) {
+        return commandLineValue;
+    }
+
+    const char* environmentValue = getenv("LDH_MEMORY_BUDGET");
+    return environmentValue ? string(environmentValue) : "";
+}
@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "application_context.hpp"
+#include "run_metrics.hpp"
+
+
+namespace fs = std::filesystem;
+
+
+size_t GetPeakResidentSetSize() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage)) {
+        return 0;
+    }
+
+#if defined(__APPLE__)
+    return (size_t) usage.ru_maxrss;  // already in bytes
+#else
+    return (size_t) usage.ru_maxrss * 1024;
+#endif
+}
+
+
+// `--metrics` wins over the environment; an empty result means metrics are off.
+string GetMetricsOutputPath(const string& commandLinePath) {
+    if (!commandLinePath.empty()) {
+        return commandLinePath;
+    }
+
+    const char* environmentPath = getenv("LDH_METRICS_FILE");
+    return environmentPath ? string(environmentPath) : "";
+}
+
+
+struct metric_sample {
+    const char* name;
+    const char* help;
+    string labels;
+    double value;
+};
+
+
+vector<metric_sample> CollectSamples(application_context& ctx, int exitCode) {
+    run_metrics& metrics = *ctx.metrics;
+    string modeLabel = string("mode=\"") + ModeToString(ctx.args->currentMode) + "\"";
+
+    double wallTime = chrono::duration<double>(metrics_clock::now() - metrics.startTime).count();
+    // a dependency found on disk can still fail to resolve afterwards, hence the clamp
+    double alreadyPresent = (double) metrics.dependenciesAlreadyPresent.load(memory_order_relaxed);
+    double fetched = max(0.0, (double) metrics.dependenciesResolved.load(memory_order_relaxed) - alreadyPresent);
+
+    vector<metric_sample> samples = {
+        {"ldh_run_duration_seconds", "Wall time of the run.", modeLabel, wallTime},
+        {"ldh_exit_code", "Exit code of the run.", modeLabel, (double) exitCode},
+        {"ldh_dependencies", "Dependencies handled, by outcome.", modeLabel + ",outcome=\"fetched\"",
+            fetched},
+        {"ldh_dependencies", "Dependencies handled, by outcome.", modeLabel + ",outcome=\"skipped\"",
+            alreadyPresent},
+        {"ldh_dependencies", "Dependencies handled, by outcome.", modeLabel + ",outcome=\"failed\"",
+            (double) metrics.dependenciesFailed.load(memory_order_relaxed)},
+        {"ldh_dependencies", "Dependencies handled, by outcome.", modeLabel + ",outcome=\"deleted\"",
+            (double) metrics.dependenciesDeleted.load(memory_order_relaxed)},
+        {"ldh_fetches", "Fetches from remotes.", modeLabel, (double) metrics.fetches.load(memory_order_relaxed)},
+        {"ldh_fetched_bytes", "Bytes received from remotes.", modeLabel,
+            (double) metrics.fetchedBytes.load(memory_order_relaxed)},
+        {"ldh_fetched_objects", "Objects received from remotes.", modeLabel,
+            (double) metrics.fetchedObjects.load(memory_order_relaxed)},
+        {"ldh_checked_out_files", "Files written by checkouts.", modeLabel,
+            (double) metrics.checkedOutFiles.load(memory_order_relaxed)},
+        {"ldh_tag_scans", "Version range matches against a repository's tags.", modeLabel,
+            (double) metrics.tagScans.load(memory_order_relaxed)},
+        {"ldh_tags_scanned", "Tags compared while matching version ranges.", modeLabel,
+            (double) metrics.tagsScanned.load(memory_order_relaxed)},
+        {"ldh_peak_rss_bytes", "Peak resident set size.", modeLabel, (double) GetPeakResidentSetSize()},
+    };
+
+    for (auto& [phase, duration] : metrics.phaseDurations) {
+        samples.push_back({"ldh_phase_duration_seconds", "Wall time per phase of the run.",
+                           modeLabel + ",phase=\"" + phase + "\"", duration});
+    }
+
+    return samples;
+}
+
+
+// Counts (bytes, objects, ...) are written as integers, anything else with as many digits as it takes to read back
+// the same value. JSON has no way to write non-finite values, which turn into `null` there.
+string FormatSampleValue(double value, bool json) {
+    if (!isfinite(value)) {
+        if (json) {
+            return "null";
+        }
+
+        return isnan(value) ? "NaN" : value > 0 ? "+Inf" : "-Inf";
+    }
+
+    // integers up to 2^53 are exact in a double
+    if (value == trunc(value) && fabs(value) <= 9007199254740992.0) {
+        return to_string((long long) value);
+    }
+
+    ostringstream out;
+    out << setprecision(numeric_limits<double>::max_digits10) << value;
+
+    return out.str();
+}
+
+
+string FormatPrometheus(vector<metric_sample>& samples) {
+    ostringstream out;
+
+    const char* previousName = "";
+    for (metric_sample& sample : samples) {
+        if (strcmp(sample.name, previousName)) {
+            out << "# HELP " << sample.name << " " << sample.help << "\n";
+            out << "# TYPE " << sample.name << " gauge\n";
+            previousName = sample.name;
+        }
+
+        out << sample.name << "{" << sample.labels << "} " << FormatSampleValue(sample.value, false) << "\n";
+    }
+
+    return out.str();
+}
+
+
+string FormatJson(application_context& ctx, vector<metric_sample>& samples) {
+    ostringstream out;
+    out << "{\"version\":\"" << LDH_VERSION << "\",\"mode\":\"" << ModeToString(ctx.args->currentMode) << "\"";
+
+    // labels other than `mode` become part of the key, e.g. `ldh_dependencies{outcome="fetched"}` turns into
+    // `"ldh_dependencies_fetched"`.
+    for (metric_sample& sample : samples) {
+        string key = sample.name;
+
+        size_t labelStart = sample.labels.find(',');
+        if (labelStart != string::npos) {
+            size_t valueStart = sample.labels.find('"', labelStart) + 1;
+            key += "_" + sample.labels.substr(valueStart, sample.labels.size() - valueStart - 1);
+        }
+
+        out << ",\"" << key << "\":" << FormatSampleValue(sample.value, true);
+    }
+    out << "}\n";
+
+    return out.str();
+}
+
+
+bool WriteRunMetrics(application_context& ctx, int exitCode) {
+    string& outputPath = ctx.metrics->outputPath;
+    vector<metric_sample> samples = CollectSamples(ctx, exitCode);
+
+    bool prometheusFormat = fs::path(outputPath).extension() == ".prom";
+    string serialized = prometheusFormat ? FormatPrometheus(samples) : FormatJson(ctx, samples);
+
+    // renamed into place, so that collectors never pick up a partially written file
+    string temporaryPath = outputPath + ".tmp." + to_string(getpid());
+    {
+        ofstream outputStream(temporaryPath, ios::trunc);
+        outputStream << serialized;
+
+        if (!outputStream) {
+            ctx.applicationLogger->warn("Failed while writing metrics to \"{}\"", temporaryPath);
+            return false;
+        }
+    }
+
+    std::error_code renameError;
+    fs::rename(temporaryPath, outputPath, renameError);
+    if (renameError) {
+        ctx.applicationLogger->warn("Failed while writing metrics to \"{}\": {}", outputPath, renameError.message());
+        fs::remove(temporaryPath, renameError);
+
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,56 @@
+#include "build_stamps.hpp"
+#include "dependency_resolver.hpp"
+#include "file_lock.hpp"
+#include "lock_journal.hpp"
+#include "lock_registry.hpp"
+#include "update.hpp"
+
+
+bool UpdateProject(application_context& ctx, configuration& config) {
+    string& lockFilePath = ctx.args->lockFilePath;
+
+    // keeps `ldh gc` away from checkouts until the lock file referring to them is registered
+    file_lock projectLock;
+    if (!LockProject(ctx, projectLock, file_lock_mode::FILE_LOCK_SHARED)) {
+        return false;
+    }
+
+    ctx.journal = OpenLockJournal(ctx, lockFilePath);
+    {
+        phase_timer resolveTimer(ctx.metrics, "resolve");
+        ResolveDependencies(ctx, config.dependencies);
+    }
+
+    // even a cancelled run writes the lock, as what did get resolved is on disk now
+    phase_timer writeLockTimer(ctx.metrics, "write_lock");
+    if (!WriteConfiguration(ctx, lockFilePath, config)) {
+        ctx.applicationLogger->error("Failed while writing lock file to \"{}\"", lockFilePath);
+
+        // the journal stays, for the next run to replay
+        delete ctx.journal;
+        ctx.journal = nullptr;
+
+        return false;
+    }
+
+    // the lock now holds everything the journal did
+    FinishLockJournal(ctx, lockFilePath);
+
+    // so that `ldh gc` knows this project's dependencies are still in use.
+    RegisterLockFile(ctx, lockFilePath);
+    projectLock.Release();
+
+    if (!WriteBuildStamps(ctx, lockFilePath, config.dependencies)) {
+        ctx.userLogger->error("Failed while writing dependency stamps for \"{}\"", lockFilePath);
+
+        return false;
+    }
+
+    if (ctx.Cancelled()) {
+        ctx.userLogger->warn("Update of \"{}\" was cancelled, some dependencies were not resolved", lockFilePath);
+
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,88 @@
+#include "configuration_io.hpp"
+#include "url_rewrite.hpp"
+#include "utils.hpp"
+
+
+void url_rewriter::AddRule(url_rewrite_rule rule) {
+    this->rules.push_back(move(rule));
+}
+
+
+vector<string> url_rewriter::MirrorsOf(const string& remoteUrl) const {
+    size_t longestPrefix = 0;
+    for (const url_rewrite_rule& rule : this->rules) {
+        if (rule.prefix.size() > longestPrefix && remoteUrl.compare(0, rule.prefix.size(), rule.prefix) == 0) {
+            longestPrefix = rule.prefix.size();
+        }
+    }
+
+    vector<string> result;
+    if (!longestPrefix) {
+        return result;
+    }
+
+    for (const url_rewrite_rule& rule : this->rules) {
+        if (rule.prefix.size() == longestPrefix && remoteUrl.compare(0, rule.prefix.size(), rule.prefix) == 0) {
+            result.push_back(rule.replacement + remoteUrl.substr(longestPrefix));
+        }
+    }
+
+    return result;
+}
+
+
+string GetMirrorConfigurationPath() {
+    return utils::GetLdhHomeDirectory() + "/" + MIRROR_CONFIGURATION_FILE_NAME;
+}
+
+
+// Sets `ctx.mirrors` up from the user's mirror configuration. Not having one is fine, having a broken one is not:
+// silently fetching everything from the canonical remotes is exactly what the configuration is meant to prevent.
+bool LoadUrlRewriter(application_context& ctx) {
+    string configurationPath = GetMirrorConfigurationPath();
+    if (!utils::FileExists(configurationPath)) {
+        return true;
+    }
+
+    url_rewriter* rewriter = new url_rewriter();
+    try {
+        dict_like_config mirrorsDict = toml::parse_file(configurationPath);
+
+        toml::array* mirrors = mirrorsDict["mirror"].as_array();
+        if (mirrors) {
+            for (auto&& entry : *mirrors) {
+                auto tbl = entry.as_table();
+                string url = tbl ? (*tbl)["url"].value_or("") : "";
+                string insteadOf = tbl ? (*tbl)["instead_of"].value_or("") : "";
+                if (url.empty() || insteadOf.empty()) {
+                    ctx.userLogger->error("Every mirror in \"{}\" needs both `url` and `instead_of`",
+                                          configurationPath);
+                    delete rewriter;
+                    return false;
+                }
+
+                rewriter->AddRule({insteadOf, url});
+            }
+        }
+    } catch (const toml::parse_error& parseError) {
+        ctx.userLogger->error("Failed while parsing mirror configuration \"{}\"", configurationPath);
+        ctx.userLogger->error("Reason: {}", parseError.description());
+        delete rewriter;
+        return false;
+    }
+
+    if (rewriter->Empty()) {
+        delete rewriter;
+        return true;
+    }
+
+    SPDLOG_LOGGER_DEBUG(ctx.applicationLogger, "Loaded mirror configuration \"{}\"", configurationPath);
+    ctx.mirrors = rewriter;
+
+    return true;
+}
+
+
+vector<string> GetMirrorUrls(application_context& ctx, const string& remoteUrl) {
+    return ctx.mirrors ? ctx.mirrors->MirrorsOf(remoteUrl) : vector<string>();
+}
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <filesystem>
+#include <sstream>
+
+#include "spdlog/sinks/ostream_sink.h"
+
+#include "configuration_io.hpp"
+#include "thread_pool.hpp"
+#include "validation.hpp"
+
+
+namespace fs = std::filesystem;
+
+
+// Hidden directories, and the `target` directories `ldh` itself creates next to manifests (whose checkouts carry
+// manifests of their own). A `target` directory that is not next to a manifest is just part of the tree.
+bool IsSkippedDirectory(const fs::path& directory) {
+    string name = directory.filename().string();
+    if (name.size() > 1 && name[0] == '.') {
+        return true;
+    }
+
+    std::error_code statusError;
+    return name == "target" && fs::exists(directory.parent_path() / MANIFEST_FILE_NAME, statusError);
+}
+
+
+bool DiscoverManifests(application_context& ctx, const vector<string>& paths, vector<string>& manifests) {
+    bool allFound = true;
+
+    for (const string& path : paths) {
+        std::error_code statusError;
+        if (!fs::is_directory(path, statusError)) {
+            if (!fs::exists(path, statusError)) {
+                ctx.userLogger->error("File not found: \"{}\"", path);
+                allFound = false;
+                continue;
+            }
+
+            manifests.push_back(path);
+            continue;
+        }
+
+        size_t manifestsBefore = manifests.size();
+
+        std::error_code iterationError;
+        fs::recursive_directory_iterator entries(path, fs::directory_options::skip_permission_denied, iterationError);
+        for (; !iterationError && entries != fs::recursive_directory_iterator(); entries.increment(iterationError)) {
+            if (entries->is_directory(statusError)) {
+                if (IsSkippedDirectory(entries->path())) {
+                    entries.disable_recursion_pending();
+                }
+                continue;
+            }
+
+            if (entries->path().filename() == MANIFEST_FILE_NAME) {
+                manifests.push_back(entries->path().string());
+            }
+        }
+
+        if (iterationError) {
+            ctx.userLogger->error("Failed while searching \"{}\" for manifests: {}", path, iterationError.message());
+            allFound = false;
+        }
+
+        // directory iteration order is unspecified, reports should not be
+        sort(manifests.begin() + manifestsBefore, manifests.end());
+    }
+
+    return allFound;
+}
+
+
+// Runs on a pool thread, with its own context whose loggers collect this manifest's diagnostics only.
+void ValidateManifest(application_context& ctx, manifest_validation& validation) {
+    ostringstream diagnosticsStream;
+    logger_ptr diagnosticsLogger = make_shared<logger_type>(validation.configurationFilePath,
+        make_shared<spdlog::sinks::ostream_sink_st>(diagnosticsStream));
+    diagnosticsLogger->set_pattern("    [%l]: %v");
+
+    execution_arguments manifestArgs = *ctx.args;
+    manifestArgs.configurationFilePath = validation.configurationFilePath;
+
+    application_context manifestCtx = ctx;
+    manifestCtx.args = &manifestArgs;
+    manifestCtx.applicationLogger = diagnosticsLogger;
+    manifestCtx.userLogger = diagnosticsLogger;
+
+    try {
+        configuration config;
+        validation.valid = ParseAndCheckConfiguration(manifestCtx, validation.configurationFilePath,
+                                                      configuration_modes::CONFIGURATION_MODE_INPUT, config);
+    } catch (const toml::parse_error& parseError) {
+        diagnosticsLogger->error("{} (line {}, column {})", parseError.description(),
+                                 parseError.source().begin.line, parseError.source().begin.column);
+        validation.valid = false;
+    }
+
+    diagnosticsLogger->flush();
+    validation.diagnostics = diagnosticsStream.str();
+}
+
+
+bool ValidateManifests(application_context& ctx, const vector<string>& paths) {
+    vector<string> manifests;
+    bool allValid = DiscoverManifests(ctx, paths, manifests);
+
+    if (manifests.empty()) {
+        ctx.userLogger->error("No manifests to validate");
+        return false;
+    }
+
+    vector<manifest_validation> validations(manifests.size());
+    {
+        thread_pool pool(min(manifests.size(), thread_pool::DefaultWorkerCount()));
+        for (size_t i = 0; i < manifests.size(); i++) {
+            validations[i].configurationFilePath = manifests[i];
+
+            pool.Submit([&ctx, &validation = validations[i]] {
+                ValidateManifest(ctx, validation);
+            });
+        }
+        pool.Wait();
+    }
+
+    size_t invalidManifests = 0;
+    for (manifest_validation& validation : validations) {
+        if (validation.valid) {
+            ctx.userLogger->info("\"{}\" OK", validation.configurationFilePath);
+            continue;
+        }
+
+        invalidManifests++;
+
+        string& diagnostics = validation.diagnostics;
+        if (!diagnostics.empty() && diagnostics.back() == '\n') {
+            diagnostics.pop_back();
+        }
+
+        if (diagnostics.empty()) {
+            ctx.userLogger->error("\"{}\" is invalid", validation.configurationFilePath);
+        } else {
+            ctx.userLogger->error("\"{}\" is invalid:\n{}", validation.configurationFilePath, diagnostics);
+        }
+    }
+
+    if (validations.size() > 1) {
+        ctx.userLogger->info("Validated {} manifests, {} invalid", validations.size(), invalidManifests);
+    }
+
+    return allValid && invalidManifests == 0;
+}
@@ -0,0 +1,246 @@
+#include <algorithm>
+#include <filesystem>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "build_stamps.hpp"
+#include "dependency_resolver.hpp"
+#include "file_lock.hpp"
+#include "lock_registry.hpp"
+#include "thread_pool.hpp"
+#include "workspace.hpp"
+
+
+namespace fs = std::filesystem;
+
+
+bool ParseWorkspace(application_context& ctx, string& workspaceFilePath, vector<workspace_member>& members) {
+    if (!fs::exists(workspaceFilePath)) {
+        ctx.applicationLogger->error("File not found: \"{}\"", workspaceFilePath);
+        return false;
+    }
+
+    dict_like_config workspaceDict = toml::parse_file(workspaceFilePath);
+    toml::array* memberEntries = workspaceDict["workspace"]["members"].as_array();
+    if (!memberEntries) {
+        ctx.userLogger->error("Workspace \"{}\" has no `workspace.members` list", workspaceFilePath);
+        return false;
+    }
+
+    fs::path workspaceRoot = fs::path(workspaceFilePath).parent_path();
+    for (auto&& entry : *memberEntries) {
+        string memberEntry = entry.value_or("");
+        if (memberEntry.empty()) {
+            ctx.userLogger->error("Workspace \"{}\" has an invalid member entry", workspaceFilePath);
+            return false;
+        }
+
+        fs::path memberPath = workspaceRoot / memberEntry;
+        if (fs::is_directory(memberPath)) {
+            memberPath /= "ldh.toml";
+        }
+
+        workspace_member& member = members.emplace_back();
+        member.configurationFilePath = memberPath.string();
+        member.lockFilePath = GenerateLockFilePath(member.configurationFilePath);
+        member.parsed = false;
+    }
+
+    // every member gets its own copy of the context, so that lock file lookups go to that member's lock.
+    thread_pool pool;
+    for (workspace_member& member : members) {
+        pool.Submit([&ctx, &member] {
+            execution_arguments memberArgs = *ctx.args;
+            memberArgs.configurationFilePath = member.configurationFilePath;
+            memberArgs.lockFilePath = member.lockFilePath;
+
+            application_context memberCtx = ctx;
+            memberCtx.args = &memberArgs;
+
+            configuration_modes mode = configuration_modes::CONFIGURATION_MODE_INPUT |
+                configuration_modes::CONFIGURATION_MODE_OUTPUT;
+            try {
+                member.parsed = ParseAndCheckConfiguration(memberCtx, member.configurationFilePath, mode,
+                                                           member.config);
+            } catch (const toml::parse_error& parseError) {
+                // thrown past a pool job, it would terminate the process
+                ctx.userLogger->error("Failed while parsing \"{}\": {} (line {}, column {})",
+                                      member.configurationFilePath, parseError.description(),
+                                      parseError.source().begin.line, parseError.source().begin.column);
+                member.parsed = false;
+            }
+        });
+    }
+    pool.Wait();
+
+    bool allParsed = true;
+    for (workspace_member& member : members) {
+        if (!member.parsed) {
+            ctx.userLogger->error("Workspace member \"{}\" is invalid", member.configurationFilePath);
+            allParsed = false;
+        }
+    }
+
+    return allParsed;
+}
+
+
+// Where a dependency comes from, regardless of which version of it is wanted.
+string DependencySourceIdentity(dependency& dep) {
+    input_dependency& input = dep.inputDependency;
+
+    string identity;
+    identity.append(SourceTypeToString(input.sourceType)).push_back('\0');
+    identity.append(input.source);
+
+    return identity;
+}
+
+
+// Two dependencies with the same identity resolve to the same checkout, regardless of which member declared them.
+string DependencyIdentity(dependency& dep) {
+    input_dependency& input = dep.inputDependency;
+
+    string identity = DependencySourceIdentity(dep);
+    identity.push_back('\0');
+    identity.append(to_string((unsigned) input.specifiedVersion.type)).push_back('\0');
+    identity.append(input.specifiedVersion.exact).push_back('\0');
+    identity.append(input.specifiedVersion.versionRange);
+
+    return identity;
+}
+
+
+void DeleteUnusedDependencies(application_context& ctx, vector<workspace_member>& members) {
+    unordered_set<string> pathsInUse;
+    for (workspace_member& member : members) {
+        for (dependency& dep : member.config.dependencies) {
+            if (dep.inputDependency.HasValue() && !dep.lockDependency.localPath.empty()) {
+                pathsInUse.insert(dep.lockDependency.localPath);
+            }
+        }
+    }
+
+    unordered_set<string> deletedPaths;
+    for (workspace_member& member : members) {
+        for (dependency& dep : member.config.dependencies) {
+            if (dep.inputDependency.HasValue()) {
+                continue;
+            }
+
+            string& localPath = dep.lockDependency.localPath;
+            if (pathsInUse.count(localPath)) {
+                SPDLOG_LOGGER_DEBUG(ctx.applicationLogger, "Keeping \"{}\", still used by another member", localPath);
+            } else if (!deletedPaths.count(localPath)) {
+                if (!DeleteDependency(ctx, dep)) {
+                    ctx.applicationLogger->warn("Resolution of \"{}\" failed.", dep.name);
+                    continue;
+                }
+
+                deletedPaths.insert(localPath);
+            }
+
+            dep.lockDependency = lock_dependency();
+        }
+
+        vector<dependency>& dependencies = member.config.dependencies;
+        dependencies.erase(remove_if(dependencies.begin(), dependencies.end(), [](dependency& dep) {
+            return !dep.inputDependency.HasValue() && !dep.lockDependency.HasValue();
+        }), dependencies.end());
+    }
+}
+
+
+bool UpdateWorkspace(application_context& ctx, string& workspaceFilePath) {
+    vector<workspace_member> members;
+    {
+        phase_timer parseTimer(ctx.metrics, "parse");
+        if (!ParseWorkspace(ctx, workspaceFilePath, members)) {
+            return false;
+        }
+    }
+
+    // merge all members' dependencies, so that each unique one is resolved exactly once. Representatives start
+    // without a lock entry, so that a failed resolution cannot leak one member's previous lock into another's.
+    unordered_map<string, size_t> uniqueIndexByIdentity;
+    vector<dependency> uniqueDependencies;
+    size_t totalDependencyCount = 0;
+
+    // checkouts are named after dependencies (`name-version`), so same-named dependencies from different sources
+    // could end up in (and overwrite) each other's checkout
+    unordered_map<string, pair<string, workspace_member*>> sourceByName;
+
+    for (workspace_member& member : members) {
+        for (dependency& dep : member.config.dependencies) {
+            if (!dep.inputDependency.HasValue()) {
+                continue;
+            }
+
+            auto [firstUse, firstSeen] = sourceByName.emplace(dep.name, make_pair(DependencySourceIdentity(dep),
+                                                                                  &member));
+            if (!firstSeen && firstUse->second.first != DependencySourceIdentity(dep)) {
+                ctx.userLogger->error("Workspace members \"{}\" and \"{}\" both depend on \"{}\", but from different "
+                                      "sources", firstUse->second.second->configurationFilePath,
+                                      member.configurationFilePath, dep.name);
+                return false;
+            }
+
+            totalDependencyCount++;
+            auto [_, inserted] = uniqueIndexByIdentity.emplace(DependencyIdentity(dep), uniqueDependencies.size());
+            if (inserted) {
+                dependency& representative = uniqueDependencies.emplace_back(dep);
+                representative.lockDependency = lock_dependency();
+            }
+        }
+    }
+
+    // keeps `ldh gc` away from checkouts until the lock files referring to them are registered
+    file_lock projectLock;
+    if (!LockProject(ctx, projectLock, file_lock_mode::FILE_LOCK_SHARED)) {
+        return false;
+    }
+
+    ctx.userLogger->info("Resolving {} unique dependencies ({} total) for {} workspace members",
+                         uniqueDependencies.size(), totalDependencyCount, members.size());
+    {
+        phase_timer resolveTimer(ctx.metrics, "resolve");
+        ResolveDependencies(ctx, uniqueDependencies);
+    }
+
+    for (workspace_member& member : members) {
+        for (dependency& dep : member.config.dependencies) {
+            if (!dep.inputDependency.HasValue()) {
+                continue;
+            }
+
+            dependency& representative = uniqueDependencies[uniqueIndexByIdentity[DependencyIdentity(dep)]];
+            if (representative.lockDependency.HasValue()) {
+                dep.lockDependency = representative.lockDependency;
+            }
+        }
+    }
+
+    {
+        phase_timer deleteTimer(ctx.metrics, "delete");
+        DeleteUnusedDependencies(ctx, members);
+    }
+
+    phase_timer writeLockTimer(ctx.metrics, "write_lock");
+    bool allWritten = true;
+    for (workspace_member& member : members) {
+        if (!WriteConfiguration(ctx, member.lockFilePath, member.config)) {
+            ctx.applicationLogger->error("Failed while writing lock file to \"{}\"", member.lockFilePath);
+            allWritten = false;
+            continue;
+        }
+
+        RegisterLockFile(ctx, member.lockFilePath);
+
+        if (!WriteBuildStamps(ctx, member.lockFilePath, member.config.dependencies)) {
+            ctx.userLogger->error("Failed while writing dependency stamps for \"{}\"", member.lockFilePath);
+            allWritten = false;
+        }
+    }
+
+    return allWritten;
+}
@@ -0,0 +1,150 @@
+/* Replays lock journals written by `lock_journal` (see `include/lock_journal.hpp`) on top of lock entries, the way
+ * an update resuming after an interruption does.
+ *
+ * Usage:
+ *     make test
+ *
+ * Each check prints a line; the exit code is the number of failed checks.
+ */
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "application_context.hpp"
+#include "lock_journal.cpp"
+#include "logger_manager.hpp"
+
+
+namespace fs = std::filesystem;
+
+
+dependency MakeEntry(const string& name, const string& version) {
+    dependency entry;
+    entry.name = name;
+    entry.lockDependency.resolvedVersion = version;
+    entry.lockDependency.resolvedSource = "git+https://example.com/" + name + ".git";
+    entry.lockDependency.localPath = application_context::dependencyPathPrefix + name + "-" + version;
+
+    return entry;
+}
+
+
+// Journals `records` (the dependency and whether it was deleted) for `lockFilePath`, as an interrupted run would
+// have, and replays them on top of `lockEntries`.
+bool JournalAndReplay(application_context& ctx, const string& lockFilePath, vector<pair<dependency, bool>> records,
+                      vector<dependency>& lockEntries) {
+    lock_journal* journal = OpenLockJournal(ctx, lockFilePath);
+    if (!journal) {
+        return false;
+    }
+
+    for (auto& [dep, deleted] : records) {
+        if (deleted) {
+            string localPath = dep.lockDependency.localPath;
+            dep.lockDependency = lock_dependency();
+            journal->RecordDeleted(ctx, dep, localPath);
+        } else {
+            journal->RecordResolved(ctx, dep);
+        }
+    }
+    delete journal;
+
+    bool replayed = ReplayLockJournal(ctx, lockFilePath, lockEntries);
+
+    std::error_code removalError;
+    fs::remove(GetLockJournalPath(lockFilePath), removalError);
+
+    return replayed;
+}
+
+
+bool HasEntry(vector<dependency>& lockEntries, const string& name, const string& version) {
+    for (dependency& entry : lockEntries) {
+        if (entry.name == name) {
+            return entry.lockDependency.resolvedVersion == version &&
+                entry.lockDependency.localPath == MakeEntry(name, version).lockDependency.localPath;
+        }
+    }
+
+    return false;
+}
+
+
+int Report(const char* name, bool passed) {
+    printf("%s %s\n", passed ? "ok  " : "FAIL", name);
+    return passed ? 0 : 1;
+}
+
+
+int main(int argc, char* argv[]) {
+    application_context ctx = application_context();
+    ctx.binaryName = string(argc > 0 ? argv[0] : "ldh-test");
+    ctx.applicationLogger = logger_manager::GetInstance()->GetLogger(APPLICATION_LOGGER_NAME);
+    ctx.userLogger = logger_manager::GetInstance()->GetLogger(USER_LOGGER_NAME);
+    ctx.args = new execution_arguments();
+
+    string scratchDirectory = (fs::temp_directory_path() / ("ldh-test." + to_string(getpid()))).string();
+    fs::create_directories(scratchDirectory);
+    string lockFilePath = scratchDirectory + "/ldh.lock";
+
+    int failures = 0;
+
+    // 1) a version bump: the new version is resolved, then the old one's checkout deleted
+    {
+        vector<dependency> lockEntries = { MakeEntry("foo", "1.0"), MakeEntry("bar", "1.0") };
+        bool replayed = JournalAndReplay(ctx, lockFilePath, { { MakeEntry("foo", "2.0"), false },
+                                                              { MakeEntry("foo", "1.0"), true } }, lockEntries);
+
+        failures += Report("version bump replays", replayed);
+        failures += Report("version bump keeps the new version", HasEntry(lockEntries, "foo", "2.0"));
+        failures += Report("version bump keeps the other entries", HasEntry(lockEntries, "bar", "1.0"));
+        failures += Report("version bump leaves a single entry", lockEntries.size() == 2);
+    }
+
+    // 2) the same, with the old checkout deleted first
+    {
+        vector<dependency> lockEntries = { MakeEntry("foo", "1.0") };
+        JournalAndReplay(ctx, lockFilePath, { { MakeEntry("foo", "1.0"), true }, { MakeEntry("foo", "2.0"), false } },
+                         lockEntries);
+
+        failures += Report("deletion before resolution keeps the new version", HasEntry(lockEntries, "foo", "2.0") &&
+                           lockEntries.size() == 1);
+    }
+
+    // 3) a dependency dropped from the manifest
+    {
+        vector<dependency> lockEntries = { MakeEntry("foo", "1.0"), MakeEntry("bar", "1.0") };
+        JournalAndReplay(ctx, lockFilePath, { { MakeEntry("foo", "1.0"), true } }, lockEntries);
+
+        failures += Report("deletion drops the entry", !HasEntry(lockEntries, "foo", "1.0") &&
+                           HasEntry(lockEntries, "bar", "1.0") && lockEntries.size() == 1);
+    }
+
+    // 4) a torn last record is ignored
+    {
+        vector<dependency> lockEntries = { MakeEntry("foo", "1.0") };
+        {
+            lock_journal* journal = OpenLockJournal(ctx, lockFilePath);
+            dependency bumped = MakeEntry("foo", "2.0");
+            journal->RecordResolved(ctx, bumped);
+            journal->Append(ctx, "-\tfoo\t" + bumped.lockDependency.localPath);
+            delete journal;
+
+            fs::resize_file(GetLockJournalPath(lockFilePath), fs::file_size(GetLockJournalPath(lockFilePath)) - 1);
+        }
+        ReplayLockJournal(ctx, lockFilePath, lockEntries);
+
+        std::error_code removalError;
+        fs::remove(GetLockJournalPath(lockFilePath), removalError);
+
+        failures += Report("torn deletion is ignored", HasEntry(lockEntries, "foo", "2.0"));
+    }
+
+    std::error_code removalError;
+    fs::remove_all(scratchDirectory, removalError);
+
+    return failures;
+}